@@ -0,0 +1,122 @@
+/*
+** Region (bump) allocator.
+** One arena lives for a whole compilation; everything in it is freed by a single reset.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define ARENA_ALIGN     16
+/*}=======================*/
+
+#define align_up(_n) (((_n) + (ARENA_ALIGN-1)) & ~(size_t)(ARENA_ALIGN-1))
+
+/*
+** Allocates a new block able to hold at least <min> bytes.
+*/
+static ArenaBlock* create_block(size_t min) {
+    ArenaBlock* blk = malloc(sizeof(ArenaBlock) + min);
+    if (blk == NULL) {
+        fprintf(stderr, "arena.c: Out of memory.\n");
+        exit(1);
+    }
+    blk->next = NULL;
+    blk->siz = 0;
+    blk->cap = min;
+    return blk;
+}
+
+/*
+** API
+*/
+Arena* arena_create(size_t block_siz) {
+    Arena* a = malloc(sizeof(Arena));
+    a->block_siz = align_up(block_siz);
+    a->first = create_block(a->block_siz);
+    a->cur = a->first;
+    a->last_alloc = NULL;
+    return a;
+}
+
+void* arena_alloc(Arena* a, size_t siz) {
+    siz = align_up(siz);
+
+    /* walk the already owned blocks (kept around after a reset) before making a new one */
+    while (a->cur->siz + siz > a->cur->cap) {
+        if (a->cur->next == NULL || a->cur->next->cap < siz) {
+            ArenaBlock* blk = create_block(siz > a->block_siz ? siz : a->block_siz);
+            blk->next = a->cur->next;
+            a->cur->next = blk;
+        }
+        a->cur = a->cur->next;
+        a->cur->siz = 0;
+    }
+
+    void* ptr = a->cur->data + a->cur->siz;
+    a->cur->siz += siz;
+    a->last_alloc = ptr;
+    return ptr;
+}
+
+void* arena_realloc(Arena* a, void* ptr, size_t old_siz, size_t new_siz) {
+    if (ptr == NULL)
+        return arena_alloc(a, new_siz);
+    if (new_siz <= old_siz)
+        return ptr;
+
+    /* the most recent allocation can just grow in place */
+    if (ptr == a->last_alloc) {
+        size_t start = (char*)ptr - a->cur->data;
+        if (start + align_up(new_siz) <= a->cur->cap) {
+            a->cur->siz = start + align_up(new_siz);
+            return ptr;
+        }
+    }
+
+    void* x = arena_alloc(a, new_siz);
+    memcpy(x, ptr, old_siz);
+    return x;
+}
+
+char* arena_strdup(Arena* a, const char* str) {
+    size_t len = strlen(str);
+    char* x = arena_alloc(a, len+1);
+    memcpy(x, str, len+1);
+    return x;
+}
+
+/*
+** Open addressing tables grow into a zeroed array <growth> times bigger, then every old slot
+** is handed to <place>, which puts it back if it is taken. <slots> is the address of the table's slot pointer.
+*/
+void arena_grow_slots(Arena* a, void* slots, size_t* cap, size_t growth, size_t size, void (*place)(void* table, const void* slot), void* table) {
+    const char* old;
+    memcpy(&old, slots, sizeof(old));
+    const size_t old_cap = *cap;
+
+    *cap *= growth;
+    void* fresh = arena_alloc(a, size*(*cap));
+    memset(fresh, 0, size*(*cap));
+    memcpy(slots, &fresh, sizeof(fresh));
+    for (size_t i = 0; i < old_cap; i++)
+        place(table, old + i*size);
+}
+
+void arena_reset(Arena* a) {
+    /* blocks are kept, so repeated compilations stay at the same footprint */
+    a->cur = a->first;
+    a->cur->siz = 0;
+    a->last_alloc = NULL;
+}
+
+void arena_free(Arena* a) {
+    ArenaBlock* blk = a->first;
+    while (blk != NULL) {
+        ArenaBlock* next = blk->next;
+        free(blk);
+        blk = next;
+    }
+    free(a);
+}
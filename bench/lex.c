@@ -0,0 +1,55 @@
+/*
+** Lexer throughput, lex_generate only, in source bytes per cycle.
+** Best of LEX_BENCH_RUNS per scan level, the tokens are dropped with the arena between runs.
+** Built by bench/run.sh with -DDEBUG_PRINT_TOKENS=0, x86-64 only (rdtsc).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <x86intrin.h>
+#include "head.h"
+
+/* config */
+#define LEX_BENCH_RUNS          7
+/*}=======================*/
+
+static const char* LEVEL_NAMES[] = {[ScanScalar] = "scalar", [ScanSSE2] = "sse2", [ScanAVX2] = "avx2"};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file>\n", argv[0]);
+        return 1;
+    }
+    FILE* f = fopen(argv[1], "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: can't open %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    const size_t len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* txt = malloc(len);
+    if (txt == NULL || fread(txt, 1, len, f) != len) {
+        fprintf(stderr, "%s: can't read %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    fclose(f);
+
+    Arena* arena = arena_create(1 << 20);
+    logger_init(txt, len, argv[1]);
+    printf("%-24s %6.1f MB", argv[1], len/1e6);
+    for (int level = ScanScalar; level <= ScanAVX2; level++) {
+        scan_init((ScanLevel)level);
+        unsigned long long best = ~0ull;
+        for (int r = 0; r < LEX_BENCH_RUNS; r++) {
+            const unsigned long long t0 = __rdtsc();
+            lex_generate(txt, len, arena);
+            const unsigned long long t1 = __rdtsc();
+            if (t1-t0 < best)
+                best = t1-t0;
+            arena_reset(arena);
+        }
+        printf("  %s %.3f", LEVEL_NAMES[level], (double)len/best);
+    }
+    printf(" bytes/cycle\n");
+    return 0;
+}
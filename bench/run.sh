@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Benchmarks the performance notes in the history were measured with:
+#   lexer      bench/lex.c over generated sources, each scan level (scan.c)
+#   registers  bench/fib.sn, fib with a polynomial at every leaf (regalloc.c)
+#   output     bench/print.sn, a million printed lines, and bench/one.sn (runtime.c)
+# The lexer is built from the sources next to this script with CC (gcc).
+# x86-64 Linux only, like the programs pya builds.
+#
+PYA=${1:-./pya}
+CC=${CC:-gcc}
+DIR=$(dirname "$0")
+SRC=$DIR/..
+TMP=${TMPDIR:-/tmp}/pya-bench.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+$CC -O2 -o "$TMP/trace" "$DIR/trace.c" || exit 1
+$CC -O2 -DDEBUG_PRINT_TOKENS=0 -I"$SRC" -o "$TMP/lex" "$DIR/lex.c" \
+    "$SRC/lex.c" "$SRC/scan.c" "$SRC/arena.c" "$SRC/intern.c" "$SRC/log.c" "$SRC/buffer.c" -pthread || exit 1
+
+echo "== lexer"
+awk 'BEGIN {
+    for (i = 0; i < 200000; i++) {
+        printf "# this is a fairly long line comment describing the code below it, number %d\n", i
+        printf "x%d = %d\n", i % 50, i
+        if (i % 100 == 0) {
+            print "'"'''"'"
+            for (j = 0; j < 5; j++)
+                print "multi line comment body text that goes on and on"
+            print "'"'''"'"
+        }
+    }
+}' > "$TMP/comments.sn"
+awk 'BEGIN {
+    for (i = 0; i < 300000; i++)
+        printf "# this is a fairly long line comment describing the code below it, number %d\n", i
+}' > "$TMP/pure.sn"
+awk 'BEGIN {
+    q = sprintf("%c", 39)
+    for (i = 0; i < 200000; i++) {
+        printf "s%d = \"a reasonably long string literal body with some words in it %d\"\n", i % 50, i
+        if (i % 10 == 0)
+            printf "t = %sescaped \\%squote\\%s and \\n newline in the body of this string%s\n", q, q, q, q
+    }
+}' > "$TMP/strings.sn"
+awk 'BEGIN {
+    for (i = 0; i < 200000; i++)
+        printf "    some_long_identifier_name_%d, another_long_identifier = value_of_something_%d\n", i, i
+}' > "$TMP/idents.sn"
+for input in comments pure strings idents; do
+    (cd "$TMP" && ./lex "$input.sn")
+done
+
+echo "== registers"
+"$PYA" -o "$TMP/fib" "$DIR/fib.sn" >/dev/null || exit 1
+sed 's/fib(32)/fib(20)/' "$DIR/fib.sn" > "$TMP/fib20.sn"
+"$PYA" -o "$TMP/fib20" "$TMP/fib20.sn" >/dev/null || exit 1
+printf 'fib(32): '
+"$TMP/trace" time 3 "$TMP/fib" >/dev/null
+printf 'fib(20): '
+"$TMP/trace" steps "$TMP/fib20" >/dev/null
+
+echo "== output"
+"$PYA" -o "$TMP/print" "$DIR/print.sn" >/dev/null || exit 1
+"$PYA" -o "$TMP/one" "$DIR/one.sn" >/dev/null || exit 1
+printf '1,000,000 lines to a file: '
+"$TMP/trace" time 3 "$TMP/print" >"$TMP/print.out"
+printf '1,000,000 lines to a file: '
+"$TMP/trace" syscalls "$TMP/print" >"$TMP/print.out"
+printf 'print(1): '
+"$TMP/trace" steps "$TMP/one" >/dev/null
+printf 'print(1) x1000: '
+"$TMP/trace" time 1000 "$TMP/one" >/dev/null
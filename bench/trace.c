@@ -0,0 +1,77 @@
+/*
+** Runs a program and reports on stderr, its own output goes where ours goes:
+**   trace steps <prog>       instructions executed (ptrace single steps)
+**   trace syscalls <prog>    system calls made
+**   trace time <n> <prog>    wall clock, best and total of <n> runs
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+/* stops of <prog> under <request>, 0 stops means it didn't run */
+static long count_stops(char** prog, enum __ptrace_request request) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        execv(prog[0], prog);
+        _exit(127);
+    }
+    int status;
+    long stops = 0;
+    waitpid(pid, &status, 0); /* stopped at the exec */
+    for (;;) {
+        ptrace(request, pid, NULL, NULL);
+        waitpid(pid, &status, 0);
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+            break;
+        stops++;
+    }
+    return stops;
+}
+
+static double run(char** prog) {
+    const double start = now();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        execv(prog[0], prog);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return now() - start;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 3 && strcmp(argv[1], "steps") == 0) {
+        fprintf(stderr, "%ld instructions\n", count_stops(&argv[2], PTRACE_SINGLESTEP));
+        return 0;
+    }
+    if (argc >= 3 && strcmp(argv[1], "syscalls") == 0) {
+        fprintf(stderr, "%ld syscalls\n", count_stops(&argv[2], PTRACE_SYSCALL)/2); /* entry and exit */
+        return 0;
+    }
+    if (argc >= 4 && strcmp(argv[1], "time") == 0) {
+        const int runs = atoi(argv[2]);
+        double best = 1e9, total = 0;
+        for (int i = 0; i < runs; i++) {
+            const double t = run(&argv[3]);
+            total += t;
+            if (t < best)
+                best = t;
+        }
+        fprintf(stderr, "best %.1f ms, %d runs %.2f s\n", best*1e3, runs, total);
+        return 0;
+    }
+    fprintf(stderr, "usage: %s steps|syscalls <prog> | time <n> <prog>\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,327 @@
+/*
+** ELF64 writer.
+** Takes the encoded machine code and writes either a relocatable object for other linkers,
+** or a static executable linked in process: one read/execute segment with the headers, .text
+** and .rodata, one read/write segment for .bss.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define ELF_BASE_ADDRESS        0x400000
+#define ELF_PAGE                0x1000
+/*}=======================*/
+
+/* the parts of the spec that are used */
+#define ET_REL          1
+#define ET_EXEC         2
+#define EM_X86_64       62
+#define SHT_PROGBITS    1
+#define SHT_SYMTAB      2
+#define SHT_STRTAB      3
+#define SHT_RELA        4
+#define SHT_NOBITS      8
+#define SHF_WRITE       0x1
+#define SHF_ALLOC       0x2
+#define SHF_EXECINSTR   0x4
+#define SHF_INFO_LINK   0x40
+#define STB_LOCAL       0
+#define STB_GLOBAL      1
+#define STT_NOTYPE      0
+#define STT_OBJECT      1
+#define STT_FUNC        2
+#define STT_SECTION     3
+#define PT_LOAD         1
+#define PF_X            1
+#define PF_W            2
+#define PF_R            4
+#define R_X86_64_PC32   2
+
+typedef struct Elf64Header {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} Elf64Header;
+
+typedef struct Elf64Section {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} Elf64Section;
+
+typedef struct Elf64Segment {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+} Elf64Segment;
+
+typedef struct Elf64Symbol {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} Elf64Symbol;
+
+typedef struct Elf64Rela {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+} Elf64Rela;
+
+/* section indices, both files use the same table */
+enum {
+    SEC_Null, SEC_Text, SEC_Rodata, SEC_Bss, SEC_Symtab, SEC_Strtab, SEC_Shstrtab, SEC_Rela,
+};
+static const char SHSTRTAB[] = "\0.text\0.rodata\0.bss\0.symtab\0.strtab\0.shstrtab\0.rela.text";
+static const uint32_t SHSTRTAB_NAMES[] = {0, 1, 7, 15, 20, 28, 36, 46};
+static const uint16_t SECTION_OF[] = {[MS_Text] = SEC_Text, [MS_Rodata] = SEC_Rodata, [MS_Bss] = SEC_Bss};
+
+/* symbols of both files: the section symbols, the named labels, then the globals */
+typedef struct ElfSymbols {
+    Elf64Symbol* v;
+    uint32_t siz;
+    uint32_t first_global;
+    char* names;
+    uint32_t names_siz;
+} ElfSymbols;
+
+#define is_local_label(_l) ((_l)->len >= 2 && (_l)->name[0] == '.' && (_l)->name[1] == 'L')
+
+static ElfSymbols build_symbols(const MachineCode* mc, const uint64_t* base) {
+    ElfSymbols s = {0};
+    uint32_t names_cap = 1;
+    for (size_t i = 0; i < mc->labels.siz; i++)
+        names_cap += mc->labels.v[i].len+1;
+    s.v = arena_alloc(mc->arena, sizeof(Elf64Symbol)*(mc->labels.siz+4));
+    s.names = arena_alloc(mc->arena, names_cap);
+    s.names[s.names_siz++] = '\0';
+
+    s.v[s.siz++] = (Elf64Symbol){0};
+    for (uint16_t sec = SEC_Text; sec <= SEC_Bss; sec++)
+        s.v[s.siz++] = (Elf64Symbol){.info = STT_SECTION, .shndx = sec, .value = base[sec]};
+    for (int global = 0; global <= 1; global++) {
+        if (global)
+            s.first_global = s.siz;
+        for (size_t i = 0; i < mc->labels.siz; i++) {
+            const MLabel* l = &mc->labels.v[i];
+            if (l->global != global || is_local_label(l))
+                continue;
+            s.v[s.siz++] = (Elf64Symbol){
+                .name = s.names_siz,
+                .info = (uint8_t)((global ? STB_GLOBAL : STB_LOCAL) << 4 | (l->section == MS_Text ? STT_FUNC : STT_OBJECT)),
+                .shndx = SECTION_OF[l->section],
+                .value = base[SECTION_OF[l->section]] + l->offset,
+            };
+            memcpy(s.names + s.names_siz, l->name, l->len);
+            s.names_siz += l->len;
+            s.names[s.names_siz++] = '\0';
+        }
+    }
+    return s;
+}
+
+static void write_padding(FILE* out, uint64_t to) {
+    static const uint8_t zeros[64] = {0};
+    for (uint64_t at = (uint64_t)ftell(out); at < to; at += sizeof(zeros) < to-at ? sizeof(zeros) : to-at)
+        fwrite(zeros, 1, sizeof(zeros) < to-at ? sizeof(zeros) : to-at, out);
+}
+
+static Elf64Header header(uint16_t type) {
+    Elf64Header h = {
+        .ident = {0x7F, 'E', 'L', 'F', 2 /* 64 bit */, 1 /* little endian */, 1 /* version */, 0 /* System V */},
+        .type = type,
+        .machine = EM_X86_64,
+        .version = 1,
+        .ehsize = sizeof(Elf64Header),
+        .shentsize = sizeof(Elf64Section),
+        .shstrndx = SEC_Shstrtab,
+    };
+    return h;
+}
+
+#define align_up(_x, _a) (((_x) + (_a)-1) & ~(uint64_t)((_a)-1))
+
+/*
+** .symtab, .strtab, .shstrtab and the section headers after <offset>, <sections> already has the loaded ones.
+** Returns 0 on success.
+*/
+static int write_tables(FILE* out, const ElfSymbols* syms, Elf64Section* sections, uint16_t count, uint64_t offset, Elf64Header* h) {
+    sections[SEC_Symtab] = (Elf64Section){
+        .type = SHT_SYMTAB, .offset = align_up(offset, 8), .size = sizeof(Elf64Symbol)*syms->siz,
+        .link = SEC_Strtab, .info = syms->first_global, .addralign = 8, .entsize = sizeof(Elf64Symbol),
+    };
+    sections[SEC_Strtab] = (Elf64Section){
+        .type = SHT_STRTAB, .offset = sections[SEC_Symtab].offset + sections[SEC_Symtab].size, .size = syms->names_siz, .addralign = 1,
+    };
+    sections[SEC_Shstrtab] = (Elf64Section){
+        .type = SHT_STRTAB, .offset = sections[SEC_Strtab].offset + sections[SEC_Strtab].size, .size = sizeof(SHSTRTAB), .addralign = 1,
+    };
+    const uint64_t tables_end = sections[SEC_Shstrtab].offset + sections[SEC_Shstrtab].size;
+    h->shoff = align_up(tables_end, 8);
+    h->shnum = count;
+    for (uint16_t i = 0; i < count; i++)
+        sections[i].name = SHSTRTAB_NAMES[i];
+
+    write_padding(out, sections[SEC_Symtab].offset);
+    fwrite(syms->v, sizeof(Elf64Symbol), syms->siz, out);
+    fwrite(syms->names, 1, syms->names_siz, out);
+    fwrite(SHSTRTAB, 1, sizeof(SHSTRTAB), out);
+    write_padding(out, h->shoff);
+    fwrite(sections, sizeof(Elf64Section), count, out);
+    return ferror(out) != 0;
+}
+
+/*{==================================*/
+/*
+** API
+*/
+
+/*
+** Everything is laid out from offset 0 of each section, references to .rodata and .bss
+** become R_X86_64_PC32 relocations against their section symbols.
+*/
+int elf_write_object(const MachineCode* mc, const X86Object* obj, FILE* out) {
+    const uint64_t base[SEC_Rela+1] = {0};
+    ElfSymbols syms = build_symbols(mc, base);
+    Elf64Header h = header(ET_REL);
+    Elf64Section sections[SEC_Rela+1] = {0};
+
+    sections[SEC_Text] = (Elf64Section){
+        .type = SHT_PROGBITS, .flags = SHF_ALLOC | SHF_EXECINSTR,
+        .offset = sizeof(Elf64Header), .size = obj->text_size, .addralign = 16,
+    };
+    sections[SEC_Rodata] = (Elf64Section){
+        .type = SHT_PROGBITS, .flags = SHF_ALLOC,
+        .offset = align_up(sections[SEC_Text].offset + obj->text_size, 8), .size = obj->rodata_size, .addralign = 8,
+    };
+    sections[SEC_Bss] = (Elf64Section){
+        .type = SHT_NOBITS, .flags = SHF_ALLOC | SHF_WRITE,
+        .offset = sections[SEC_Rodata].offset + obj->rodata_size, .size = obj->bss_size, .addralign = 8,
+    };
+    fwrite(&h, sizeof(h), 1, out); /* written again once the section headers are placed */
+    fwrite(obj->text, 1, obj->text_size, out);
+    write_padding(out, sections[SEC_Rodata].offset);
+    fwrite(obj->rodata, 1, obj->rodata_size, out);
+
+    /* relocations, before the tables so the section headers stay last */
+    Elf64Rela* rela = arena_alloc(mc->arena, sizeof(Elf64Rela)*(obj->relocs_siz+1));
+    for (size_t i = 0; i < obj->relocs_siz; i++) {
+        const X86Reloc* r = &obj->relocs[i];
+        const MLabel* l = &mc->labels.v[r->label];
+        rela[i] = (Elf64Rela){
+            .offset = r->offset,
+            .info = (uint64_t)SECTION_OF[l->section] << 32 | R_X86_64_PC32, /* section symbols are 1..3 */
+            .addend = (int64_t)l->offset + r->addend,
+        };
+    }
+    sections[SEC_Rela] = (Elf64Section){
+        .type = SHT_RELA, .flags = SHF_INFO_LINK, .offset = align_up(sections[SEC_Bss].offset, 8),
+        .size = sizeof(Elf64Rela)*obj->relocs_siz, .link = SEC_Symtab, .info = SEC_Text, .addralign = 8, .entsize = sizeof(Elf64Rela),
+    };
+    write_padding(out, sections[SEC_Rela].offset);
+    fwrite(rela, sizeof(Elf64Rela), obj->relocs_siz, out);
+
+    if (write_tables(out, &syms, sections, SEC_Rela+1, sections[SEC_Rela].offset + sections[SEC_Rela].size, &h))
+        return 1;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, out);
+    return ferror(out) != 0;
+}
+
+/*
+** The file is mapped as it is: headers, .text and .rodata in the first segment,
+** .bss takes no space in the file and starts on the next page.
+*/
+int elf_write_executable(const MachineCode* mc, const X86Object* obj, FILE* out) {
+    Elf64Header h = header(ET_EXEC);
+    Elf64Segment segments[2];
+    Elf64Section sections[SEC_Shstrtab+1] = {0};
+    h.phoff = sizeof(Elf64Header);
+    h.phentsize = sizeof(Elf64Segment);
+    h.phnum = 2;
+
+    const uint64_t text_at = align_up(sizeof(Elf64Header) + sizeof(segments), 16);
+    const uint64_t rodata_at = align_up(text_at + obj->text_size, 8);
+    const uint64_t file_end = rodata_at + obj->rodata_size;
+    uint64_t base[SEC_Shstrtab+1] = {0};
+    base[SEC_Text] = ELF_BASE_ADDRESS + text_at;
+    base[SEC_Rodata] = ELF_BASE_ADDRESS + rodata_at;
+    const uint64_t bss_at = align_up(file_end, 8); /* words in .bss are aligned, tagged strings rely on it */
+    base[SEC_Bss] = align_up(ELF_BASE_ADDRESS + file_end, ELF_PAGE) + bss_at % ELF_PAGE; /* same offset in the page as in the file */
+
+    segments[0] = (Elf64Segment){
+        .type = PT_LOAD, .flags = PF_R | PF_X, .offset = 0, .vaddr = ELF_BASE_ADDRESS, .paddr = ELF_BASE_ADDRESS,
+        .filesz = file_end, .memsz = file_end, .align = ELF_PAGE,
+    };
+    segments[1] = (Elf64Segment){
+        .type = PT_LOAD, .flags = PF_R | PF_W, .offset = bss_at, .vaddr = base[SEC_Bss], .paddr = base[SEC_Bss],
+        .filesz = 0, .memsz = obj->bss_size, .align = ELF_PAGE,
+    };
+    h.entry = base[SEC_Text] + mc->labels.v[mc->entry].offset;
+
+    /* resolve what a linker would have */
+    uint8_t* text = arena_alloc(mc->arena, obj->text_size+1);
+    memcpy(text, obj->text, obj->text_size);
+    for (size_t i = 0; i < obj->relocs_siz; i++) {
+        const X86Reloc* r = &obj->relocs[i];
+        const MLabel* l = &mc->labels.v[r->label];
+        const int64_t value = (int64_t)(base[SECTION_OF[l->section]] + l->offset) + r->addend - (int64_t)(base[SEC_Text] + r->offset);
+        for (int k = 0; k < 4; k++)
+            text[r->offset + k] = (uint8_t)((uint64_t)value >> (k*8));
+    }
+
+    sections[SEC_Text] = (Elf64Section){
+        .type = SHT_PROGBITS, .flags = SHF_ALLOC | SHF_EXECINSTR, .addr = base[SEC_Text],
+        .offset = text_at, .size = obj->text_size, .addralign = 16,
+    };
+    sections[SEC_Rodata] = (Elf64Section){
+        .type = SHT_PROGBITS, .flags = SHF_ALLOC, .addr = base[SEC_Rodata],
+        .offset = rodata_at, .size = obj->rodata_size, .addralign = 8,
+    };
+    sections[SEC_Bss] = (Elf64Section){
+        .type = SHT_NOBITS, .flags = SHF_ALLOC | SHF_WRITE, .addr = base[SEC_Bss],
+        .offset = file_end, .size = obj->bss_size, .addralign = 8,
+    };
+    ElfSymbols syms = build_symbols(mc, base);
+
+    fwrite(&h, sizeof(h), 1, out);
+    fwrite(segments, sizeof(segments), 1, out);
+    write_padding(out, text_at);
+    fwrite(text, 1, obj->text_size, out);
+    write_padding(out, rodata_at);
+    fwrite(obj->rodata, 1, obj->rodata_size, out);
+
+    /* the section headers are only for tools like objdump */
+    if (write_tables(out, &syms, sections, SEC_Shstrtab+1, file_end, &h))
+        return 1;
+    fseek(out, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, out);
+    return ferror(out) != 0;
+}
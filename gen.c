@@ -0,0 +1,738 @@
+/*
+** x86-64 code generator.
+** Walks the IR and appends machine instructions (x86.c) for Linux, the program starts at _start and
+** talks to the kernel through syscalls, no libc.
+** Values live where regalloc.c put them, %rax, %rdx and %r11 are left free as scratch.
+** Values are kept sign or zero extended to 64 bits from their width.
+** With trap set, arithmetic and conversions that leave their type jump to the runtime instead of wrapping.
+** Dynamic values (IR_Dyn) get their integer case in line, everything else goes through the runtime.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "head.h"
+
+/* config */
+#define GEN_GROWTH 2
+/*}=======================*/
+
+static const uint8_t ARG_REGISTERS[IR_MAX_PARAMS] = {RDI, RSI, RDX, RCX, R8, R9};
+static const uint8_t CALLEE_SAVED[] = {RBX, R12, R13, R14, R15};
+
+/* brings a register back to the canonical form of the type after arithmetic, nothing for M_Label */
+static const struct {
+    uint8_t op;
+    uint8_t width;
+    uint8_t from; /* bytes read */
+} NORMALIZE[IR_TypeCount] = {
+    [IR_I8] = {M_Movsx, 8, 1}, [IR_I16] = {M_Movsx, 8, 2}, [IR_I32] = {M_Movsx, 8, 4},
+    [IR_U8] = {M_Movzx, 4, 1}, [IR_U16] = {M_Movzx, 4, 2}, [IR_U32] = {M_Mov, 4, 4},
+};
+
+/* setcc of each comparison, signed and unsigned */
+static const uint8_t SETCC[IR_OpCount][2] = {
+    [IR_Eq] = {CC_E, CC_E}, [IR_Ne] = {CC_NE, CC_NE},
+    [IR_Lt] = {CC_L, CC_B}, [IR_Le] = {CC_LE, CC_BE},
+    [IR_Gt] = {CC_G, CC_A}, [IR_Ge] = {CC_GE, CC_AE},
+};
+
+#define name_of(_gs, _sym) (int)symbol_len((_gs)->ir->symbols, _sym), symbol_name((_gs)->ir->symbols, _sym)
+#define type_of(_gs, _ref) ((IrType)(_gs)->ir->insts.v[_ref].type)
+
+#define gen_push(_arena, _arr, _val) do {                                                                           \
+    if ((_arr).siz + 1 > (_arr).cap) {                                                                              \
+        (_arr).v = arena_realloc(_arena, (_arr).v, sizeof(*(_arr).v)*(_arr).cap, sizeof(*(_arr).v)*(_arr).cap*GEN_GROWTH); \
+        (_arr).cap *= GEN_GROWTH;                                                                                   \
+    }                                                                                                               \
+    (_arr).v[(_arr).siz++] = (_val);                                                                                \
+} while (0)
+
+#define put(_gs, _op, _w, _src, _dst) x86_put((_gs)->mc, _op, _w, _src, _dst)
+#define place(_gs, _label) put(_gs, M_Label, 0, mo_label(_label), mo_none)
+
+/* instruction that needs its aux byte, a condition or the width of the source */
+static void put_aux(GenState* gs, MOp op, uint8_t width, uint8_t aux, MOperand src, MOperand dst) {
+    put(gs, op, width, src, dst);
+    gs->mc->insts.v[gs->mc->insts.siz-1].aux = aux;
+}
+
+/* label named after <fmt>, the name lives in the arena */
+static uint32_t new_label(GenState* gs, MSection section, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    char* name = arena_alloc(gs->arena, (size_t)len+1);
+    va_start(args, fmt);
+    vsnprintf(name, (size_t)len+1, fmt, args);
+    va_end(args);
+    return x86_label(gs->mc, section, name, (uint32_t)len);
+}
+
+/*
+** Locations, a register below 16 or else spill slot (loc - 16).
+*/
+#define LOC_SLOT(_slot) (16 + (_slot))
+#define is_reg(_loc) ((_loc) < 16)
+
+#define rel(_gs, _ref) ((_ref) - (_gs)->func->first_inst)
+#define use_pos(_gs, _at) (2*rel(_gs, _at))
+#define def_pos(_gs, _at) (2*rel(_gs, _at)+1)
+#define is_dead(_gs, _ref) ((_gs)->ra->segs_of[rel(_gs, _ref)] == IR_NONE)
+
+static uint32_t loc_of(GenState* gs, IrRef ref, uint32_t pos) {
+    uint8_t reg = regalloc_location(gs->ra, rel(gs, ref), pos);
+    return reg == RA_MEMORY ? LOC_SLOT(gs->ra->slots[rel(gs, ref)]) : reg;
+}
+
+static MOperand loc_operand(GenState* gs, uint32_t loc) {
+    if (is_reg(loc))
+        return mo_reg(loc);
+    return mo_mem(RBP, -(int64_t)(gs->pushed + loc-16 + 1)*8);
+}
+
+static void move(GenState* gs, uint32_t src, uint32_t dst) {
+    if (src == dst)
+        return;
+    if (!is_reg(src) && !is_reg(dst)) {
+        put(gs, M_Mov, 8, loc_operand(gs, src), mo_reg(RAX));
+        src = RAX;
+    }
+    put(gs, M_Mov, 8, loc_operand(gs, src), loc_operand(gs, dst));
+}
+
+/*
+** Moves that all happen at once, <src> and <dst> are taken apart.
+** Whatever can go without overwriting a pending source goes first, a cycle is broken through %r11.
+*/
+static void parallel_move(GenState* gs, uint32_t* src, uint32_t* dst, uint32_t n) {
+    while (n > 0) {
+        int moved = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            int blocked = 0;
+            for (uint32_t j = 0; j < n && !blocked; j++)
+                blocked = j != i && src[j] == dst[i];
+            if (blocked)
+                continue;
+            move(gs, src[i], dst[i]);
+            src[i] = src[n-1];
+            dst[i] = dst[n-1];
+            n--;
+            moved = 1;
+            break;
+        }
+        if (moved)
+            continue;
+        uint32_t saved = dst[0];
+        move(gs, saved, R11);
+        for (uint32_t j = 0; j < n; j++)
+            if (src[j] == saved)
+                src[j] = R11;
+    }
+}
+
+static void normalize(GenState* gs, uint8_t reg, IrType type) {
+    if (NORMALIZE[type].op != M_Label)
+        put_aux(gs, (MOp)NORMALIZE[type].op, NORMALIZE[type].width, NORMALIZE[type].from, mo_reg(reg), mo_reg(reg));
+}
+
+/*
+** Trap checks.
+** Wrapping arithmetic is done on all 64 bits and normalized after. With trap set it is done in the width
+** of the type instead, so the flags tell whether the result left it, or else on the extended values,
+** exact, and the result has to be canonical already.
+*/
+#define trap_if(_gs, _cc, _routine) put_aux(_gs, M_Jcc, 0, _cc, mo_label((_gs)->runtime.routines[_routine]), mo_none)
+#define WIDTH(_type) (NORMALIZE[_type].op == M_Label ? 8 : NORMALIZE[_type].from)
+/* flag of an add, sub or neg that left the type, neg sets the carry for anything but 0 */
+#define OVERFLOW_CC(_type) (ir_is_signed(_type) ? CC_O : CC_B)
+
+/* after an operation in the width of <type> on <reg>, 32 bit ones already zeroed the top */
+static void check_flag(GenState* gs, uint8_t reg, IrType type, X86Cond cc) {
+    trap_if(gs, cc, RT_Overflow);
+    if (type != IR_U32)
+        normalize(gs, reg, type);
+}
+
+/* <reg> holds an exact result */
+static void check_canonical(GenState* gs, uint8_t reg, IrType type) {
+    put_aux(gs, (MOp)NORMALIZE[type].op, NORMALIZE[type].width, NORMALIZE[type].from, mo_reg(reg), mo_reg(R11));
+    put(gs, M_Cmp, 8, mo_reg(R11), mo_reg(reg));
+    trap_if(gs, CC_NE, RT_Overflow);
+}
+
+static void emit_const(GenState* gs, uint32_t dst, uint64_t value) {
+    if (!is_reg(dst) && (int64_t)value != (int32_t)value) {
+        put(gs, M_MovAbs, 8, mo_imm(value), mo_reg(RAX));
+        move(gs, RAX, dst);
+    } else if (!is_reg(dst)) {
+        put(gs, M_Mov, 8, mo_imm(value), loc_operand(gs, dst));
+    } else if (value == 0) {
+        put(gs, M_Xor, 4, mo_reg(dst), mo_reg(dst));
+    } else if (value <= UINT32_MAX) {
+        put(gs, M_Mov, 4, mo_imm(value), mo_reg(dst));
+    } else if ((int64_t)value == (int32_t)value) {
+        put(gs, M_Mov, 8, mo_imm(value), mo_reg(dst));
+    } else {
+        put(gs, M_MovAbs, 8, mo_imm(value), mo_reg(dst));
+    }
+}
+
+static void emit_string(GenState* gs, Symbol str, uint8_t reg) {
+    if (gs->string_labels[str] == 0) {
+        const uint32_t label = new_label(gs, MS_Rodata, ".Ls%u", (uint32_t)gs->mc->strings.siz+1);
+        gen_push(gs->arena, gs->mc->strings, ((MString){.label = label, .text = str}));
+        gs->string_labels[str] = label+1;
+    }
+    put(gs, M_Lea, 8, mo_label(gs->string_labels[str]-1), mo_reg(reg));
+}
+
+/*
+** Moves on the edge <block> -> <target>: phi operands, and values that are in another register at the
+** start of the target than at the end of the block. Values in memory there need nothing, the slot is written at the definition.
+*/
+static uint32_t edge_moves(GenState* gs, uint32_t block, uint32_t target, uint32_t** src, uint32_t** dst) {
+    const IrModule* ir = gs->ir;
+    const IrBlock* bl = &ir->blocks.v[block];
+    const IrBlock* to = &ir->blocks.v[target];
+    const uint32_t end = use_pos(gs, bl->first + bl->count-1), start = use_pos(gs, to->first);
+
+    uint32_t n = 0, cap = (uint32_t)gs->ra->split.siz + to->count;
+    *src = arena_alloc(gs->arena, sizeof(uint32_t)*(cap+1));
+    *dst = arena_alloc(gs->arena, sizeof(uint32_t)*(cap+1));
+    for (IrRef at = to->first; ir->insts.v[at].op == IR_Phi; at++) {
+        const IrInst* phi = &ir->insts.v[at];
+        if (is_dead(gs, at))
+            continue;
+        for (uint32_t i = 0; i < phi->b; i++) {
+            if (ir->extra.v[phi->a + i*2] != block)
+                continue;
+            (*src)[n] = loc_of(gs, ir->extra.v[phi->a + i*2+1], end);
+            (*dst)[n++] = loc_of(gs, at, def_pos(gs, to->first)); /* all phis are defined there */
+        }
+    }
+    for (size_t i = 0; i < gs->ra->split.siz; i++) {
+        const IrRef v = gs->ra->split.v[i];
+        if (gs->ra->segs.v[gs->ra->segs_of[v]].from >= start)
+            continue; /* defined in the target */
+        const uint8_t reg = regalloc_location(gs->ra, v, start); /* segments of a value are not in order, a split one can be cut again */
+        if (reg == RA_MEMORY)
+            continue;
+        (*src)[n] = loc_of(gs, gs->func->first_inst + v, end);
+        (*dst)[n++] = reg;
+    }
+    return n;
+}
+
+static void emit_print(GenState* gs, const IrInst* in, uint32_t pos) {
+    for (uint32_t i = 0; i < in->b; i++)
+        put(gs, M_Push, 8, loc_operand(gs, loc_of(gs, gs->ir->extra.v[in->a + i], pos)), mo_none);
+    for (uint32_t i = 0; i < in->b; i++) {
+        const IrType type = type_of(gs, gs->ir->extra.v[in->a + i]);
+        if (i > 0) {
+            put(gs, M_Mov, 4, mo_imm(' '), mo_reg(RDI));
+            put(gs, M_Call, 0, mo_label(gs->runtime.routines[RT_PrintChar]), mo_none);
+        }
+        put(gs, M_Mov, 8, mo_mem(RSP, (in->b-1-i)*8), mo_reg(RDI));
+        const RuntimeRoutine routine = type == IR_Str ? RT_PrintStr : type == IR_Dyn ? RT_PrintDyn : ir_is_signed(type) || type == IR_Bool ? RT_PrintInt : RT_PrintUint;
+        put(gs, M_Call, 0, mo_label(gs->runtime.routines[routine]), mo_none);
+    }
+    put(gs, M_Mov, 4, mo_imm('\n'), mo_reg(RDI));
+    put(gs, M_Call, 0, mo_label(gs->runtime.routines[RT_PrintChar]), mo_none);
+    if (in->b > 0)
+        put(gs, M_Add, 8, mo_imm(in->b*8), mo_reg(RSP));
+}
+
+static void emit_epilogue(GenState* gs) {
+    if (gs->func == &gs->ir->funcs.v[0]) { /* end of the program */
+        put(gs, M_Call, 0, mo_label(gs->runtime.routines[RT_Flush]), mo_none);
+        put(gs, M_Mov, 4, mo_imm(60), mo_reg(RAX));
+        put(gs, M_Xor, 4, mo_reg(RDI), mo_reg(RDI));
+        put(gs, M_Syscall, 0, mo_none, mo_none);
+        return;
+    }
+    if (gs->pushed == 0) {
+        put(gs, M_Leave, 0, mo_none, mo_none);
+        put(gs, M_Ret, 0, mo_none, mo_none);
+        return;
+    }
+    put(gs, M_Lea, 8, mo_mem(RBP, -(int64_t)gs->pushed*8), mo_reg(RSP));
+    for (uint32_t i = sizeof(CALLEE_SAVED); i-- > 0;)
+        if (gs->ra->callee_saved >> CALLEE_SAVED[i] & 1)
+            put(gs, M_Pop, 8, mo_reg(CALLEE_SAVED[i]), mo_none);
+    put(gs, M_Pop, 8, mo_reg(RBP), mo_none);
+    put(gs, M_Ret, 0, mo_none, mo_none);
+}
+
+/* add, sub and mul into <dst>, through %rax when <dst> is not a register or is the right operand */
+static void emit_arithmetic(GenState* gs, const IrInst* in, uint32_t a, uint32_t b, uint32_t dst) {
+    static const uint8_t OPS[] = {[IR_Add] = M_Add, [IR_Sub] = M_Sub, [IR_Mul] = M_Imul};
+    const IrType type = (IrType)in->type;
+    if (gs->ir->trap && in->op == IR_Mul && type == IR_U64) { /* imul only tells signed overflow */
+        move(gs, a, RAX);
+        put(gs, M_Mul, 8, loc_operand(gs, b), mo_none);
+        trap_if(gs, CC_O, RT_Overflow);
+        move(gs, RAX, dst);
+        return;
+    }
+    if (is_reg(dst) && dst == b && dst != a && in->op != IR_Sub) { /* commutes */
+        b = a;
+        a = dst;
+    }
+    uint8_t work = is_reg(dst) && dst != b ? (uint8_t)dst : RAX;
+    move(gs, a, work);
+    if (!gs->ir->trap) {
+        put(gs, (MOp)OPS[in->op], 8, loc_operand(gs, b), mo_reg(work));
+        normalize(gs, work, type);
+    } else if (in->op == IR_Mul && (!ir_is_signed(type) || WIDTH(type) == 1)) { /* no imul that tells, the product of two is exact */
+        put(gs, M_Imul, 8, loc_operand(gs, b), mo_reg(work));
+        check_canonical(gs, work, type);
+    } else {
+        put(gs, (MOp)OPS[in->op], WIDTH(type), loc_operand(gs, b), mo_reg(work));
+        check_flag(gs, work, type, in->op == IR_Mul ? CC_O : OVERFLOW_CC(type));
+    }
+    move(gs, work, dst);
+}
+
+/*
+** Quotient in %rax or remainder in %rdx.
+** A zero divisor goes to the runtime, a signed one of -1 is a negation because idiv faults on the
+** smallest value. Neither check is needed for a constant divisor that is neither.
+*/
+static void emit_division(GenState* gs, const IrInst* in, uint32_t a, uint32_t b) {
+    const IrType type = (IrType)in->type;
+    const IrInst* divisor = &gs->ir->insts.v[in->b];
+    const int64_t known = divisor->op == IR_Const ? (int64_t)((uint64_t)divisor->a | (uint64_t)divisor->b << 32) : 0;
+    const int checked = known == 0 || (known == -1 && ir_is_signed(type));
+    uint32_t done = 0;
+    if (checked) {
+        if (is_reg(b))
+            put(gs, M_Test, 8, mo_reg(b), mo_reg(b));
+        else
+            put(gs, M_Cmp, 8, mo_imm(0), loc_operand(gs, b));
+        trap_if(gs, CC_E, RT_DivZero);
+    }
+    move(gs, a, RAX);
+    if (checked && ir_is_signed(type)) {
+        const uint32_t other = new_label(gs, MS_Text, ".Ld%u", ++gs->divisions);
+        done = new_label(gs, MS_Text, ".Ldd%u", gs->divisions);
+        put(gs, M_Cmp, 8, mo_imm(-1), loc_operand(gs, b));
+        put_aux(gs, M_Jcc, 0, CC_NE, mo_label(other), mo_none);
+        if (in->op == IR_Div) {
+            if (gs->ir->trap) {
+                put(gs, M_Neg, WIDTH(type), mo_reg(RAX), mo_none);
+                check_flag(gs, RAX, type, CC_O);
+            } else {
+                put(gs, M_Neg, 8, mo_reg(RAX), mo_none); /* wraps below */
+            }
+        } else {
+            put(gs, M_Xor, 4, mo_reg(RDX), mo_reg(RDX));
+        }
+        put(gs, M_Jmp, 0, mo_label(done), mo_none);
+        place(gs, other);
+    }
+    if (ir_is_signed(type)) {
+        put(gs, M_Cqto, 8, mo_none, mo_none);
+        put(gs, M_Idiv, 8, loc_operand(gs, b), mo_none);
+    } else {
+        put(gs, M_Xor, 4, mo_reg(RDX), mo_reg(RDX));
+        put(gs, M_Div, 8, loc_operand(gs, b), mo_none);
+    }
+    if (done != 0)
+        place(gs, done);
+}
+
+/*
+** Arithmetic and comparisons of dynamic values, <b> is IR_NONE for a negation.
+** The operands go to %rax and %r11, one branch on their low bits tells whether both are integers,
+** which shifted up by one add, subtract and compare as they are. Anything else goes to the runtime,
+** which makes them integers (or a type error) and comes back to try again, or joins two strings.
+*/
+static void emit_dynamic(GenState* gs, const IrInst* in, uint32_t a, uint32_t b, uint32_t dst) {
+    const uint32_t retry = new_label(gs, MS_Text, ".Ly%u", ++gs->dynamics);
+    const uint32_t slow = new_label(gs, MS_Text, ".Lys%u", gs->dynamics), done = new_label(gs, MS_Text, ".Lyd%u", gs->dynamics);
+    const int trap = gs->ir->trap;
+    move(gs, a, RAX);
+    if (in->op != IR_Neg)
+        move(gs, b, R11);
+    place(gs, retry);
+    if (in->op != IR_Neg) {
+        put(gs, M_Mov, 4, mo_reg(RAX), mo_reg(RDX));
+        put(gs, M_Or, 4, mo_reg(R11), mo_reg(RDX));
+        put(gs, M_Test, 1, mo_imm(1), mo_reg(RDX));
+    } else {
+        put(gs, M_Test, 1, mo_imm(1), mo_reg(RAX));
+    }
+    put_aux(gs, M_Jcc, 0, CC_NE, mo_label(slow), mo_none);
+
+    switch ((IrOp)in->op) {
+        case IR_Add: put(gs, M_Add, 8, mo_reg(R11), mo_reg(RAX)); break;
+        case IR_Sub: put(gs, M_Sub, 8, mo_reg(R11), mo_reg(RAX)); break;
+        case IR_Mul: {
+            put(gs, M_Sar, 8, mo_imm(IR_DYN_INT_BITS), mo_reg(R11));
+            put(gs, M_Imul, 8, mo_reg(R11), mo_reg(RAX));
+            break;
+        }
+        case IR_Neg: put(gs, M_Neg, 8, mo_reg(RAX), mo_none); break;
+        case IR_Div: case IR_Mod: { /* 63 bit values, idiv can't fault on them */
+            put(gs, M_Sar, 8, mo_imm(IR_DYN_INT_BITS), mo_reg(RAX));
+            put(gs, M_Sar, 8, mo_imm(IR_DYN_INT_BITS), mo_reg(R11));
+            put(gs, M_Test, 8, mo_reg(R11), mo_reg(R11));
+            trap_if(gs, CC_E, RT_DivZero);
+            put(gs, M_Cqto, 8, mo_none, mo_none);
+            put(gs, M_Idiv, 8, mo_reg(R11), mo_none);
+            if (in->op == IR_Mod)
+                put(gs, M_Mov, 8, mo_reg(RDX), mo_reg(RAX));
+            put(gs, M_Add, 8, mo_reg(RAX), mo_reg(RAX));
+            break;
+        }
+        default: { /* comparisons */
+            put(gs, M_Cmp, 8, mo_reg(R11), mo_reg(RAX));
+            put_aux(gs, M_Setcc, 1, SETCC[in->op][0], mo_reg(RAX), mo_none);
+            put_aux(gs, M_Movzx, 4, 1, mo_reg(RAX), mo_reg(RAX));
+            break;
+        }
+    }
+    if (trap && in->op != IR_Mod && in->type == IR_Dyn)
+        trap_if(gs, CC_O, RT_Overflow);
+    put(gs, M_Jmp, 0, mo_label(done), mo_none);
+
+    place(gs, slow);
+    if (in->op == IR_Neg)
+        put(gs, M_Xor, 4, mo_reg(R11), mo_reg(R11));
+    const RuntimeRoutine routine = in->op == IR_Add ? RT_DynAdd : in->op == IR_Eq || in->op == IR_Ne ? RT_DynEq : RT_DynInts;
+    put(gs, M_Call, 0, mo_label(gs->runtime.routines[routine]), mo_none);
+    if (in->op == IR_Add) { /* joined strings are done */
+        put(gs, M_Test, 1, mo_imm(1), mo_reg(RAX));
+        put_aux(gs, M_Jcc, 0, CC_NE, mo_label(done), mo_none);
+    }
+    put(gs, M_Jmp, 0, mo_label(retry), mo_none);
+    place(gs, done);
+    move(gs, RAX, dst);
+}
+
+/* a static value into a dynamic one, the integers that don't fit in 63 bits always trap */
+static void emit_tag(GenState* gs, IrType from, uint8_t work) {
+    if (from == IR_Str) {
+        put(gs, M_Or, 8, mo_imm(IR_DYN_STRING), mo_reg(work));
+    } else if (from == IR_Bool) {
+        put(gs, M_Shl, 8, mo_imm(IR_DYN_BOOL_BITS), mo_reg(work));
+        put(gs, M_Or, 8, mo_imm(IR_DYN_BOOL), mo_reg(work));
+    } else {
+        put(gs, M_Add, 8, mo_reg(work), mo_reg(work));
+        if (WIDTH(from) == 8)
+            trap_if(gs, CC_O, RT_Overflow);
+        if (from == IR_U64) /* the top bit was set */
+            trap_if(gs, CC_B, RT_Overflow);
+    }
+}
+
+/* a dynamic value in %rax back to <type>, a string has to be one, an integer or boolean converts like IR_Conv */
+static void emit_untag(GenState* gs, IrType type) {
+    if (type == IR_Str) {
+        put(gs, M_Mov, 4, mo_reg(RAX), mo_reg(RDX));
+        put(gs, M_And, 4, mo_imm(7), mo_reg(RDX));
+        put(gs, M_Cmp, 4, mo_imm(IR_DYN_STRING), mo_reg(RDX));
+        trap_if(gs, CC_NE, RT_TypeError);
+        put(gs, M_Dec, 8, mo_reg(RAX), mo_none);
+        return;
+    }
+    const uint32_t retry = new_label(gs, MS_Text, ".Ly%u", ++gs->dynamics);
+    const uint32_t slow = new_label(gs, MS_Text, ".Lys%u", gs->dynamics), done = new_label(gs, MS_Text, ".Lyd%u", gs->dynamics);
+    place(gs, retry);
+    put(gs, M_Test, 1, mo_imm(1), mo_reg(RAX));
+    put_aux(gs, M_Jcc, 0, CC_NE, mo_label(slow), mo_none);
+    put(gs, M_Sar, 8, mo_imm(IR_DYN_INT_BITS), mo_reg(RAX));
+    if (type == IR_Bool) {
+        put(gs, M_Test, 8, mo_reg(RAX), mo_reg(RAX));
+        put_aux(gs, M_Setcc, 1, CC_NE, mo_reg(RAX), mo_none);
+        put_aux(gs, M_Movzx, 4, 1, mo_reg(RAX), mo_reg(RAX));
+    } else if (gs->ir->trap) {
+        if (type == IR_U64) {
+            put(gs, M_Test, 8, mo_reg(RAX), mo_reg(RAX));
+            trap_if(gs, CC_S, RT_Overflow);
+        }
+        if (NORMALIZE[type].op != M_Label)
+            check_canonical(gs, RAX, type);
+    } else {
+        normalize(gs, RAX, type);
+    }
+    put(gs, M_Jmp, 0, mo_label(done), mo_none);
+    place(gs, slow);
+    put(gs, M_Xor, 4, mo_reg(R11), mo_reg(R11));
+    put(gs, M_Call, 0, mo_label(gs->runtime.routines[RT_DynInts]), mo_none);
+    put(gs, M_Jmp, 0, mo_label(retry), mo_none);
+    place(gs, done);
+}
+
+static void emit_branch(GenState* gs, uint32_t block, const IrInst* in, uint32_t pos) {
+    const uint32_t yes = gs->ir->extra.v[in->b], no = gs->ir->extra.v[in->b+1];
+    const uint32_t cond = loc_of(gs, in->a, pos);
+    if (is_reg(cond))
+        put(gs, M_Test, 8, mo_reg(cond), mo_reg(cond));
+    else
+        put(gs, M_Cmp, 8, mo_imm(0), loc_operand(gs, cond));
+
+    uint32_t *yes_src, *yes_dst, *no_src, *no_dst;
+    uint32_t yes_n = edge_moves(gs, block, yes, &yes_src, &yes_dst);
+    uint32_t no_n = edge_moves(gs, block, no, &no_src, &no_dst);
+    if (no_n == 0) {
+        put_aux(gs, M_Jcc, 0, CC_E, mo_label(gs->block_labels[no]), mo_none);
+        parallel_move(gs, yes_src, yes_dst, yes_n);
+        put(gs, M_Jmp, 0, mo_label(gs->block_labels[yes]), mo_none);
+        return;
+    }
+    const uint32_t edge = new_label(gs, MS_Text, ".Le%u", ++gs->edges);
+    put_aux(gs, M_Jcc, 0, CC_E, mo_label(edge), mo_none);
+    parallel_move(gs, yes_src, yes_dst, yes_n);
+    put(gs, M_Jmp, 0, mo_label(gs->block_labels[yes]), mo_none);
+    place(gs, edge);
+    parallel_move(gs, no_src, no_dst, no_n);
+    put(gs, M_Jmp, 0, mo_label(gs->block_labels[no]), mo_none);
+}
+
+static void gen_inst(GenState* gs, uint32_t block, IrRef at) {
+    const IrModule* ir = gs->ir;
+    const IrInst* in = &ir->insts.v[at];
+    const IrType type = (IrType)in->type;
+    const uint32_t pos = use_pos(gs, at);
+
+    /* values coming back from their slot */
+    for (; gs->reload < gs->ra->reloads.siz && gs->ra->reloads.v[gs->reload].pos == pos; gs->reload++) {
+        const IrRef v = gs->ra->reloads.v[gs->reload].value;
+        move(gs, LOC_SLOT(gs->ra->slots[v]), regalloc_location(gs->ra, v, pos));
+    }
+
+    /* nothing reads it, drop it unless it has an effect, a dynamic value can be of the wrong kind */
+    const int dead = type != IR_Void && is_dead(gs, at);
+    const int traps = (gs->ir->trap && (in->op == IR_Add || in->op == IR_Sub || in->op == IR_Mul || in->op == IR_Neg || in->op == IR_Conv))
+        || (in->op == IR_Tag && ir_is_int(type_of(gs, in->a)) && WIDTH(type_of(gs, in->a)) == 8);
+    const int dynamic = in->op >= IR_Add && in->op <= IR_Ge && type_of(gs, in->a) == IR_Dyn;
+    if (dead && in->op != IR_Call && in->op != IR_Div && in->op != IR_Mod && in->op != IR_Untag && !traps && !dynamic)
+        return;
+    const uint32_t def = in->op == IR_Phi ? def_pos(gs, ir->blocks.v[block].first) : pos+1; /* with the other phis of the block */
+    const uint32_t dst = dead ? RAX : type != IR_Void ? loc_of(gs, at, def) : RAX;
+    const uint8_t work = is_reg(dst) ? (uint8_t)dst : RAX;
+    #define operand(_ref) loc_of(gs, _ref, pos)
+
+    switch ((IrOp)in->op) {
+        case IR_Const: emit_const(gs, dst, (uint64_t)in->a | (uint64_t)in->b << 32); break;
+        case IR_String: emit_string(gs, in->a, work); move(gs, work, dst); break;
+        case IR_Param: break; /* moved in the prologue */
+
+        case IR_Add: case IR_Sub: case IR_Mul: {
+            if (dynamic)
+                emit_dynamic(gs, in, operand(in->a), operand(in->b), dst);
+            else
+                emit_arithmetic(gs, in, operand(in->a), operand(in->b), dst);
+            break;
+        }
+        case IR_Div: case IR_Mod: {
+            if (dynamic) {
+                emit_dynamic(gs, in, operand(in->a), operand(in->b), dst);
+                break;
+            }
+            emit_division(gs, in, operand(in->a), operand(in->b));
+            const uint8_t result = in->op == IR_Div ? RAX : RDX;
+            normalize(gs, result, type);
+            if (!dead)
+                move(gs, result, dst);
+            break;
+        }
+        case IR_Neg: {
+            if (dynamic) {
+                emit_dynamic(gs, in, operand(in->a), IR_NONE, dst);
+                break;
+            }
+            move(gs, operand(in->a), work);
+            if (gs->ir->trap) {
+                put(gs, M_Neg, WIDTH(type), mo_reg(work), mo_none);
+                check_flag(gs, work, type, OVERFLOW_CC(type));
+            } else {
+                put(gs, M_Neg, 8, mo_reg(work), mo_none);
+                normalize(gs, work, type);
+            }
+            move(gs, work, dst);
+            break;
+        }
+        case IR_Eq: case IR_Ne: case IR_Lt: case IR_Le: case IR_Gt: case IR_Ge: {
+            if (dynamic) {
+                emit_dynamic(gs, in, operand(in->a), operand(in->b), dst);
+                break;
+            }
+            uint32_t a = operand(in->a), b = operand(in->b);
+            if (!is_reg(a) && !is_reg(b)) {
+                move(gs, a, RAX);
+                a = RAX;
+            }
+            put(gs, M_Cmp, 8, loc_operand(gs, b), loc_operand(gs, a));
+            put_aux(gs, M_Setcc, 1, SETCC[in->op][!ir_is_signed(type_of(gs, in->a))], mo_reg(work), mo_none);
+            put_aux(gs, M_Movzx, 4, 1, mo_reg(work), mo_reg(work));
+            move(gs, work, dst);
+            break;
+        }
+        case IR_Conv: {
+            const IrType from = type_of(gs, in->a);
+            move(gs, operand(in->a), work);
+            if (type == IR_Bool) {
+                put(gs, M_Test, 8, mo_reg(work), mo_reg(work));
+                put_aux(gs, M_Setcc, 1, CC_NE, mo_reg(work), mo_none);
+                put_aux(gs, M_Movzx, 4, 1, mo_reg(work), mo_reg(work));
+            } else if (gs->ir->trap) { /* only u64 has values that read as negative, then it has to be in the narrower type */
+                if ((from == IR_U64 && type != IR_U64) || (type == IR_U64 && ir_is_signed(from))) {
+                    put(gs, M_Test, 8, mo_reg(work), mo_reg(work));
+                    trap_if(gs, CC_S, RT_Overflow);
+                }
+                if (NORMALIZE[type].op != M_Label)
+                    check_canonical(gs, work, type);
+            } else {
+                normalize(gs, work, type);
+            }
+            move(gs, work, dst);
+            break;
+        }
+        case IR_Tag: {
+            move(gs, operand(in->a), work);
+            emit_tag(gs, type_of(gs, in->a), work);
+            move(gs, work, dst);
+            break;
+        }
+        case IR_Untag: {
+            move(gs, operand(in->a), RAX);
+            emit_untag(gs, type);
+            move(gs, RAX, dst);
+            break;
+        }
+        case IR_Phi: break; /* written on the edges */
+
+        case IR_LoadGlobal: {
+            put(gs, M_Mov, 8, mo_label(gs->global_labels[in->a]), mo_reg(work));
+            move(gs, work, dst);
+            break;
+        }
+        case IR_StoreGlobal: {
+            uint32_t value = operand(in->b);
+            if (!is_reg(value)) {
+                move(gs, value, RAX);
+                value = RAX;
+            }
+            put(gs, M_Mov, 8, mo_reg(value), mo_label(gs->global_labels[in->a]));
+            break;
+        }
+        case IR_Call: {
+            uint32_t src[IR_MAX_PARAMS], to[IR_MAX_PARAMS];
+            for (uint32_t i = 0; i < in->b; i++) {
+                src[i] = operand(ir->extra.v[in->a+1+i]);
+                to[i] = ARG_REGISTERS[i];
+            }
+            parallel_move(gs, src, to, in->b);
+            put(gs, M_Call, 0, mo_label(gs->func_labels[ir->extra.v[in->a]]), mo_none);
+            if (type != IR_Void && !dead)
+                move(gs, RAX, dst);
+            break;
+        }
+        case IR_Print: emit_print(gs, in, pos); break;
+
+        case IR_Jmp: {
+            uint32_t *src, *to;
+            uint32_t n = edge_moves(gs, block, in->a, &src, &to);
+            parallel_move(gs, src, to, n);
+            put(gs, M_Jmp, 0, mo_label(gs->block_labels[in->a]), mo_none);
+            break;
+        }
+        case IR_Br: emit_branch(gs, block, in, pos); break;
+        case IR_Ret: {
+            if (in->a != IR_NONE)
+                move(gs, operand(in->a), RAX);
+            emit_epilogue(gs);
+            break;
+        }
+
+        default: break;
+    }
+    #undef operand
+
+    /* a value that goes to memory later is written to its slot once, here */
+    const IrRef v = rel(gs, at);
+    if (!dead && type != IR_Void && gs->ra->slots[v] != IR_NONE && is_reg(dst))
+        move(gs, dst, LOC_SLOT(gs->ra->slots[v]));
+}
+
+static void gen_function(GenState* gs, const IrFunc* f) {
+    gs->func = f;
+    gs->ra = regalloc_function(gs->ir, f, gs->arena);
+    gs->reload = 0;
+    gs->pushed = 0;
+    const int top = f == &gs->ir->funcs.v[0];
+    place(gs, gs->func_labels[f - gs->ir->funcs.v]);
+    put(gs, M_Push, 8, mo_reg(RBP), mo_none);
+    put(gs, M_Mov, 8, mo_reg(RSP), mo_reg(RBP));
+    for (uint32_t i = 0; i < sizeof(CALLEE_SAVED) && !top; i++) {
+        if (gs->ra->callee_saved >> CALLEE_SAVED[i] & 1) {
+            put(gs, M_Push, 8, mo_reg(CALLEE_SAVED[i]), mo_none);
+            gs->pushed++;
+        }
+    }
+    const uint32_t frame = ((gs->pushed + gs->ra->slot_count)*8 + 15) / 16 * 16 - gs->pushed*8;
+    if (frame > 0)
+        put(gs, M_Sub, 8, mo_imm(frame), mo_reg(RSP));
+
+    /* arguments to wherever their parameters live */
+    uint32_t src[IR_MAX_PARAMS], dst[IR_MAX_PARAMS], n = 0;
+    for (uint32_t i = 0; i < f->params; i++) {
+        if (is_dead(gs, f->first_inst + i))
+            continue;
+        src[n] = ARG_REGISTERS[i];
+        dst[n++] = loc_of(gs, f->first_inst + i, 2*i+1);
+    }
+    parallel_move(gs, src, dst, n);
+
+    for (uint32_t b = f->first_block; b < f->first_block + f->blocks; b++)
+        gs->block_labels[b] = new_label(gs, MS_Text, ".Lb%u", b);
+    for (uint32_t b = f->first_block; b < f->first_block + f->blocks; b++) {
+        const IrBlock* bl = &gs->ir->blocks.v[b];
+        place(gs, gs->block_labels[b]);
+        for (IrRef at = bl->first; at < bl->first + bl->count; at++)
+            gen_inst(gs, b, at);
+    }
+}
+
+/*{==================================*/
+/*
+** API
+*/
+MachineCode* gen_code(const IrModule* ir, Arena* arena) {
+    GenState gs = {
+        .ir = ir,
+        .mc = x86_create(ir->symbols, arena),
+        .edges = 0,
+        .divisions = 0,
+        .dynamics = 0,
+        .arena = arena,
+    };
+    gs.string_labels = arena_alloc(arena, sizeof(uint32_t)*ir->symbols->siz);
+    memset(gs.string_labels, 0, sizeof(uint32_t)*ir->symbols->siz);
+    gs.global_labels = arena_alloc(arena, sizeof(uint32_t)*ir->symbols->siz);
+    gs.func_labels = arena_alloc(arena, sizeof(uint32_t)*(ir->funcs.siz+1));
+    gs.block_labels = arena_alloc(arena, sizeof(uint32_t)*(ir->blocks.siz+1));
+
+    /* whatever can be referred to before it is placed */
+    gs.func_labels[0] = gs.mc->entry = new_label(&gs, MS_Text, "_start");
+    gs.mc->labels.v[gs.mc->entry].global = 1;
+    for (size_t i = 1; i < ir->funcs.siz; i++)
+        gs.func_labels[i] = new_label(&gs, MS_Text, "f_%.*s", name_of(&gs, ir->funcs.v[i].name));
+    for (size_t i = 0; i < ir->insts.siz && !gs.runtime.dynamic; i++)
+        gs.runtime.dynamic = ir->insts.v[i].type == IR_Dyn;
+    runtime_declare(gs.mc, &gs.runtime);
+    for (size_t i = 0; i < ir->globals.siz; i++) {
+        const Symbol name = ir->globals.v[i].name;
+        gs.global_labels[name] = new_label(&gs, MS_Bss, "g_%.*s", name_of(&gs, name));
+        gen_push(arena, gs.mc->bss, ((MBss){.label = gs.global_labels[name], .size = 8}));
+    }
+
+    for (size_t i = 0; i < ir->funcs.siz; i++)
+        gen_function(&gs, &ir->funcs.v[i]);
+    runtime_emit(gs.mc, &gs.runtime);
+    return gs.mc;
+}
@@ -2,21 +2,187 @@
 ** Main internal handler of files.
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "head.h"
 
-void compile_text(char* txt, char* filename) {
-    if (strlen(txt) < 1) {
+#if !defined(_WIN32)
+#define COMPILE_MMAP 1
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#define COMPILE_MMAP 0 /* read into memory instead */
+#endif
+
+/* config */
+#define COMPILE_ARENA_BLOCK_SIZE    (1 << 20)
+#define COMPILE_TOKEN_RING_SIZE     16 /* tokens kept alive while parsing, power of 2 */
+#define COMPILE_PARALLEL_LEX_MIN    (1 << 20) /* smaller sources are lexed while parsing */
+#ifndef COMPILE_VERIFY_WORDS
+#define COMPILE_VERIFY_WORDS        1 /* check the keyword hash once, before the first compilation */
+#endif
+#ifndef COMPILE_VERIFY_IR
+#define COMPILE_VERIFY_IR           1 /* check the IR before anything uses it */
+#endif
+#ifndef COMPILE_PEEPHOLE
+#define COMPILE_PEEPHOLE            1 /* clean up the machine code before it is written */
+#endif
+/*}=======================*/
+
+/* lives across compilations (playground), reset after each one */
+static Arena* arena = NULL;
+
+CompileOptions compile_options = {
+    .lex_threads = 1,
+    .lex_compare = 0,
+    .output = NULL,
+    .emit_ir = 0,
+    .emit_asm = 0,
+    .emit_object = 0,
+    .peep_stats = 0,
+    .overflow_trap = 0,
+    .explain_types = 0,
+};
+
+/*
+** Writes <output> from the IR: assembly text for -S, an object for -c, else a static executable.
+** The code is encoded and linked in process, nothing outside the compiler is run.
+*/
+static int build_executable(const IrModule* ir, const char* output) {
+    MachineCode* mc = gen_code(ir, arena);
+#if COMPILE_PEEPHOLE
+    PeepStats stats;
+    peep_optimize(mc, &stats);
+    if (compile_options.peep_stats)
+        peep_print_stats(&stats, stdout);
+#endif
+    const int binary = !compile_options.emit_asm;
+    FILE* f = NULL;
+#if !defined(_WIN32)
+    if (binary && !compile_options.emit_object) { /* runnable straight away */
+        int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+        f = fd < 0 ? NULL : fdopen(fd, "wb");
+    } else
+#endif
+        f = fopen(output, binary ? "wb" : "w");
+    if (f == NULL) {
+        fprintf(stderr, "PyToASM: Could not write %s.\n", output);
+        return 1;
+    }
+
+    int failed = 0;
+    if (compile_options.emit_asm) {
+        x86_print(mc, f);
+    } else {
+        X86Object* obj = x86_encode(mc, arena);
+        failed = compile_options.emit_object ? elf_write_object(mc, obj, f) : elf_write_executable(mc, obj, f);
+    }
+    failed |= fclose(f) != 0;
+    if (failed) {
+        fprintf(stderr, "PyToASM: Writing %s failed.\n", output);
+        remove(output);
+    }
+    return failed;
+}
+
+int compile_text(const char* txt, size_t len, char* filename) {
+    if (len < 1) {
         VGA_YELLOW();
         printf("PyToASM: No code to process.\n");
         VGA_RESET();
-        return;
+        return 0;
+    }
+    if (arena == NULL) {
+        arena = arena_create(COMPILE_ARENA_BLOCK_SIZE);
+        scan_init(ScanAVX2);
+#if COMPILE_VERIFY_WORDS
+        if (lex_verify_words() != 0)
+            return 1;
+#endif
+    }
+
+    logger_init(txt, len, filename);
+    if (compile_options.lex_compare && lex_compare(txt, len, arena, compile_options.lex_threads) != 0) {
+        arena_reset(arena); /* the lexers disagree, nothing after them can be trusted */
+        return 1;
     }
-    logger_init(txt, filename);
+
     /* parse */
-    LexOut* lo = lex_generate(txt);
-    AbstractSyntaxTree* ast = parse_generate(lo);
+    TokenStream* ts;
+    if (compile_options.lex_threads > 1 && len >= COMPILE_PARALLEL_LEX_MIN)
+        ts = lex_parallel(txt, len, arena, compile_options.lex_threads); /* whole stream up front */
+    else
+        ts = lex_open(txt, len, arena, COMPILE_TOKEN_RING_SIZE)->ts; /* tokens are pulled by the parser */
+    logger_use_lines(&ts->line_starts);
+    AbstractSyntaxTree* ast = parse_generate(ts, arena);
+
+    /* generate */
+    int failed = 0;
+    if (compile_options.emit_ir || compile_options.explain_types || compile_options.output != NULL) {
+        IrModule* ir = ir_lower(ast, compile_options.overflow_trap, arena);
+#if COMPILE_VERIFY_IR
+        failed = ir_verify(ir) != 0;
+#endif
+        if (compile_options.emit_ir)
+            ir_print(ir, stdout);
+        if (compile_options.explain_types)
+            ir_explain_types(ir, stdout);
+        if (!failed && compile_options.output != NULL)
+            failed = build_executable(ir, compile_options.output);
+    }
 
     /* free up memory */
-    lex_free(lo);
-    parse_free(ast);
-}
\ No newline at end of file
+    arena_reset(arena);
+    return failed;
+}
+
+/*
+** The source is mapped read-only and lexed in place, nothing is copied before lexing starts.
+*/
+int compile_file(char* filename) {
+#if COMPILE_MMAP
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "PyToASM: Could not open %s.\n", filename);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) { /* nothing to map */
+        close(fd);
+        return compile_text("", 0, filename);
+    }
+
+    char* txt = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file */
+    if (txt == MAP_FAILED) {
+        fprintf(stderr, "PyToASM: Could not map %s.\n", filename);
+        return 1;
+    }
+    madvise(txt, len, MADV_SEQUENTIAL);
+
+    int failed = compile_text(txt, len, filename);
+    munmap(txt, len);
+#else
+    FILE* f = fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "PyToASM: Could not open %s.\n", filename);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t len = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char* txt = malloc(len > 0 ? len : 1);
+    len = fread(txt, 1, len, f);
+    fclose(f);
+
+    int failed = compile_text(txt, len, filename);
+    free(txt);
+#endif
+    return failed;
+}
@@ -4,6 +4,7 @@
 #pragma once
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 
 /* utilities for coloring text */
 #define VGA_YELLOW() printf("\033[93m")
@@ -28,16 +29,129 @@ void buffer_write_long(Buffer* buf, size_t location, char* STR); /* Write a whol
 char buffer_read(Buffer* buf, size_t location);
 #define buffer_realign_siz(_buf) _buf->siz = strlen(_buf->data)
 
+/* arena.c */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t siz;
+    size_t cap; /* capacity */
+    _Alignas(16) char data[];
+} ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* first;
+    ArenaBlock* cur; /* block currently being bumped */
+    void* last_alloc; /* most recent allocation, can grow in place */
+    size_t block_siz;
+} Arena;
+
+Arena* arena_create(size_t block_siz);
+void* arena_alloc(Arena* a, size_t siz);
+void* arena_realloc(Arena* a, void* ptr, size_t old_siz, size_t new_siz); /* Old memory stays until the next reset. */
+char* arena_strdup(Arena* a, const char* str);
+void arena_grow_slots(Arena* a, void* slots, size_t* cap, size_t growth, size_t size, void (*place)(void* table, const void* slot), void* table); /* Rehashes an open addressing table. */
+void arena_reset(Arena* a); /* Frees everything at once, keeps the blocks for reuse. */
+void arena_free(Arena* a);
+
+/* scan.c */
+typedef enum ScanLevel {
+    ScanScalar,
+    ScanSSE2,
+    ScanAVX2,
+} ScanLevel;
+
+typedef const char* (*ScanFunction)(const char* p, const char* end); /* first interesting byte in [p, end] */
+typedef struct ScanKernels {
+    const char* name;
+    ScanFunction ident; /* stops at a non identifier character */
+    ScanFunction space; /* stops at anything but ' ' \f \t \v */
+    ScanFunction line_comment; /* stops at a newline or \0 */
+    ScanFunction multi_comment; /* stops at a newline, \0 or ' */
+    ScanFunction string; /* stops at a newline, \0, quote or backslash */
+} ScanKernels;
+
+extern ScanKernels scan_kernels;
+void scan_init(ScanLevel max); /* Picks the best kernels the CPU supports, up to <max>. */
+
+/* intern.c */
+typedef uint32_t Symbol; /* a distinct spelling, equal text <=> equal symbol */
+
+/* symbols every table starts with */
+typedef enum SymbolPreset {
+    SYM_Empty = 0, /* "" */
+    SYM_Char = 1, /* SYM_Char+c is the one character string c */
+
+    /* keywords */
+    SYM_class = SYM_Char + 256,
+    SYM_and, SYM_as, SYM_async, SYM_await, SYM_break, SYM_continue, SYM_def, SYM_del, SYM_elif, SYM_else,
+    SYM_except, SYM_finally, SYM_for, SYM_from, SYM_global, SYM_if, SYM_import, SYM_in, SYM_is, SYM_lambda,
+    SYM_nonlocal, SYM_not, SYM_or, SYM_pass, SYM_raise, SYM_return, SYM_try, SYM_while, SYM_with, SYM_yield,
+    SYM_end,
+    /* types */
+    SYM_i8, SYM_i16, SYM_i32, SYM_i64, SYM_u8, SYM_u16, SYM_u32, SYM_u64, SYM_string, SYM_boolean,
+    /* constants */
+    SYM_True, SYM_False, SYM_None,
+
+    SYM_PresetCount,
+} SymbolPreset;
+
+typedef struct SymbolEntry {
+    const char* name; /* a view, not NUL-terminated */
+    uint32_t len;
+    uint32_t hash;
+} SymbolEntry;
+
+typedef struct InternSlot {
+    uint64_t head; /* first 7 bytes and the length, the whole key for short spellings */
+    uint32_t hash;
+    Symbol sym; /* SYM_Empty for a free slot */
+} InternSlot;
+
+typedef struct InternTable {
+    Arena* arena;
+    SymbolEntry* v; /* indexed by Symbol */
+    size_t siz;
+    size_t cap;
+    InternSlot* slots; /* open addressing over v */
+    size_t slots_cap; /* power of 2 */
+} InternTable;
+
+InternTable* intern_create(Arena* arena);
+Symbol intern(InternTable* it, const char* name, uint32_t len); /* <name> is kept as a view, it has to outlive the table. */
+#define symbol_name(_it, _sym) ((_it)->v[_sym].name)
+#define symbol_len(_it, _sym) ((_it)->v[_sym].len)
+#define symbol_of_char(_c) ((Symbol)(SYM_Char + (uint8_t)(_c)))
+
 /* log.c */
-void logger_init(char* _lines, char* filename);
+typedef struct LineTable {
+    uint32_t* v;
+    size_t siz;
+    size_t cap;
+} LineTable; /* offset of the first character of every line */
+
+void logger_init(const char* src, size_t len, char* filename); /* <src> is not copied and has to outlive the compilation. */
+void logger_use_lines(const LineTable* lines); /* Line table to look errors up in, filled as the lexer goes. */
 void logger_error(int line_num, int start, int end, const char* code, const char* type_of_err);
 void logger_dev_warning(int line_num, const char* type_of_warn); 
 #define logger_token_error(line_num, start, code) logger_error(line_num, start, start+1, code, "Syntax")
 #define logger_parse_error(line_num, start, code) logger_error(line_num, start, start+1, code, "Parse")
+#define logger_compile_error(line_num, start, code) logger_error(line_num, start, start+1, code, "Compile")
 
 /* head.c */
+typedef struct CompileOptions {
+    int lex_threads; /* > 1 lexes big sources in parallel */
+    int lex_compare; /* check the parallel lexer against the sequential one */
+    const char* output; /* file to build, NULL only parses */
+    int emit_ir; /* print the IR to stdout */
+    int emit_asm; /* -S, the output is assembly text */
+    int emit_object; /* -c, the output is a relocatable object */
+    int peep_stats; /* print how often each peephole rule fired */
+    int overflow_trap; /* --overflow=trap, integers that leave their type end the program instead of wrapping */
+    int explain_types; /* print how every unannotated variable got its type */
+} CompileOptions;
+extern CompileOptions compile_options;
 
-void compile_text(char* txt, char* filename);
+int compile_text(const char* txt, size_t len, char* filename); /* <txt> needs no \0, 0 on success. */
+int compile_file(char* filename); /* Maps the file and compiles it, 0 on success. */
 
 /* lex.c */
 typedef enum TK_Kind {
@@ -62,50 +176,79 @@ typedef enum TK_Kind {
     TK_Sub,
     TK_Mul,
     TK_Div,
+    TK_Mod,
     TK_Increment,
     TK_Decrement,
     TK_Multiment,
     TK_Divement,
     TK_Equals,
     TK_EqualsEquals,
+    TK_NotEquals,
+    TK_Less,
+    TK_Greater,
+    TK_LessEquals,
+    TK_GreaterEquals,
     TK_Comma,
+
+    TK_End, /* always the last token of a stream */
 } TK_Kind;
-typedef struct Token {
-    TK_Kind kind;
-    char* value;
 
-    struct Token* next;
-    struct Token* prev;
+/*
+** Tokens as parallel arrays, token i is (kind[i], offset[i], sym[i]).
+** Either complete, or a ring of the last <cap> tokens that pulls more from the lexer on demand.
+*/
+#define TS_NO_RING ((size_t)-1)
+typedef struct TokenStream {
+    struct LexState* lex; /* lexer producing the rest of the tokens, NULL once complete */
+    const char* src;
+    uint8_t* kind; /* TK_Kind */
+    uint32_t* offset; /* start of the token in src */
+    Symbol* sym; /* spelling, decoded for string literals */
+    size_t siz; /* tokens made so far */
+    size_t cap;
+    size_t mask; /* slot of token i is i & mask, TS_NO_RING when complete */
 
-    int line;
-    int column;
+    InternTable* symbols;
+    LineTable line_starts;
+} TokenStream;
 
-    int columns_traversed;
-} Token;
+/* token i of a stream, only valid once ts_kind() reached it */
+#define ts_slot(_ts, _i) ((_i) & (_ts)->mask)
+#define ts_offset(_ts, _i) ((_ts)->offset[ts_slot(_ts, _i)])
+#define ts_sym(_ts, _i) ((_ts)->sym[ts_slot(_ts, _i)])
+#define ts_value(_ts, _i) symbol_name((_ts)->symbols, ts_sym(_ts, _i))
+#define ts_len(_ts, _i) symbol_len((_ts)->symbols, ts_sym(_ts, _i))
 
 typedef struct LexState {
-    Buffer* tk_buf; /* buffer for scanning */
-    struct {
-        Token** v;
-        size_t siz;
-        size_t cap;
-    } tks;
+    Arena* arena; /* every token comes from here */
+    TokenStream* ts; /* output */
+    const char* src;
+    const char* end; /* one past the last character, src needs no \0 */
+    const char* iptr; /* where the next lex_next continues */
+    uint8_t state; /* scanner state to continue in */
+    int done; /* TK_End was made (chunks: the chunk is done) */
+    const char* stop; /* parallel lexing, the line start where the chunk ends */
+    void* on_error; /* parallel lexing, jmp_buf to leave through on a syntax error */
+    const char* error_at;
+    const char* error_code;
+    const char* line_start; /* first character of the current line */
+    const char* tk_start; /* pending token being scanned */
 
     int line;
-    int column;
-    int columns_traversed;
-    int newline_column;
-    int in_comment;
-    int is_comment_multiline;
+    char quote; /* quote character of the string being scanned */
+    int has_escape; /* the string being scanned needs decoding */
+    int parenthesis_balance;
 } LexState;
 
-typedef struct LexOut {
-    Token** tks;
-    size_t siz;
-} LexOut;
-
-LexOut* lex_generate(char* txt);
-void lex_free(LexOut* lo);
+LexState* lex_open(const char* txt, size_t len, Arena* arena, size_t ring); /* <ring> is a power of 2, or 0 for a complete stream */
+TK_Kind lex_next(LexState* ls); /* Makes the next token(s), returns the kind of the newest. */
+TokenStream* lex_generate(const char* txt, size_t len, Arena* arena); /* Lexes everything up front. */
+TokenStream* lex_parallel(const char* txt, size_t len, Arena* arena, int threads); /* Lexes chunks of lines on <threads> threads. */
+int lex_compare(const char* txt, size_t len, Arena* arena, int threads); /* Lexes both ways, 0 when the streams are identical. */
+int lex_verify_words(void); /* Number of keywords, types and constants the word hash loses, each is written to stderr. */
+TK_Kind ts_kind(TokenStream* ts, size_t i); /* Kind of token i, pulls from the lexer if needed. TK_End past the end. */
+int ts_line(TokenStream* ts, uint32_t offset);
+int ts_column(TokenStream* ts, uint32_t offset);
 
 /* parse.c */
 typedef enum ND_Kind {
@@ -135,6 +278,8 @@ typedef enum ND_Kind {
     ND_ExplicitArgumentExpression, // a: type, has a type expression underneath
     ND_ArgumentExpression, // literal/expression
     ND_TypeResolveExpression,
+    ND_TypeParameterListExpression, // <T, U> of a generic def, its first child
+    ND_TypeArgumentListExpression, // <i32> of a call to a generic def, after the arguments
     ND_ConditionalExpression,
     ND_VarSeperationExpression, // ,
 
@@ -144,23 +289,29 @@ typedef enum ND_Kind {
 
 
 
+/*
+** Nodes live in one array and refer to each other by index.
+** Children of a node are the <count> indices at edges[<first>], in order.
+*/
+typedef uint32_t NodeId;
+#define NODE_NONE ((NodeId)-1)
+
 typedef struct Node {
     ND_Kind kind;
-    char* value;
-    
-    struct Node* prev;
-    struct {
-        struct Node** refs;
-        size_t siz;
-        size_t cap;
-    } next;
-
-    /* etc */
-    int line;
-    int column;
-    int columns_traversed;
+    Symbol value; /* same as the token it came from */
+    uint32_t offset; /* source offset of the token it came from */
+    NodeId parent; /* NODE_NONE for the root */
+    uint32_t first; /* first child in the edges */
+    uint32_t count; /* number of children */
 } Node;
 
+/* children while parsing, they only become edge ranges once the tree is done */
+typedef struct NodeLinks {
+    NodeId first;
+    NodeId last;
+    NodeId next; /* next sibling */
+} NodeLinks;
+
 typedef enum ScopeKind {
     ScopeUndefined, // root is this
     ScopeClause,
@@ -169,17 +320,42 @@ typedef enum ScopeKind {
 
 typedef struct Scope {
     ScopeKind kind;
-    Node* node; /* the node the scope refers to */
+    NodeId node; /* the node the scope refers to */
+    size_t vars_mark; /* ps->vars.declared.siz when the scope was pushed */
 } Scope;
 
 typedef struct ParseVariable {
-    char* name;
-    Node* node;
+    Symbol name;
+    NodeId node;
+    struct ParseVariable* shadowed; /* same name in an outer scope */
 } ParseVariable;
 
+typedef enum ExprOpKind {
+    ExprBinary,
+    ExprUnary,
+    ExprParen, /* ( of a parenthesized expression */
+    ExprCall, /* ( of a call, the arguments so far are under its node */
+    ExprCast, /* ( of string(...), its node is the cast */
+} ExprOpKind;
+
+/* pending operator or open bracket of the expression parser */
+typedef struct ExprOp {
+    ExprOpKind kind;
+    uint8_t prec; /* binding power, 0 for the brackets */
+    NodeId node; /* operator node, the argument list for calls */
+} ExprOp;
+
+/* one per distinct name, <var> is the innermost visible binding or NULL */
+typedef struct VarSlot {
+    Symbol name; /* SYM_Empty for a free slot */
+    ParseVariable* var;
+} VarSlot;
+
 typedef struct ParseState {
+    Arena* arena; /* nodes, scopes and variables come from here */
     struct {
-        Node** ptrs;
+        Node* v;
+        NodeLinks* links; /* links[i] are the children of v[i] */
         size_t siz;
         size_t cap;
     } nodes;
@@ -189,22 +365,534 @@ typedef struct ParseState {
         size_t cap;
     } scopes;
 
-    Node* root; /* every node is below this */
-    Node* current_node; /* The current relevant node, used for parenting etc. */
+    NodeId root; /* every node is below this */
+    NodeId current_node; /* The current relevant node, used for parenting etc. */
     ND_Kind current_statement; /* the current, most top level statement as of now */
     ND_Kind current_expression; /* the current expression being dealt with */
-    Token* current_token; /* the current token that is being dealt with to make statements/expressions/literals */
+    TokenStream* ts;
+    size_t cursor; /* index of the current token that is being dealt with to make statements/expressions/literals */
     struct {
-        ParseVariable** v;
+        VarSlot* slots; /* open addressing, names are never removed */
         size_t siz;
-        size_t cap;
-    } vars_allowed_in_scope; /* All the defined variables allowed in this specific scope */
+        size_t cap; /* power of 2 */
+        struct {
+            ParseVariable** v;
+            size_t siz;
+            size_t cap;
+        } declared; /* in order, a scope pops everything above its vars_mark */
+    } vars; /* every variable visible from the current scope */
+    struct {
+        struct {
+            ExprOp* v;
+            size_t siz;
+            size_t cap;
+        } ops;
+        struct {
+            NodeId* v;
+            size_t siz;
+            size_t cap;
+        } operands;
+    } expr; /* stacks of the expression parser, nesting depth never reaches the C stack */
 } ParseState;
 
+/*
+** Flat tree in preorder, the root is nodes[0] and every subtree is contiguous.
+** Only indices inside, so the arrays can be written out and read back as they are.
+*/
 typedef struct AbstractSyntaxTree {
-    Node** nodes;
+    Node* nodes;
     size_t siz;
+    NodeId* edges; /* child ranges of every node, siz-1 of them */
+    size_t edges_siz;
+    InternTable* symbols; /* node values */
+    TokenStream* ts; /* lines of the node offsets, for errors */
 } AbstractSyntaxTree;
 
-AbstractSyntaxTree* parse_generate(LexOut* lo);
-void parse_free(AbstractSyntaxTree* ast);
+/* child <_i> of node <_nd> */
+#define ast_child_id(_ast, _nd, _i) ((_ast)->edges[(_nd)->first + (_i)])
+#define ast_child(_ast, _nd, _i) (&(_ast)->nodes[ast_child_id(_ast, _nd, _i)])
+
+AbstractSyntaxTree* parse_generate(TokenStream* ts, Arena* arena);
+
+/* ir.c */
+/*
+** SSA form between the tree and the generator.
+** Every instruction defines at most one value named by its index, operands are indices too.
+** Instructions, blocks and operand lists of the whole module sit in flat arrays,
+** a function is a range of blocks and a block a range of instructions.
+*/
+typedef enum IrType {
+    IR_Void, /* no value */
+    IR_Bool,
+    IR_I8, IR_I16, IR_I32, IR_I64,
+    IR_U8, IR_U16, IR_U32, IR_U64,
+    IR_Str, /* address of the length, the bytes follow it */
+    IR_Dyn, /* tagged, for variables set to values of different kinds: see IR_DYN_* */
+    IR_TypeCount,
+} IrType;
+#define ir_is_int(_t) ((_t) >= IR_Bool && (_t) <= IR_U64)
+#define ir_is_signed(_t) ((_t) >= IR_I8 && (_t) <= IR_I64)
+
+/*
+** A dynamic value is one 64 bit word, the low bits tell what it holds.
+** An integer is shifted up by one over a clear low bit, so 0 is the integer 0 and integers add as they are.
+** A string is its address (8 byte aligned) with the low bit set, a boolean is shifted up by three over 011.
+** Integers keep 63 bits, arithmetic that leaves them wraps or traps like on any other type.
+** A static integer that doesn't fit in them is never cut down, making it dynamic traps in either mode.
+*/
+#define IR_DYN_INT_BITS 1
+#define IR_DYN_STRING 1
+#define IR_DYN_BOOL 3
+#define IR_DYN_BOOL_BITS 3
+
+typedef enum IrOp {
+    IR_Const, /* a | b<<32, already wrapped to the type */
+    IR_String, /* a: Symbol of the text */
+    IR_Param, /* a: index, first in the entry block */
+    IR_Add, IR_Sub, IR_Mul, IR_Div, IR_Mod, /* a, b: operands of the result type */
+    IR_Neg, /* a */
+    IR_Eq, IR_Ne, IR_Lt, IR_Le, IR_Gt, IR_Ge, /* a, b: integers of one type, boolean result */
+    IR_Conv, /* a: integer to the result type, wraps */
+    IR_Tag, /* a: integer, boolean or string to IR_Dyn */
+    IR_Untag, /* a: IR_Dyn to the integer or string result type, traps when it holds another kind */
+    IR_Phi, /* extra[a..a+2b): predecessor block, value pairs, first in the block */
+    IR_LoadGlobal, /* a: Symbol */
+    IR_StoreGlobal, /* a: Symbol, b: value */
+    IR_Call, /* extra[a]: function, extra[a+1..a+1+b): arguments */
+    IR_Print, /* extra[a..a+b): values */
+    /* terminators, last in every block and nowhere else */
+    IR_Jmp, /* a: block */
+    IR_Br, /* a: boolean, extra[b], extra[b+1]: blocks if true, false */
+    IR_Ret, /* a: value or IR_NONE */
+    IR_OpCount,
+} IrOp;
+#define ir_is_terminator(_op) ((_op) >= IR_Jmp && (_op) <= IR_Ret)
+
+typedef uint32_t IrRef;
+#define IR_NONE ((IrRef)-1)
+#define IR_MAX_PARAMS 6 /* all of them in registers */
+
+typedef struct IrInst {
+    uint8_t op; /* IrOp */
+    uint8_t type; /* IrType of the value, IR_Void if none */
+    IrRef a;
+    IrRef b;
+} IrInst;
+
+typedef struct IrBlock {
+    uint32_t first; /* instructions */
+    uint32_t count;
+} IrBlock;
+
+typedef struct IrFunc {
+    Symbol name; /* SYM_Empty for the top level */
+    IrType ret;
+    uint32_t params;
+    uint32_t first_block;
+    uint32_t blocks;
+    uint32_t first_inst; /* values print relative to this */
+    uint32_t insts;
+} IrFunc;
+
+typedef struct IrGlobal {
+    Symbol name;
+    IrType type;
+} IrGlobal;
+
+/*
+** Types of unannotated variables are inferred. A local has the type of the value it was last set to
+** and, after an if, the one its two values meet in, a global the one all its stores meet in.
+** A constant takes the type it meets when it fits, else the wider one wins (unsigned on a tie).
+*/
+typedef enum IrNoteKind {
+    IR_NoteValue, /* set to a value of the type */
+    IR_NoteConstant, /* set to a constant */
+    IR_NoteJoin, /* from[0] before an if, from[1] after its body */
+    IR_NoteWidened, /* a global stored from[0] and from[1] */
+} IrNoteKind;
+
+typedef struct IrNote {
+    Symbol func; /* SYM_Empty for globals */
+    Symbol name;
+    uint32_t line;
+    uint32_t column;
+    uint8_t kind; /* IrNoteKind */
+    uint8_t type; /* IrType */
+    uint8_t from[2];
+} IrNote;
+
+typedef struct IrModule {
+    struct {
+        IrInst* v;
+        size_t siz;
+        size_t cap;
+    } insts;
+    struct {
+        IrBlock* v;
+        size_t siz;
+        size_t cap;
+    } blocks;
+    struct {
+        uint32_t* v;
+        size_t siz;
+        size_t cap;
+    } extra; /* operand lists */
+    struct {
+        IrFunc* v;
+        size_t siz;
+        size_t cap;
+    } funcs; /* funcs.v[0] is the top level */
+    struct {
+        IrGlobal* v;
+        size_t siz;
+        size_t cap;
+    } globals;
+    struct {
+        IrNote* v;
+        size_t siz;
+        size_t cap;
+    } notes; /* locals in the order they were set, then globals */
+    InternTable* symbols;
+    Arena* arena;
+    int trap; /* arithmetic and conversions that leave their type end the program, else they wrap */
+} IrModule;
+
+/* what a function is lowered from */
+typedef struct IrDef {
+    NodeId node; /* the def, the root for the top level */
+    const uint8_t* type_args; /* IrType bound to each type parameter in an instance of a generic def, NULL otherwise */
+} IrDef;
+
+/* a generic def instantiated with some type arguments, slot of the instantiation cache */
+typedef struct IrInstance {
+    Symbol generic; /* name of the def, SYM_Empty for a free slot */
+    const uint8_t* type_args; /* as many as the def has type parameters */
+    uint32_t fn; /* the function lowered for them */
+} IrInstance;
+
+/* expression node waiting on the stack of lower_expr */
+typedef struct IrPending {
+    NodeId node;
+    uint32_t next; /* operands lowered so far */
+    uint32_t fn; /* called by a call, IR_NONE for print */
+} IrPending;
+
+typedef struct IrBuilder {
+    AbstractSyntaxTree* ast;
+    IrModule* ir;
+    Arena* arena;
+    Symbol print; /* the builtin */
+    uint32_t* funcs; /* function of every name, IR_NONE if none (or generic) */
+    NodeId* generics; /* def of every generic function by name, NODE_NONE if none */
+    struct {
+        IrDef* v;
+        size_t siz;
+        size_t cap;
+    } defs; /* of every function, in order */
+    struct {
+        IrInstance* slots; /* open addressing by name and type arguments */
+        size_t siz;
+        size_t cap; /* power of 2 */
+    } instances; /* every instantiation of the module is lowered once, whatever calls it */
+    IrRef* vars; /* value of every local by name, IR_NONE if none */
+    uint8_t* global_types; /* IrType of every global by name, IR_Void if none */
+    IrNote* global_notes; /* how the type of every global was decided, by name */
+    uint8_t* declared; /* IrType of every annotated local (argument) by name, IR_Void if inferred */
+    int widened; /* a global's type grew after it was read, the module is lowered again */
+    void* on_error; /* jmp_buf, an error leaves the function and waits for the end of the pass */
+    uint32_t error_line; /* of the first error of the pass */
+    uint32_t error_column;
+    char error[128]; /* empty if none */
+    struct {
+        Symbol* v;
+        size_t siz;
+        size_t cap;
+    } locals; /* names set in vars, in order */
+    struct {
+        struct {
+            IrPending* v;
+            size_t siz;
+            size_t cap;
+        } pending;
+        struct {
+            IrRef* v;
+            size_t siz;
+            size_t cap;
+        } values;
+    } expr; /* stacks of lower_expr, nesting depth never reaches the C stack */
+    uint32_t func; /* being lowered */
+    uint32_t block; /* instructions go here, IR_NONE right after a terminator */
+} IrBuilder;
+
+IrModule* ir_lower(AbstractSyntaxTree* ast, int trap, Arena* arena); /* Type errors go through the logger. */
+int ir_verify(const IrModule* ir); /* Number of problems, each is written to stderr. */
+void ir_print(const IrModule* ir, FILE* out);
+void ir_explain_types(const IrModule* ir, FILE* out); /* The notes, for --explain-types. */
+uint64_t ir_wrap(IrType type, uint64_t value); /* <value> cut to <type> and extended back to 64 bits */
+
+/* regalloc.c */
+typedef enum X86Reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} X86Reg;
+#define RA_MEMORY 0xFF /* in the spill slot of the value */
+
+/*
+** Positions: 2*i reads the operands of instruction i, 2*i+1 writes its value (i relative to the function).
+** A value lives in one place per segment, its segments cover its whole interval in order.
+*/
+typedef struct RaSegment {
+    uint32_t from;
+    uint32_t to;
+    uint32_t next; /* next segment of the value, IR_NONE for the last */
+    uint8_t reg; /* X86Reg or RA_MEMORY */
+} RaSegment;
+
+typedef struct RaInterval {
+    IrRef value; /* relative to the function */
+    uint32_t start;
+    uint32_t end;
+    uint32_t seg; /* segment once it has a register */
+} RaInterval;
+
+/* the value is loaded from its slot right before the instruction at <pos> */
+typedef struct RaReload {
+    IrRef value;
+    uint32_t pos;
+} RaReload;
+
+typedef struct RegAlloc {
+    uint32_t* segs_of; /* first segment of every value, IR_NONE if it is never used */
+    uint32_t* slots; /* spill slot of every value, IR_NONE if it never goes to memory */
+    uint32_t slot_count;
+    uint16_t callee_saved; /* mask of the callee saved registers handed out */
+    struct {
+        RaSegment* v;
+        size_t siz;
+        size_t cap;
+    } segs;
+    struct {
+        RaReload* v;
+        size_t siz;
+        size_t cap;
+    } reloads; /* by position */
+    struct {
+        IrRef* v;
+        size_t siz;
+        size_t cap;
+    } split; /* values with more than one segment */
+} RegAlloc;
+
+RegAlloc* regalloc_function(const IrModule* ir, const IrFunc* f, Arena* arena);
+uint8_t regalloc_location(const RegAlloc* ra, IrRef v, uint32_t pos); /* X86Reg or RA_MEMORY */
+
+/* x86.c */
+/*
+** Machine code of the whole program, x86-64 instructions in AT&T order (source first).
+** It is printed as GNU as for -S, or encoded to bytes for the object and executable writers.
+*/
+typedef enum MOp {
+    M_Label, /* pseudo, places label src.imm */
+    M_Mov, M_MovAbs,
+    M_Movsx, M_Movzx, /* aux: bytes of the source */
+    M_Lea,
+    M_Add, M_Sub, M_Imul, M_Xor, M_And, M_Or, M_Cmp, M_Test, /* imul also takes an immediate, dst = dst * imm */
+    M_Shl, M_Shr, M_Sar, /* src: the count, an immediate */
+    M_Neg, M_Inc, M_Dec, M_Mul, M_Div, M_Idiv, M_Cqto,
+    M_RepMovsb, /* copies %rcx bytes from (%rsi) to (%rdi) */
+    M_Setcc, /* aux: X86Cond */
+    M_Push, M_Pop,
+    M_Jmp, M_Jcc, M_Call, /* src: label, aux: X86Cond of M_Jcc */
+    M_Ret, M_Leave, M_Syscall,
+    M_OpCount,
+} MOp;
+
+typedef enum X86Cond {
+    CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G,
+} X86Cond; /* the low nibble of the jcc/setcc opcodes */
+
+typedef enum MOperandKind {
+    MO_None,
+    MO_Reg, /* reg */
+    MO_Imm, /* imm */
+    MO_Mem, /* imm(reg) */
+    MO_Label, /* label imm, label(%rip) as a memory operand */
+} MOperandKind;
+
+typedef struct MOperand {
+    uint8_t kind;
+    uint8_t reg;
+    int64_t imm;
+} MOperand;
+#define mo_reg(_r) ((MOperand){.kind = MO_Reg, .reg = (uint8_t)(_r)})
+#define mo_imm(_v) ((MOperand){.kind = MO_Imm, .imm = (int64_t)(_v)})
+#define mo_mem(_base, _disp) ((MOperand){.kind = MO_Mem, .reg = (uint8_t)(_base), .imm = (int64_t)(_disp)})
+#define mo_label(_l) ((MOperand){.kind = MO_Label, .imm = (int64_t)(_l)})
+#define mo_none ((MOperand){.kind = MO_None})
+
+typedef struct MInst {
+    uint8_t op;
+    uint8_t width; /* bytes of the operation, 1 2 4 or 8 */
+    uint8_t aux;
+    MOperand src;
+    MOperand dst;
+} MInst;
+
+typedef enum MSection {
+    MS_Text,
+    MS_Rodata,
+    MS_Bss,
+} MSection;
+
+typedef struct MLabel {
+    const char* name; /* names starting with .L stay out of the symbol table */
+    uint32_t len;
+    uint8_t section;
+    uint8_t global;
+    uint32_t offset; /* in the section, once encoded */
+} MLabel;
+
+/* string constant in .rodata, the 8 byte length then the bytes */
+typedef struct MString {
+    uint32_t label;
+    Symbol text;
+} MString;
+
+typedef struct MBss {
+    uint32_t label;
+    uint32_t size;
+} MBss;
+
+typedef struct MachineCode {
+    struct {
+        MInst* v;
+        size_t siz;
+        size_t cap;
+    } insts; /* .text */
+    struct {
+        MLabel* v;
+        size_t siz;
+        size_t cap;
+    } labels;
+    struct {
+        MString* v;
+        size_t siz;
+        size_t cap;
+    } strings;
+    struct {
+        MBss* v;
+        size_t siz;
+        size_t cap;
+    } bss;
+    uint32_t entry; /* label of _start */
+    InternTable* symbols;
+    Arena* arena;
+} MachineCode;
+
+/* where the address of a label goes, a 32-bit displacement from the end of the instruction */
+typedef struct X86Reloc {
+    uint32_t offset; /* of the displacement in .text */
+    uint32_t label;
+    int32_t addend;
+} X86Reloc;
+
+typedef struct X86Object {
+    uint8_t* text;
+    uint32_t text_size;
+    uint8_t* rodata;
+    uint32_t rodata_size;
+    uint32_t bss_size;
+    X86Reloc* relocs; /* only the references to .rodata and .bss, jumps and calls are resolved */
+    size_t relocs_siz;
+} X86Object;
+
+MachineCode* x86_create(InternTable* symbols, Arena* arena);
+uint32_t x86_label(MachineCode* mc, MSection section, const char* name, uint32_t len); /* <name> has to outlive <mc>. */
+void x86_put(MachineCode* mc, MOp op, uint8_t width, MOperand src, MOperand dst);
+void x86_print(const MachineCode* mc, FILE* out); /* GNU as, AT&T syntax. */
+X86Object* x86_encode(MachineCode* mc, Arena* arena); /* Lays out every section and fills in the label offsets. */
+
+/* elf.c */
+int elf_write_object(const MachineCode* mc, const X86Object* obj, FILE* out); /* ELF64 relocatable, 0 on success. */
+int elf_write_executable(const MachineCode* mc, const X86Object* obj, FILE* out); /* Static, starts at mc->entry. */
+
+/* peep.c */
+typedef enum PeepRule {
+    PEEP_JumpToNext, /* jmp/jcc to the label right after it */
+    PEEP_JumpChain, /* jmp/jcc to a jmp, goes to the final target */
+    PEEP_BranchOverJump, /* jcc L; jmp M; L: becomes jncc M */
+    PEEP_Unreachable, /* code after a jmp or ret up to a label something refers to */
+    PEEP_ShrinkImmediate, /* shorter encoding of the same immediate */
+    PEEP_ZeroToXor, /* mov $0, %r becomes xor %r, %r */
+    PEEP_SameImmediate, /* mov $k, %b becomes mov %a, %b while %a holds k */
+    PEEP_StoreLoad, /* a load right after a store to the same place reads the register */
+    PEEP_RedundantMove, /* a move of a value back where it already is */
+    PEEP_RuleCount,
+} PeepRule;
+
+typedef struct PeepStats {
+    uint32_t hits[PEEP_RuleCount];
+    uint32_t before; /* instructions */
+    uint32_t after;
+    uint32_t passes;
+} PeepStats;
+
+void peep_optimize(MachineCode* mc, PeepStats* stats); /* Rewrites mc->insts in place, <stats> may be NULL. */
+void peep_print_stats(const PeepStats* stats, FILE* out);
+
+/* runtime.c */
+typedef enum RuntimeRoutine {
+    RT_PrintUint, /* %rdi */
+    RT_PrintInt, /* %rdi */
+    RT_PrintStr, /* %rdi = the string */
+    RT_PrintChar, /* %dil */
+    RT_Flush, /* stdout buffer out, before the program exits */
+    RT_Overflow, /* jumped to, flushes, reports and exits with status 1 */
+    RT_DivZero, /* same */
+    /* only in programs with dynamic values */
+    RT_PrintDyn, /* %rdi = a dynamic value */
+    RT_DynInts, /* %rax, %r11 = dynamic values made integers, a boolean is 0 or 1, a string traps */
+    RT_DynAdd, /* same, except two strings are joined into %rax */
+    RT_DynEq, /* %rax, %r11 = dynamic values made integers that are equal when the values are */
+    RT_TypeError, /* trap */
+    RT_OutOfMemory, /* trap */
+    RT_Count,
+} RuntimeRoutine;
+#define RT_FirstDynamic RT_PrintDyn
+
+typedef struct Runtime {
+    uint32_t routines[RT_Count]; /* text labels */
+    uint32_t out; /* .bss stdout buffer */
+    uint32_t out_len;
+    uint32_t pairs; /* .rodata, "00" to "99" as a string */
+    uint32_t heap; /* .bss strings joined at run time, never freed */
+    uint32_t heap_len;
+    uint32_t texts[RT_Count]; /* .rodata, message of each trap */
+    int dynamic; /* set before declaring, the program has IR_Dyn values */
+} Runtime;
+
+void runtime_declare(MachineCode* mc, Runtime* rt); /* Labels, before the program refers to them. */
+void runtime_emit(MachineCode* mc, const Runtime* rt); /* Appends the routines. */
+
+/* gen.c */
+
+typedef struct GenState {
+    const IrModule* ir;
+    MachineCode* mc;
+    const IrFunc* func; /* being generated */
+    const RegAlloc* ra; /* of the function */
+    size_t reload; /* next one to emit */
+    uint32_t pushed; /* callee saved registers below %rbp */
+    uint32_t edges; /* last edge label used */
+    uint32_t divisions; /* last label of a division by -1 used */
+    uint32_t dynamics; /* last label of a dynamic operation used */
+    uint32_t* func_labels; /* by function */
+    uint32_t* block_labels; /* by block */
+    uint32_t* global_labels; /* by name */
+    uint32_t* string_labels; /* by string, label+1 once it is used */
+    Runtime runtime;
+    Arena* arena;
+} GenState;
+
+MachineCode* gen_code(const IrModule* ir, Arena* arena); /* x86-64 for Linux, the program starts at _start. */
@@ -0,0 +1,161 @@
+/*
+** String interning.
+** Every distinct spelling of a compilation gets a dense 32-bit symbol, equal text <=> equal symbol,
+** so names, keywords and literals are compared as integers after lexing.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define INTERN_INIT_CAPACITY    1024 /* power of 2 */
+#define INTERN_GROWTH           2
+/*}=======================*/
+
+/* spellings every table starts with, the lexer and parser refer to them by SymbolPreset */
+static const struct {
+    const char* name;
+    uint32_t len;
+} PRESETS[SYM_PresetCount] = {
+    /* keywords */
+    [SYM_class] = {"class", 5},     [SYM_and] = {"and", 3},         [SYM_as] = {"as", 2},
+    [SYM_async] = {"async", 5},     [SYM_await] = {"await", 5},     [SYM_break] = {"break", 5},
+    [SYM_continue] = {"continue", 8}, [SYM_def] = {"def", 3},       [SYM_del] = {"del", 3},
+    [SYM_elif] = {"elif", 4},       [SYM_else] = {"else", 4},       [SYM_except] = {"except", 6},
+    [SYM_finally] = {"finally", 7}, [SYM_for] = {"for", 3},         [SYM_from] = {"from", 4},
+    [SYM_global] = {"global", 6},   [SYM_if] = {"if", 2},           [SYM_import] = {"import", 6},
+    [SYM_in] = {"in", 2},           [SYM_is] = {"is", 2},           [SYM_lambda] = {"lambda", 6},
+    [SYM_nonlocal] = {"nonlocal", 8}, [SYM_not] = {"not", 3},       [SYM_or] = {"or", 2},
+    [SYM_pass] = {"pass", 4},       [SYM_raise] = {"raise", 5},     [SYM_return] = {"return", 6},
+    [SYM_try] = {"try", 3},         [SYM_while] = {"while", 5},     [SYM_with] = {"with", 4},
+    [SYM_yield] = {"yield", 5},     [SYM_end] = {"end", 3},
+    /* types */
+    [SYM_i8] = {"i8", 2},           [SYM_i16] = {"i16", 3},         [SYM_i32] = {"i32", 3},
+    [SYM_i64] = {"i64", 3},         [SYM_u8] = {"u8", 2},           [SYM_u16] = {"u16", 3},
+    [SYM_u32] = {"u32", 3},         [SYM_u64] = {"u64", 3},         [SYM_string] = {"string", 6},
+    [SYM_boolean] = {"boolean", 7},
+    /* constants */
+    [SYM_True] = {"True", 4},       [SYM_False] = {"False", 5},     [SYM_None] = {"None", 4},
+};
+
+/*
+** Up to 7 bytes of <name> with the length on top.
+** Spellings shorter than 8 bytes are equal exactly when their heads are.
+*/
+static inline uint64_t spelling_head(const char* name, uint32_t len) {
+    uint64_t head = (uint64_t)(len < 255 ? len : 255) << 56;
+    for (uint32_t i = 0; i < len && i < 7; i++)
+        head |= (uint64_t)(uint8_t)name[i] << (i*8);
+    return head;
+}
+
+static inline uint32_t mix(uint64_t h) {
+    h *= 0xFF51AFD7ED558CCDull;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/*
+** Short spellings hash their head, longer ones go 8 bytes at a time,
+** the tail is copied so nothing past <name>+<len> is read.
+*/
+static uint32_t hash_spelling(const char* name, uint32_t len, uint64_t head) {
+    if (len < 8)
+        return mix(head);
+    uint64_t h = len * 0x9E3779B97F4A7C15ull;
+    uint64_t w;
+    for (; len >= 8; name += 8, len -= 8) {
+        memcpy(&w, name, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, name, len);
+    return mix(h ^ w);
+}
+
+/*
+** Slot holding <name>, or the free slot where it would go.
+** Short spellings are matched in the slot alone, without touching the entries or the source they view.
+*/
+static InternSlot* find_slot(InternTable* it, const char* name, uint32_t len, uint32_t hash, uint64_t head) {
+    size_t mask = it->slots_cap-1;
+    for (size_t i = hash & mask;; i = (i+1) & mask) {
+        InternSlot* slot = &it->slots[i];
+        if (slot->sym == SYM_Empty)
+            return slot;
+        if (slot->hash == hash && slot->head == head) {
+            if (len < 8)
+                return slot;
+            const SymbolEntry* e = &it->v[slot->sym];
+            if (e->len == len && memcmp(e->name, name, len) == 0)
+                return slot;
+        }
+    }
+}
+
+static Symbol push_entry(InternTable* it, const char* name, uint32_t len, uint32_t hash) {
+    if (it->siz + 1 > it->cap) {
+        it->v = arena_realloc(it->arena, it->v, sizeof(SymbolEntry)*it->cap, sizeof(SymbolEntry)*it->cap*INTERN_GROWTH);
+        it->cap *= INTERN_GROWTH;
+    }
+    it->v[it->siz] = (SymbolEntry){name, len, hash};
+    return (Symbol)it->siz++;
+}
+
+static void place_slot(void* table, const void* slot) {
+    InternTable* it = table;
+    const InternSlot* s = slot;
+    if (s->sym != SYM_Empty)
+        *find_slot(it, it->v[s->sym].name, it->v[s->sym].len, s->hash, s->head) = *s;
+}
+
+/*
+** API
+*/
+InternTable* intern_create(Arena* arena) {
+    InternTable* it = arena_alloc(arena, sizeof(InternTable));
+    *it = (InternTable){
+        .arena = arena,
+        .v = arena_alloc(arena, sizeof(SymbolEntry)*INTERN_INIT_CAPACITY),
+        .siz = 0,
+        .cap = INTERN_INIT_CAPACITY,
+        .slots = arena_alloc(arena, sizeof(InternSlot)*INTERN_INIT_CAPACITY),
+        .slots_cap = INTERN_INIT_CAPACITY,
+    };
+    memset(it->slots, 0, sizeof(InternSlot)*it->slots_cap);
+
+    /* "" and the one character strings are never hashed */
+    char* chars = arena_alloc(arena, 256);
+    push_entry(it, "", 0, 0);
+    for (int c = 0; c < 256; c++) {
+        chars[c] = (char)c;
+        push_entry(it, &chars[c], 1, 0);
+    }
+    for (Symbol s = SYM_Char + 256; s < SYM_PresetCount; s++) {
+        const char* name = PRESETS[s].name;
+        uint32_t len = PRESETS[s].len;
+        uint64_t head = spelling_head(name, len);
+        uint32_t hash = hash_spelling(name, len, head);
+        *find_slot(it, name, len, hash, head) = (InternSlot){head, hash, push_entry(it, name, len, hash)};
+    }
+    return it;
+}
+
+Symbol intern(InternTable* it, const char* name, uint32_t len) {
+    if (len < 2)
+        return len == 0 ? SYM_Empty : symbol_of_char(*name);
+
+    uint64_t head = spelling_head(name, len);
+    uint32_t hash = hash_spelling(name, len, head);
+    InternSlot* slot = find_slot(it, name, len, hash, head);
+    if (slot->sym != SYM_Empty)
+        return slot->sym;
+
+    if ((it->siz + 1)*2 > it->slots_cap) {
+        arena_grow_slots(it->arena, &it->slots, &it->slots_cap, INTERN_GROWTH, sizeof(InternSlot), place_slot, it);
+        slot = find_slot(it, name, len, hash, head);
+    }
+    *slot = (InternSlot){head, hash, push_entry(it, name, len, hash)};
+    return slot->sym;
+}
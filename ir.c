@@ -0,0 +1,1625 @@
+/*
+** SSA intermediate representation.
+** The tree is lowered function by function into one module, checked by the verifier and printed for --emit-ir.
+** Locals are SSA values, joins get phis, globals stay in memory and go through loads and stores.
+** The types of unannotated variables are inferred on the way (see IrNote), a global that has to grow
+** after it was used gets the module lowered again.
+** Operations on constants are folded while lowering, an if on a constant keeps only the branch taken.
+** With trap set, a constant that leaves its type is an error here, the rest is checked at run time by gen.c.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "head.h"
+
+/* config */
+#define IR_INIT_CAPACITY        256
+#define IR_GROWTH               2
+#define IR_INSTANCES_INIT_CAPACITY 16 /* instantiation cache slots, power of 2 */
+/*}=======================*/
+
+static const char* TYPE_NAMES[IR_TypeCount] = {
+    [IR_Void] = "None", [IR_Bool] = "boolean",
+    [IR_I8] = "i8", [IR_I16] = "i16", [IR_I32] = "i32", [IR_I64] = "i64",
+    [IR_U8] = "u8", [IR_U16] = "u16", [IR_U32] = "u32", [IR_U64] = "u64",
+    [IR_Str] = "string", [IR_Dyn] = "dynamic",
+};
+
+static const char* OP_NAMES[IR_OpCount] = {
+    [IR_Const] = "const", [IR_String] = "str", [IR_Param] = "param",
+    [IR_Add] = "add", [IR_Sub] = "sub", [IR_Mul] = "mul", [IR_Div] = "div", [IR_Mod] = "mod", [IR_Neg] = "neg",
+    [IR_Eq] = "eq", [IR_Ne] = "ne", [IR_Lt] = "lt", [IR_Le] = "le", [IR_Gt] = "gt", [IR_Ge] = "ge",
+    [IR_Conv] = "conv", [IR_Tag] = "tag", [IR_Untag] = "untag", [IR_Phi] = "phi",
+    [IR_LoadGlobal] = "load", [IR_StoreGlobal] = "store", [IR_Call] = "call", [IR_Print] = "print",
+    [IR_Jmp] = "jmp", [IR_Br] = "br", [IR_Ret] = "ret",
+};
+
+/* bytes of each integer width, the widest wins when two meet */
+static const uint8_t TYPE_BYTES[IR_TypeCount] = {
+    [IR_Bool] = 1, [IR_I8] = 1, [IR_I16] = 2, [IR_I32] = 4, [IR_I64] = 8,
+    [IR_U8] = 1, [IR_U16] = 2, [IR_U32] = 4, [IR_U64] = 8, [IR_Str] = 8, [IR_Dyn] = 8,
+};
+
+/* appends <_val> to a {v, siz, cap} array of the arena */
+#define ir_push(_arena, _arr, _val) do {                                                                            \
+    if ((_arr).siz + 1 > (_arr).cap) {                                                                              \
+        (_arr).v = arena_realloc(_arena, (_arr).v, sizeof(*(_arr).v)*(_arr).cap, sizeof(*(_arr).v)*(_arr).cap*IR_GROWTH); \
+        (_arr).cap *= IR_GROWTH;                                                                                    \
+    }                                                                                                               \
+    (_arr).v[(_arr).siz++] = (_val);                                                                                \
+} while (0)
+
+#define ir_init(_arena, _arr) do {                                          \
+    (_arr).v = arena_alloc(_arena, sizeof(*(_arr).v)*IR_INIT_CAPACITY);     \
+    (_arr).siz = 0;                                                         \
+    (_arr).cap = IR_INIT_CAPACITY;                                          \
+} while (0)
+
+#define type_of(_ir, _ref) ((IrType)(_ir)->insts.v[_ref].type)
+
+/*
+** Lowering
+*/
+#define node_of(_b, _id) (&(_b)->ast->nodes[_id])
+
+/*
+** Type error at <nd>.
+** It may only be there because a global has not grown to its final type yet, so the first one of a pass
+** is kept and the function is left, the pass goes on and reports it only if nothing grew.
+** Outside of a function it is reported right away.
+*/
+static void lower_error(IrBuilder* b, const Node* nd, const char* code) {
+    if (b->on_error == NULL)
+        logger_compile_error(ts_line(b->ast->ts, nd->offset), ts_column(b->ast->ts, nd->offset)-1, code);
+    if (b->error[0] == '\0') {
+        b->error_line = (uint32_t)ts_line(b->ast->ts, nd->offset);
+        b->error_column = (uint32_t)ts_column(b->ast->ts, nd->offset)-1;
+        snprintf(b->error, sizeof(b->error), "%s", code);
+    }
+    longjmp(*(jmp_buf*)b->on_error, 1);
+}
+
+static void expect_type(IrBuilder* b, const Node* nd, IrType got, IrType want) {
+    if (got == want)
+        return;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "Expected %s, got %s.", TYPE_NAMES[want], TYPE_NAMES[got]);
+    lower_error(b, nd, buf);
+}
+
+/* the type <nd> names in function <fn>, where the type parameters of a generic def stand for its type arguments */
+static IrType type_of_name(IrBuilder* b, uint32_t fn, const Node* nd) {
+    switch (nd->value) {
+        case SYM_i8: return IR_I8;
+        case SYM_i16: return IR_I16;
+        case SYM_i32: return IR_I32;
+        case SYM_i64: return IR_I64;
+        case SYM_u8: return IR_U8;
+        case SYM_u16: return IR_U16;
+        case SYM_u32: return IR_U32;
+        case SYM_u64: return IR_U64;
+        case SYM_boolean: return IR_Bool;
+        case SYM_string: return IR_Str;
+        case SYM_None: return IR_Void;
+        default: {
+            const IrDef* def = &b->defs.v[fn];
+            if (def->type_args != NULL) {
+                const Node* params = ast_child(b->ast, node_of(b, def->node), 0);
+                for (uint32_t i = 0; i < params->count; i++)
+                    if (ast_child(b->ast, params, i)->value == nd->value)
+                        return (IrType)def->type_args[i];
+            }
+            lower_error(b, nd, "Unknown type.");
+            return IR_Void;
+        }
+    }
+}
+
+/* the def keeps its arguments under child 0 and its return type under child 1, a generic one has its type parameters before */
+#define def_generic(_b, _def) (node_of(_b, _def)->count > 0 && ast_child((_b)->ast, node_of(_b, _def), 0)->kind == ND_TypeParameterListExpression)
+#define def_params(_b, _def) ast_child((_b)->ast, node_of(_b, _def), def_generic(_b, _def))
+#define def_return(_b, _fn) type_of_name(_b, _fn, ast_child((_b)->ast, node_of(_b, (_b)->defs.v[_fn].node), def_generic(_b, (_b)->defs.v[_fn].node) + 1))
+#define def_body(_b, _def) (def_generic(_b, _def) + 2) /* first statement */
+
+/*
+** New block, instructions go there from now on and the one before has to be terminated.
+** Blocks are numbered in the order they are laid out, jumps forward are patched once the target starts.
+*/
+static uint32_t start_block(IrBuilder* b) {
+    ir_push(b->arena, b->ir->blocks, ((IrBlock){(uint32_t)b->ir->insts.siz, 0}));
+    b->block = (uint32_t)b->ir->blocks.siz-1;
+    return b->block;
+}
+
+/*
+** Appends to the current block.
+** Code after a terminator (return) is unreachable and gets a block without predecessors.
+*/
+static IrRef emit(IrBuilder* b, IrOp op, IrType type, uint32_t x, uint32_t y) {
+    if (b->block == IR_NONE)
+        start_block(b);
+    ir_push(b->arena, b->ir->insts, ((IrInst){.op = (uint8_t)op, .type = (uint8_t)type, .a = x, .b = y}));
+    b->ir->blocks.v[b->block].count++;
+    if (ir_is_terminator(op))
+        b->block = IR_NONE;
+    return (IrRef)b->ir->insts.siz-1;
+}
+
+/* <n> free operand slots */
+static uint32_t push_extra(IrBuilder* b, uint32_t n) {
+    uint32_t at = (uint32_t)b->ir->extra.siz;
+    for (uint32_t i = 0; i < n; i++)
+        ir_push(b->arena, b->ir->extra, IR_NONE);
+    return at;
+}
+
+static IrRef emit_const(IrBuilder* b, IrType type, uint64_t value) {
+    value = ir_wrap(type, value);
+    return emit(b, IR_Const, type, (uint32_t)value, (uint32_t)(value >> 32));
+}
+
+#define is_const(_b, _ref) ((_b)->ir->insts.v[_ref].op == IR_Const)
+#define const_value(_b, _ref) ((uint64_t)(_b)->ir->insts.v[_ref].a | (uint64_t)(_b)->ir->insts.v[_ref].b << 32)
+
+/* with trap set, a constant that left <type> */
+static void check_constant(IrBuilder* b, const Node* nd, IrType type, int overflows) {
+    if (!b->ir->trap || !overflows)
+        return;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "Constant overflows %s.", TYPE_NAMES[type]);
+    lower_error(b, nd, buf);
+}
+
+/*
+** Whether <value> of <from> is also a value of <to>, booleans take anything.
+** Values are extended to 64 bits, only u64 has some that read as negative.
+*/
+static int fits(IrType from, IrType to, uint64_t value) {
+    if (to == IR_Bool)
+        return 1;
+    if ((from == IR_U64) != (to == IR_U64) && (int64_t)value < 0)
+        return 0;
+    return ir_wrap(to, value) == value;
+}
+
+/* integers keep 63 bits in a dynamic value */
+#define IR_DYN_MIN (-((int64_t)1 << 62))
+#define IR_DYN_MAX (((int64_t)1 << 62) - 1)
+
+/* <ref> of a static type as a dynamic value, constant integers and booleans are tagged here */
+static IrRef tag(IrBuilder* b, const Node* nd, IrRef ref) {
+    const IrType from = type_of(b->ir, ref);
+    if (!is_const(b, ref))
+        return emit(b, IR_Tag, IR_Dyn, ref, IR_NONE);
+    const uint64_t value = const_value(b, ref);
+    if (from == IR_Bool)
+        return emit_const(b, IR_Dyn, value << IR_DYN_BOOL_BITS | IR_DYN_BOOL);
+    const int fits_dyn = from == IR_U64 ? value <= (uint64_t)IR_DYN_MAX : (int64_t)value >= IR_DYN_MIN && (int64_t)value <= IR_DYN_MAX;
+    if (!fits_dyn) /* with or without trap, it would come back as another number */
+        lower_error(b, nd, "Constant overflows dynamic.");
+    return emit_const(b, IR_Dyn, value << IR_DYN_INT_BITS);
+}
+
+/*
+** <ref> as <type>, integers convert into each other (and wrap, or trap), anything else has to match.
+** Anything with a value goes into a dynamic one, which comes back out as an integer or a string checked at run time.
+*/
+static IrRef convert(IrBuilder* b, const Node* nd, IrRef ref, IrType type) {
+    IrType from = ref == IR_NONE ? IR_Void : type_of(b->ir, ref);
+    if (from == type)
+        return ref;
+    if (type == IR_Dyn && from != IR_Void)
+        return tag(b, nd, ref);
+    if (from == IR_Dyn && (ir_is_int(type) || type == IR_Str))
+        return emit(b, IR_Untag, type, ref, IR_NONE);
+    if (!ir_is_int(from) || !ir_is_int(type))
+        expect_type(b, nd, from, type);
+    if (is_const(b, ref)) {
+        check_constant(b, nd, type, !fits(from, type, const_value(b, ref)));
+        return emit_const(b, type, type == IR_Bool ? const_value(b, ref) != 0 : const_value(b, ref));
+    }
+    return emit(b, IR_Conv, type, ref, IR_NONE);
+}
+
+/*
+** Folding.
+** <x> op <y> in <type> (the operands' type for comparisons), 0 when it has to be left to run time:
+** division by zero, and the i64 division that overflows, are handled there.
+*/
+static int fold_binary(IrOp op, IrType type, uint64_t x, uint64_t y, uint64_t* out) {
+    const int sign = ir_is_signed(type);
+    switch (op) {
+        case IR_Add: *out = x + y; break;
+        case IR_Sub: *out = x - y; break;
+        case IR_Mul: *out = x * y; break;
+        case IR_Div: case IR_Mod: {
+            if (y == 0 || (sign && (int64_t)x == INT64_MIN && (int64_t)y == -1))
+                return 0;
+            if (sign)
+                *out = (uint64_t)(op == IR_Div ? (int64_t)x / (int64_t)y : (int64_t)x % (int64_t)y);
+            else
+                *out = op == IR_Div ? x / y : x % y;
+            break;
+        }
+        case IR_Eq: *out = x == y; break;
+        case IR_Ne: *out = x != y; break;
+        case IR_Lt: *out = sign ? (int64_t)x < (int64_t)y : x < y; break;
+        case IR_Le: *out = sign ? (int64_t)x <= (int64_t)y : x <= y; break;
+        case IR_Gt: *out = sign ? (int64_t)x > (int64_t)y : x > y; break;
+        case IR_Ge: *out = sign ? (int64_t)x >= (int64_t)y : x >= y; break;
+        default: return 0;
+    }
+    return 1;
+}
+
+/*
+** Whether <value> folded from <x> op <y> left <type>.
+** Narrower operands are extended, so their 64 bit result is exact and only has to fit.
+*/
+static int fold_overflows(IrOp op, IrType type, uint64_t x, uint64_t y, uint64_t value) {
+    int64_t s;
+    uint64_t u;
+    switch (type) {
+        case IR_I64: {
+            if (op == IR_Add) return __builtin_add_overflow((int64_t)x, (int64_t)y, &s);
+            if (op == IR_Sub) return __builtin_sub_overflow((int64_t)x, (int64_t)y, &s);
+            if (op == IR_Mul) return __builtin_mul_overflow((int64_t)x, (int64_t)y, &s);
+            return 0; /* INT64_MIN / -1 isn't folded */
+        }
+        case IR_U64: {
+            if (op == IR_Add) return __builtin_add_overflow(x, y, &u);
+            if (op == IR_Sub) return __builtin_sub_overflow(x, y, &u);
+            if (op == IR_Mul) return __builtin_mul_overflow(x, y, &u);
+            return 0;
+        }
+        default: return !fits(type, type, value);
+    }
+}
+
+/* <op> of <type> on two values of the same type, a constant when both are */
+static IrRef emit_binary(IrBuilder* b, const Node* nd, IrOp op, IrType type, IrRef x, IrRef y) {
+    uint64_t value;
+    if (is_const(b, x) && is_const(b, y) && fold_binary(op, type_of(b->ir, x), const_value(b, x), const_value(b, y), &value)) {
+        check_constant(b, nd, type, fold_overflows(op, type, const_value(b, x), const_value(b, y), value));
+        return emit_const(b, type, value);
+    }
+    return emit(b, op, type, x, y);
+}
+
+/* <len> bytes of <txt> as a string constant, the text is copied */
+static IrRef emit_string(IrBuilder* b, const char* txt, uint32_t len) {
+    char* copy = arena_alloc(b->arena, len+1);
+    memcpy(copy, txt, len);
+    return emit(b, IR_String, IR_Str, intern(b->ir->symbols, copy, len), IR_NONE);
+}
+
+/* the wider integer type, unsigned on a tie, booleans count as i64 */
+static IrType wider(IrType tx, IrType ty) {
+    if (tx == IR_Bool)
+        tx = IR_I64;
+    if (ty == IR_Bool)
+        ty = IR_I64;
+    if (tx == ty)
+        return tx;
+    if (TYPE_BYTES[tx] != TYPE_BYTES[ty])
+        return TYPE_BYTES[tx] > TYPE_BYTES[ty] ? tx : ty;
+    return ir_is_signed(tx) ? ty : tx;
+}
+
+/* type two integer operands meet in, literals take the type of the other side */
+static IrType common_type(IrBuilder* b, IrRef x, IrRef y) {
+    IrType tx = type_of(b->ir, x), ty = type_of(b->ir, y);
+    if (is_const(b, x) && !is_const(b, y))
+        tx = ty;
+    else if (is_const(b, y) && !is_const(b, x))
+        ty = tx;
+    return wider(tx, ty);
+}
+
+/*
+** Type a variable of type <have> takes when it is also set to <value>, IR_Dyn when they are of different kinds.
+** Unlike operands, a constant only takes the type it meets when it fits.
+*/
+static IrType join_type(IrBuilder* b, IrType have, IrRef value) {
+    const IrType type = type_of(b->ir, value);
+    if (type == have)
+        return have;
+    if (!ir_is_int(type) || !ir_is_int(have) || (type == IR_Bool) != (have == IR_Bool))
+        return IR_Dyn;
+    if (is_const(b, value) && fits(type, have, const_value(b, value)))
+        return have;
+    return wider(have, type);
+}
+
+/* the two values of a local meeting after an if */
+static IrType join_values(IrBuilder* b, IrRef x, IrRef y) {
+    if (is_const(b, x) && !is_const(b, y))
+        return join_type(b, type_of(b->ir, y), x);
+    return join_type(b, type_of(b->ir, x), y);
+}
+
+static IrNote make_note(IrBuilder* b, const Node* nd, Symbol func, Symbol name, IrNoteKind kind, IrType type, IrType x, IrType y) {
+    return (IrNote){
+        .func = func, .name = name,
+        .line = (uint32_t)ts_line(b->ast->ts, nd->offset), .column = (uint32_t)ts_column(b->ast->ts, nd->offset),
+        .kind = (uint8_t)kind, .type = (uint8_t)type, .from = {(uint8_t)x, (uint8_t)y},
+    };
+}
+
+/* unannotated local <name> set to <value> */
+static void note_local(IrBuilder* b, const Node* nd, Symbol name, IrRef value) {
+    const IrNoteKind kind = is_const(b, value) ? IR_NoteConstant : IR_NoteValue;
+    ir_push(b->arena, b->ir->notes, make_note(b, nd, b->ir->funcs.v[b->func].name, name, kind, type_of(b->ir, value), IR_Void, IR_Void));
+}
+
+static IrRef check_int_operand(IrBuilder* b, NodeId id, IrRef ref) {
+    IrType type = ref == IR_NONE ? IR_Void : type_of(b->ir, ref);
+    if (!ir_is_int(type))
+        expect_type(b, node_of(b, id), type, IR_I64);
+    return ref;
+}
+
+#define is_string(_b, _ref) ((_ref) != IR_NONE && type_of((_b)->ir, _ref) == IR_Str)
+#define is_dynamic(_b, _ref) ((_ref) != IR_NONE && type_of((_b)->ir, _ref) == IR_Dyn)
+#define is_string_const(_b, _ref) ((_b)->ir->insts.v[_ref].op == IR_String)
+
+static uint64_t parse_number(IrBuilder* b, const Node* nd) {
+    const char* txt = symbol_name(b->ast->symbols, nd->value);
+    uint32_t len = symbol_len(b->ast->symbols, nd->value);
+    uint64_t base = 10, value = 0;
+    uint32_t i = 0;
+    if (len > 1 && txt[0] == '0' && txt[1] == 'x') {
+        base = 16;
+        i = 2;
+    }
+    if (i == len)
+        lower_error(b, nd, "Malformed number."); /* 0x alone */
+    for (; i < len; i++) {
+        const char c = txt[i];
+        uint64_t digit = c >= '0' && c <= '9' ? (uint64_t)(c - '0') : base == 16 && (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (uint64_t)((c | 0x20) - 'a' + 10) : base;
+        if (digit >= base)
+            lower_error(b, nd, "Malformed number.");
+        if (value > (UINT64_MAX - digit) / base)
+            lower_error(b, nd, "Number too big.");
+        value = value*base + digit;
+    }
+    return value;
+}
+
+static IrOp arithmetic_op(IrBuilder* b, const Node* nd, char op) {
+    switch (op) {
+        case '+': return IR_Add;
+        case '-': return IR_Sub;
+        case '*': return IR_Mul;
+        case '/': return IR_Div;
+        case '%': return IR_Mod;
+        default: {
+            lower_error(b, nd, "Unknown operator.");
+            return IR_Add;
+        }
+    }
+}
+
+static IrRef lower_arithmetic(IrBuilder* b, const Node* nd, const IrRef* operands) {
+    const char op = *symbol_name(b->ast->symbols, nd->value);
+    if (nd->count == 1) { /* unary */
+        IrRef x = operands[0];
+        if (is_dynamic(b, x))
+            return op == '-' ? emit(b, IR_Neg, IR_Dyn, x, IR_NONE) : x;
+        x = check_int_operand(b, ast_child_id(b->ast, nd, 0), x);
+        if (type_of(b->ir, x) == IR_Bool)
+            x = convert(b, nd, x, IR_I64);
+        if (op != '-')
+            return x;
+        if (is_const(b, x)) {
+            check_constant(b, nd, type_of(b->ir, x), fold_overflows(IR_Sub, type_of(b->ir, x), 0, const_value(b, x), 0 - const_value(b, x)));
+            return emit_const(b, type_of(b->ir, x), 0 - const_value(b, x));
+        }
+        return emit(b, IR_Neg, type_of(b->ir, x), x, IR_NONE);
+    }
+
+    const NodeId left = ast_child_id(b->ast, nd, 0), right = ast_child_id(b->ast, nd, 1);
+    IrRef x = operands[0], y = operands[1];
+    if (op == '+' && is_string(b, x) && is_string(b, y)) { /* joined here, there are no strings built at run time */
+        if (!is_string_const(b, x) || !is_string_const(b, y))
+            lower_error(b, nd, "Only constant strings can be joined.");
+        const Symbol sx = b->ir->insts.v[x].a, sy = b->ir->insts.v[y].a;
+        const uint32_t lx = symbol_len(b->ir->symbols, sx), ly = symbol_len(b->ir->symbols, sy);
+        char* txt = arena_alloc(b->arena, lx+ly+1);
+        memcpy(txt, symbol_name(b->ir->symbols, sx), lx);
+        memcpy(txt+lx, symbol_name(b->ir->symbols, sy), ly);
+        return emit_string(b, txt, lx+ly);
+    }
+    if (is_dynamic(b, x) || is_dynamic(b, y)) /* kinds are checked at run time */
+        return emit(b, arithmetic_op(b, nd, op), IR_Dyn, convert(b, nd, x, IR_Dyn), convert(b, nd, y, IR_Dyn));
+    x = check_int_operand(b, left, x);
+    y = check_int_operand(b, right, y);
+    IrType type = common_type(b, x, y);
+    x = convert(b, nd, x, type);
+    y = convert(b, nd, y, type);
+    return emit_binary(b, nd, arithmetic_op(b, nd, op), type, x, y);
+}
+
+static IrRef lower_comparison(IrBuilder* b, const Node* nd, const IrRef* operands) {
+    const char* op = symbol_name(b->ast->symbols, nd->value);
+    const uint32_t len = symbol_len(b->ast->symbols, nd->value);
+    const NodeId left = ast_child_id(b->ast, nd, 0), right = ast_child_id(b->ast, nd, 1);
+    IrRef x = operands[0], y = operands[1];
+    if ((op[0] == '=' || op[0] == '!') && is_string(b, x) && is_string(b, y) && is_string_const(b, x) && is_string_const(b, y)) {
+        const int equal = b->ir->insts.v[x].a == b->ir->insts.v[y].a; /* interned, equal text is the same symbol */
+        return emit_const(b, IR_Bool, op[0] == '=' ? equal : !equal);
+    }
+
+    IrOp cmp = IR_Eq;
+    switch (op[0]) {
+        case '=': cmp = IR_Eq; break;
+        case '!': cmp = IR_Ne; break;
+        case '<': cmp = len == 1 ? IR_Lt : IR_Le; break;
+        case '>': cmp = len == 1 ? IR_Gt : IR_Ge; break;
+        default: lower_error(b, nd, "Unknown operator.");
+    }
+    if (is_dynamic(b, x) || is_dynamic(b, y))
+        return emit(b, cmp, IR_Bool, convert(b, nd, x, IR_Dyn), convert(b, nd, y, IR_Dyn));
+    x = check_int_operand(b, left, x);
+    y = check_int_operand(b, right, y);
+    IrType type = type_of(b->ir, x) == IR_Bool && type_of(b->ir, y) == IR_Bool ? IR_Bool : common_type(b, x, y);
+    x = convert(b, nd, x, type);
+    y = convert(b, nd, y, type);
+    return emit_binary(b, nd, cmp, IR_Bool, x, y);
+}
+
+/* string(x) of a constant, written the way print would */
+static IrRef lower_string_cast(IrBuilder* b, const Node* nd, IrRef x) {
+    if (is_string(b, x))
+        return x;
+    check_int_operand(b, ast_child_id(b->ast, nd, 0), x);
+    if (!is_const(b, x))
+        lower_error(b, nd, "Only constants can be cast to string.");
+
+    char txt[24];
+    const uint64_t value = const_value(b, x);
+    int len;
+    if (ir_is_signed(type_of(b->ir, x)))
+        len = snprintf(txt, sizeof(txt), "%lld", (long long)(int64_t)value);
+    else
+        len = snprintf(txt, sizeof(txt), "%llu", (unsigned long long)value);
+    return emit_string(b, txt, (uint32_t)len);
+}
+
+/*
+** Instantiation cache.
+** A generic def is lowered once per distinct tuple of type arguments, as a function of its own with every
+** type parameter replaced, so its values stay unboxed. Open addressing like the variables of the parser.
+*/
+static uint32_t instance_hash(Symbol generic, const uint8_t* args, uint32_t n) {
+    uint32_t h = generic * 2654435761u; /* Fibonacci hashing, then FNV over the arguments */
+    for (uint32_t i = 0; i < n; i++)
+        h = (h ^ args[i]) * 16777619u;
+    return h;
+}
+
+/* slot of the instance, or the free slot where it would go */
+static IrInstance* find_instance(IrBuilder* b, Symbol generic, const uint8_t* args, uint32_t n) {
+    const size_t mask = b->instances.cap-1;
+    for (size_t i = instance_hash(generic, args, n) & mask;; i = (i+1) & mask) {
+        IrInstance* slot = &b->instances.slots[i];
+        if (slot->generic == SYM_Empty || (slot->generic == generic && memcmp(slot->type_args, args, n) == 0))
+            return slot;
+    }
+}
+
+static void place_instance(void* table, const void* slot) {
+    IrBuilder* b = table;
+    const IrInstance* s = slot;
+    if (s->generic != SYM_Empty)
+        *find_instance(b, s->generic, s->type_args, def_params(b, b->generics[s->generic])->count) = *s;
+}
+
+/*
+** Function of the generic def called by <nd> for the type arguments of the call.
+** A new one is named like gen.i32 and lowered after the functions before it, in the same pass.
+*/
+static uint32_t instantiate(IrBuilder* b, const Node* nd) {
+    const NodeId def = b->generics[nd->value];
+    const Node* types = ast_child(b->ast, nd, 1);
+    if (def == NODE_NONE)
+        lower_error(b, nd, b->funcs[nd->value] == IR_NONE ? "Unknown function." : "Not a generic function.");
+    const Node* params = ast_child(b->ast, node_of(b, def), 0);
+    if (types->count != params->count)
+        lower_error(b, nd, "Wrong number of type arguments.");
+
+    uint8_t* args = arena_alloc(b->arena, types->count);
+    uint32_t len = symbol_len(b->ir->symbols, nd->value);
+    for (uint32_t i = 0; i < types->count; i++) {
+        args[i] = (uint8_t)type_of_name(b, b->func, ast_child(b->ast, types, i));
+        len += 1 + (uint32_t)strlen(TYPE_NAMES[args[i]]);
+    }
+    IrInstance* slot = find_instance(b, nd->value, args, types->count);
+    if (slot->generic != SYM_Empty)
+        return slot->fn;
+
+    char* name = arena_alloc(b->arena, len+1);
+    uint32_t at = (uint32_t)sprintf(name, "%.*s", (int)symbol_len(b->ir->symbols, nd->value), symbol_name(b->ir->symbols, nd->value));
+    for (uint32_t i = 0; i < types->count; i++)
+        at += (uint32_t)sprintf(name+at, ".%s", TYPE_NAMES[args[i]]);
+
+    const uint32_t fn = (uint32_t)b->ir->funcs.siz;
+    ir_push(b->arena, b->defs, ((IrDef){.node = def, .type_args = args}));
+    const IrType ret = def_return(b, fn);
+    ir_push(b->arena, b->ir->funcs, ((IrFunc){
+        .name = intern(b->ir->symbols, name, len),
+        .ret = ret,
+        .params = def_params(b, def)->count,
+    }));
+    *slot = (IrInstance){.generic = nd->value, .type_args = args, .fn = fn};
+    if (++b->instances.siz*2 > b->instances.cap)
+        arena_grow_slots(b->arena, &b->instances.slots, &b->instances.cap, IR_GROWTH, sizeof(IrInstance), place_instance, b);
+    return fn;
+}
+
+/* function called by <nd>, IR_NONE for print, checked before its arguments are lowered */
+static uint32_t call_target(IrBuilder* b, const Node* nd) {
+    if (nd->value == b->print)
+        return IR_NONE;
+    const uint32_t fn = nd->count > 1 ? instantiate(b, nd) : b->funcs[nd->value];
+    if (fn == IR_NONE)
+        lower_error(b, nd, b->generics[nd->value] == NODE_NONE ? "Unknown function." : "Missing type arguments.");
+    if (ast_child(b->ast, nd, 0)->count != def_params(b, b->defs.v[fn].node)->count)
+        lower_error(b, nd, "Wrong number of arguments.");
+    return fn;
+}
+
+/* argument <i> of a call to <fn>, right after it is lowered */
+static IrRef call_argument(IrBuilder* b, const Node* nd, uint32_t fn, uint32_t i, IrRef value) {
+    const Node* arg = ast_child(b->ast, ast_child(b->ast, nd, 0), i);
+    if (fn == IR_NONE) {
+        if (value == IR_NONE)
+            lower_error(b, arg, "No value to print.");
+        return value;
+    }
+    const Node* param = ast_child(b->ast, def_params(b, b->defs.v[fn].node), i);
+    return convert(b, arg, value, type_of_name(b, fn, ast_child(b->ast, param, 0)));
+}
+
+static IrRef lower_call(IrBuilder* b, const Node* nd, uint32_t fn, const IrRef* values) {
+    const uint32_t count = ast_child(b->ast, nd, 0)->count;
+    if (fn == IR_NONE) {
+        uint32_t at = push_extra(b, count);
+        memcpy(&b->ir->extra.v[at], values, sizeof(uint32_t)*count);
+        return emit(b, IR_Print, IR_Void, at, count);
+    }
+
+    uint32_t at = push_extra(b, count+1);
+    b->ir->extra.v[at] = fn;
+    memcpy(&b->ir->extra.v[at+1], values, sizeof(uint32_t)*count);
+    IrRef call = emit(b, IR_Call, b->ir->funcs.v[fn].ret, at, count);
+    return b->ir->funcs.v[fn].ret == IR_Void ? IR_NONE : call;
+}
+
+/* value of a local, or a load of the global */
+static IrRef lower_name(IrBuilder* b, const Node* nd) {
+    if (b->vars[nd->value] != IR_NONE)
+        return b->vars[nd->value];
+    if (b->global_types[nd->value] == IR_Void)
+        lower_error(b, nd, "Unknown variable.");
+    return emit(b, IR_LoadGlobal, b->global_types[nd->value], nd->value, IR_NONE);
+}
+
+/* node whose children are the operands of <nd>, NULL for a leaf */
+static const Node* expr_operands(IrBuilder* b, const Node* nd) {
+    switch (nd->kind) {
+        case ND_ArithmeticExpression:
+        case ND_ConditionalExpression:
+        case ND_StringCastExpression: return nd;
+        case ND_CallExpressionStatement: return ast_child(b->ast, nd, 0);
+        default: return NULL;
+    }
+}
+
+/* <nd> once its operands are lowered, they are on top of the value stack */
+static IrRef finish_expr(IrBuilder* b, const Node* nd, uint32_t fn, const IrRef* operands) {
+    switch (nd->kind) {
+        case ND_NumberLiteral: { /* i64, unless only u64 holds it */
+            const uint64_t value = parse_number(b, nd);
+            return emit_const(b, value > INT64_MAX ? IR_U64 : IR_I64, value);
+        }
+        case ND_BooleanLiteral: return emit_const(b, IR_Bool, nd->value == SYM_True);
+        case ND_StringLiteral: return emit(b, IR_String, IR_Str, nd->value, IR_NONE);
+        case ND_IdentifierExpression: return lower_name(b, nd);
+        case ND_ArithmeticExpression: return lower_arithmetic(b, nd, operands);
+        case ND_ConditionalExpression: return lower_comparison(b, nd, operands);
+        case ND_StringCastExpression: return lower_string_cast(b, nd, operands[0]);
+        case ND_CallExpressionStatement: return lower_call(b, nd, fn, operands);
+
+        default: {
+            lower_error(b, nd, "Unsupported expression.");
+            return IR_NONE;
+        }
+    }
+}
+
+/*
+** IR_NONE for calls without a value.
+** Postorder with an explicit stack, the operands of the pending node on top are lowered one at a time
+** and their values wait on a second stack, so nesting depth never reaches the C stack.
+*/
+static IrRef lower_expr(IrBuilder* b, NodeId id) {
+    const size_t base = b->expr.pending.siz;
+    ir_push(b->arena, b->expr.pending, ((IrPending){.node = id, .next = 0, .fn = IR_NONE}));
+    while (b->expr.pending.siz > base) {
+        IrPending* p = &b->expr.pending.v[b->expr.pending.siz-1];
+        const Node* nd = node_of(b, p->node);
+        const Node* operands = expr_operands(b, nd);
+        const uint32_t count = operands == NULL ? 0 : operands->count;
+        if (p->next == 0) { /* first visit */
+            if (nd->kind == ND_StringCastExpression && nd->count != 1)
+                lower_error(b, nd, "Invalid expression.");
+            if (nd->kind == ND_CallExpressionStatement)
+                p->fn = call_target(b, nd);
+        } else if (nd->kind == ND_CallExpressionStatement) {
+            IrRef* value = &b->expr.values.v[b->expr.values.siz-1];
+            *value = call_argument(b, nd, p->fn, p->next-1, *value);
+        }
+        if (p->next < count) {
+            const NodeId operand = ast_child_id(b->ast, operands, p->next++);
+            ir_push(b->arena, b->expr.pending, ((IrPending){.node = operand, .next = 0, .fn = IR_NONE}));
+            continue;
+        }
+
+        const uint32_t fn = p->fn;
+        b->expr.pending.siz--;
+        b->expr.values.siz -= count;
+        const IrRef value = finish_expr(b, nd, fn, &b->expr.values.v[b->expr.values.siz]);
+        ir_push(b->arena, b->expr.values, value);
+    }
+    return b->expr.values.v[--b->expr.values.siz];
+}
+
+/*
+** Statements
+*/
+static void lower_statement(IrBuilder* b, NodeId id);
+
+/* new local of this function */
+static void declare_local(IrBuilder* b, Symbol name, IrRef value) {
+    ir_push(b->arena, b->locals, name);
+    b->vars[name] = value;
+}
+
+/*
+** <name> = <value>.
+** At the top level every name is a global, their type is the one all the values stored meet in.
+** Inside a def, a declaration is a local, a reassignment goes to the local or else the global of that name.
+** An unannotated local takes the value as it is, its type can change from one assignment to the next.
+*/
+static void assign(IrBuilder* b, const Node* nd, Symbol name, IrRef value) {
+    if (b->vars[name] != IR_NONE && b->declared[name] != IR_Void) {
+        b->vars[name] = convert(b, nd, value, (IrType)b->declared[name]);
+        return;
+    }
+    if (b->vars[name] != IR_NONE) {
+        b->vars[name] = value;
+        note_local(b, nd, name, value);
+        return;
+    }
+    if (b->func != 0 && (nd->kind == ND_VarDeclStatement || b->global_types[name] == IR_Void)) {
+        declare_local(b, name, value);
+        note_local(b, nd, name, value);
+        return;
+    }
+
+    const IrType have = (IrType)b->global_types[name], type = type_of(b->ir, value);
+    if (have == IR_Void) {
+        b->global_types[name] = (uint8_t)type;
+        b->global_notes[name] = make_note(b, nd, SYM_Empty, name, is_const(b, value) ? IR_NoteConstant : IR_NoteValue, type, IR_Void, IR_Void);
+        ir_push(b->arena, b->ir->globals, ((IrGlobal){name, type}));
+    } else {
+        const IrType joined = join_type(b, have, value);
+        if (joined != have) { /* what was lowered with the old type is redone */
+            b->global_types[name] = (uint8_t)joined;
+            b->global_notes[name] = make_note(b, nd, SYM_Empty, name, IR_NoteWidened, joined, have, type);
+            b->widened = 1;
+        }
+    }
+    emit(b, IR_StoreGlobal, IR_Void, name, convert(b, nd, value, b->global_types[name]));
+}
+
+/*
+** a = x, or a, b = x which stores x into both.
+** The names are a chain of VarDecl/VarReassign and VarSeperation nodes, the = hangs off the last one.
+*/
+static void lower_assignment(IrBuilder* b, const Node* nd) {
+    const Node* value = nd;
+    while (value->kind != ND_EqualsExpression) {
+        if (value->count == 0)
+            lower_error(b, value, "Missing value.");
+        value = ast_child(b->ast, value, 0);
+    }
+    if (value->count == 0)
+        lower_error(b, value, "Missing value.");
+    IrRef ref = lower_expr(b, ast_child_id(b->ast, value, 0));
+    if (ref == IR_NONE)
+        lower_error(b, value, "No value to assign.");
+
+    for (const Node* names = nd; names != value; names = ast_child(b->ast, names, 0))
+        if (names->kind != ND_VarSeperationExpression)
+            assign(b, names, names->value, ref);
+}
+
+static void lower_return(IrBuilder* b, const Node* nd) {
+    const IrType want = b->ir->funcs.v[b->func].ret;
+    IrRef value = IR_NONE;
+    if (nd->count > 0)
+        value = convert(b, nd, lower_expr(b, ast_child_id(b->ast, nd, 0)), want);
+    else if (want != IR_Void)
+        lower_error(b, nd, "Missing return value.");
+    emit(b, IR_Ret, IR_Void, value, IR_NONE);
+}
+
+/*
+** if on a constant, a body that is taken goes in line and needs no phis.
+** One that isn't is still lowered for its errors, then everything it emitted is dropped.
+*/
+static void lower_constant_if(IrBuilder* b, const Node* nd, int taken) {
+    const size_t known = b->locals.siz;
+    const size_t insts = b->ir->insts.siz, blocks = b->ir->blocks.siz, extra = b->ir->extra.siz, notes = b->ir->notes.siz;
+    const uint32_t block = b->block;
+    const uint32_t count = block != IR_NONE ? b->ir->blocks.v[block].count : 0;
+    IrRef* before = arena_alloc(b->arena, sizeof(IrRef)*(known+1));
+    for (size_t i = 0; i < known; i++)
+        before[i] = b->vars[b->locals.v[i]];
+
+    for (uint32_t i = 1; i < nd->count; i++)
+        lower_statement(b, ast_child_id(b->ast, nd, i));
+    for (size_t i = known; i < b->locals.siz; i++)
+        b->vars[b->locals.v[i]] = IR_NONE;
+    b->locals.siz = known;
+    if (taken)
+        return;
+
+    b->ir->insts.siz = insts;
+    b->ir->blocks.siz = blocks;
+    b->ir->extra.siz = extra;
+    b->ir->notes.siz = notes;
+    b->block = block;
+    if (block != IR_NONE)
+        b->ir->blocks.v[block].count = count;
+    for (size_t i = 0; i < known; i++)
+        b->vars[b->locals.v[i]] = before[i];
+}
+
+/*
+** The body is its own block, the join after it gets a phi for every local the body changed.
+** The two values of an unannotated local meet in one type, each is converted on its way to the join,
+** the one from before the body on an edge block of its own.
+*/
+static void lower_if(IrBuilder* b, const Node* nd) {
+    IrRef cond = lower_expr(b, ast_child_id(b->ast, nd, 0));
+    if (is_dynamic(b, cond))
+        cond = convert(b, nd, cond, IR_Bool);
+    cond = check_int_operand(b, ast_child_id(b->ast, nd, 0), cond);
+    if (type_of(b->ir, cond) != IR_Bool)
+        cond = emit_binary(b, nd, IR_Ne, IR_Bool, cond, emit_const(b, type_of(b->ir, cond), 0));
+    if (is_const(b, cond)) {
+        lower_constant_if(b, nd, const_value(b, cond) != 0);
+        return;
+    }
+
+    if (b->block == IR_NONE) /* dead code, nothing emitted for the condition */
+        start_block(b);
+    const uint32_t from = b->block;
+    const uint32_t targets = push_extra(b, 2);
+    emit(b, IR_Br, IR_Void, cond, targets);
+
+    /* locals as they are before the body */
+    const size_t known = b->locals.siz;
+    IrRef* before = arena_alloc(b->arena, sizeof(IrRef)*(known+1));
+    for (size_t i = 0; i < known; i++)
+        before[i] = b->vars[b->locals.v[i]];
+
+    b->ir->extra.v[targets] = start_block(b);
+    for (uint32_t i = 1; i < nd->count; i++)
+        lower_statement(b, ast_child_id(b->ast, nd, i));
+    const uint32_t body_end = b->block;
+
+    /* locals declared in the body end with it */
+    for (size_t i = known; i < b->locals.siz; i++)
+        b->vars[b->locals.v[i]] = IR_NONE;
+    b->locals.siz = known;
+
+    /* type of every local that gets a phi, IR_Void for the rest */
+    uint8_t* types = arena_alloc(b->arena, known+1);
+    int retyped = 0;
+    for (size_t i = 0; i < known; i++) {
+        const Symbol name = b->locals.v[i];
+        types[i] = IR_Void;
+        if (b->vars[name] == before[i])
+            continue;
+        if (body_end == IR_NONE) { /* the body returned, only the old value gets here */
+            b->vars[name] = before[i];
+            continue;
+        }
+        const IrType x = type_of(b->ir, before[i]), y = type_of(b->ir, b->vars[name]);
+        const IrType type = join_values(b, before[i], b->vars[name]);
+        if (x != y)
+            ir_push(b->arena, b->ir->notes, make_note(b, nd, b->ir->funcs.v[b->func].name, name, IR_NoteJoin, type, x, y));
+        b->vars[name] = convert(b, nd, b->vars[name], type);
+        types[i] = (uint8_t)type;
+        retyped |= type != x;
+    }
+    const IrRef jump = body_end != IR_NONE ? emit(b, IR_Jmp, IR_Void, IR_NONE, IR_NONE) : IR_NONE;
+
+    uint32_t skip = from, skip_jump = IR_NONE;
+    if (retyped) {
+        skip = start_block(b);
+        b->ir->extra.v[targets+1] = skip;
+        for (size_t i = 0; i < known; i++)
+            if (types[i] != IR_Void)
+                before[i] = convert(b, nd, before[i], (IrType)types[i]);
+        skip_jump = emit(b, IR_Jmp, IR_Void, IR_NONE, IR_NONE);
+    }
+
+    const uint32_t join = start_block(b);
+    if (skip_jump != IR_NONE)
+        b->ir->insts.v[skip_jump].a = join;
+    else
+        b->ir->extra.v[targets+1] = join;
+    if (jump != IR_NONE)
+        b->ir->insts.v[jump].a = join;
+    for (size_t i = 0; i < known; i++) {
+        if (types[i] == IR_Void)
+            continue;
+        const Symbol name = b->locals.v[i];
+        uint32_t at = push_extra(b, 4);
+        b->ir->extra.v[at] = skip;
+        b->ir->extra.v[at+1] = before[i];
+        b->ir->extra.v[at+2] = body_end;
+        b->ir->extra.v[at+3] = b->vars[name];
+        b->vars[name] = emit(b, IR_Phi, (IrType)types[i], at, 2);
+    }
+}
+
+static void lower_statement(IrBuilder* b, NodeId id) {
+    const Node* nd = node_of(b, id);
+    switch (nd->kind) {
+        case ND_VarDeclStatement: case ND_VarReassignStatement: lower_assignment(b, nd); break;
+        case ND_ReturnStatement: lower_return(b, nd); break;
+        case ND_IfStatement: lower_if(b, nd); break;
+        case ND_PassStatement: break;
+        case ND_FunctionDefStatement: break; /* every def is lowered on its own */
+
+        /* expression statement, the value is dropped */
+        case ND_CallExpressionStatement: case ND_ArithmeticExpression: case ND_ConditionalExpression: case ND_StringCastExpression:
+        case ND_IdentifierExpression: case ND_NumberLiteral: case ND_StringLiteral: case ND_BooleanLiteral: {
+            lower_expr(b, id);
+            break;
+        }
+
+        default: lower_error(b, nd, "Unsupported statement.");
+    }
+}
+
+/*
+** Lowers <count> statements from child <first> of <nd> into function <fn>.
+** Arguments come first in the entry block, falling off the end returns 0 (or "" and nothing).
+*/
+static void forget_locals(IrBuilder* b) {
+    for (size_t i = 0; i < b->locals.siz; i++) {
+        b->vars[b->locals.v[i]] = IR_NONE;
+        b->declared[b->locals.v[i]] = IR_Void;
+    }
+    b->locals.siz = 0;
+}
+
+static void lower_function(IrBuilder* b, uint32_t fn, const Node* nd, uint32_t first) {
+    IrFunc* f = &b->ir->funcs.v[fn];
+    b->func = fn;
+    f->first_block = (uint32_t)b->ir->blocks.siz;
+    f->first_inst = (uint32_t)b->ir->insts.siz;
+    start_block(b);
+
+    if (fn != 0) {
+        const Node* params = def_params(b, b->defs.v[fn].node);
+        if (params->count > IR_MAX_PARAMS)
+            lower_error(b, nd, "Too many arguments (6 at most).");
+        for (uint32_t i = 0; i < params->count; i++) {
+            const Node* param = ast_child(b->ast, params, i);
+            if (b->vars[param->value] != IR_NONE)
+                lower_error(b, param, "Argument defined twice.");
+            IrType type = type_of_name(b, fn, ast_child(b->ast, param, 0));
+            if (type == IR_Void)
+                lower_error(b, param, "Arguments can't be None.");
+            declare_local(b, param->value, emit(b, IR_Param, type, i, IR_NONE));
+            b->declared[param->value] = (uint8_t)type;
+        }
+    }
+
+    for (uint32_t i = first; i < nd->count; i++)
+        lower_statement(b, ast_child_id(b->ast, nd, i));
+    if (b->block != IR_NONE) {
+        IrRef value = IR_NONE;
+        if (f->ret == IR_Str)
+            value = emit(b, IR_String, IR_Str, SYM_Empty, IR_NONE);
+        else if (f->ret != IR_Void)
+            value = emit_const(b, f->ret, 0);
+        emit(b, IR_Ret, IR_Void, value, IR_NONE);
+    }
+
+    f = &b->ir->funcs.v[fn];
+    f->blocks = (uint32_t)b->ir->blocks.siz - f->first_block;
+    f->insts = (uint32_t)b->ir->insts.siz - f->first_inst;
+    forget_locals(b);
+}
+
+/* lower_function, after an error the function is left half done and the pass goes on with the next */
+static void lower_guarded(IrBuilder* b, uint32_t fn, const Node* nd, uint32_t first) {
+    jmp_buf on_error;
+    b->on_error = &on_error;
+    if (setjmp(on_error) != 0) {
+        forget_locals(b);
+        b->expr.pending.siz = 0; /* what the expression left there */
+        b->expr.values.siz = 0;
+        b->block = IR_NONE;
+    } else {
+        lower_function(b, fn, nd, first);
+    }
+    b->on_error = NULL;
+}
+
+/*
+** Verifier
+*/
+
+/* targets of the terminator of <block>, returns how many */
+static uint32_t successors(const IrModule* ir, uint32_t block, uint32_t out[2]) {
+    const IrBlock* bl = &ir->blocks.v[block];
+    if (bl->count == 0)
+        return 0;
+    const IrInst* last = &ir->insts.v[bl->first + bl->count-1];
+    switch (last->op) {
+        case IR_Jmp: out[0] = last->a; return 1;
+        case IR_Br: out[0] = ir->extra.v[last->b]; out[1] = ir->extra.v[last->b+1]; return 2;
+        default: return 0;
+    }
+}
+
+/*
+** Dominator tree of one function (Cooper, Harvey and Kennedy), numbered so that
+** <a> dominates <b> exactly when pre[a] <= pre[b] && post[b] <= post[a]. Unreachable blocks get no number.
+*/
+typedef struct Dominance {
+    uint32_t* pre;
+    uint32_t* post;
+} Dominance;
+#define dom_reachable(_d, _bl) ((_d)->pre[_bl] != IR_NONE)
+#define dominates(_d, _x, _y) ((_d)->pre[_x] <= (_d)->pre[_y] && (_d)->post[_y] <= (_d)->post[_x])
+
+static Dominance dominance(const IrModule* ir, const IrFunc* f, Arena* arena) {
+    const uint32_t n = f->blocks, base = f->first_block;
+    uint32_t* order = arena_alloc(arena, sizeof(uint32_t)*n); /* reverse postorder */
+    uint32_t* rpo = arena_alloc(arena, sizeof(uint32_t)*n); /* position in order */
+    uint32_t* idom = arena_alloc(arena, sizeof(uint32_t)*n);
+    uint32_t* stack = arena_alloc(arena, sizeof(uint32_t)*n*2);
+    uint32_t* pred_first = arena_alloc(arena, sizeof(uint32_t)*(n+1));
+    for (uint32_t i = 0; i < n; i++) {
+        rpo[i] = IR_NONE;
+        idom[i] = IR_NONE;
+    }
+
+    /* postorder without recursion, stack holds block and next successor */
+    uint32_t count = 0, top = 0;
+    rpo[0] = 0;
+    stack[top++] = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t succ[2];
+        uint32_t bl = stack[top-2], k = stack[top-1];
+        uint32_t ns = successors(ir, base+bl, succ);
+        if (k < ns) {
+            stack[top-1]++;
+            uint32_t s = succ[k] - base;
+            if (rpo[s] == IR_NONE) {
+                rpo[s] = 0;
+                stack[top++] = s;
+                stack[top++] = 0;
+            }
+            continue;
+        }
+        order[count++] = bl;
+        top -= 2;
+    }
+    for (uint32_t i = 0; i < count/2; i++) {
+        uint32_t t = order[i];
+        order[i] = order[count-1-i];
+        order[count-1-i] = t;
+    }
+    for (uint32_t i = 0; i < count; i++)
+        rpo[order[i]] = i;
+
+    /* predecessors of the reachable blocks, grouped by block */
+    memset(pred_first, 0, sizeof(uint32_t)*(n+1));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t succ[2];
+        uint32_t ns = successors(ir, base+order[i], succ);
+        for (uint32_t k = 0; k < ns; k++)
+            pred_first[succ[k]-base+1]++;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        pred_first[i+1] += pred_first[i];
+    uint32_t* preds = arena_alloc(arena, sizeof(uint32_t)*(pred_first[n]+1));
+    uint32_t* fill = stack; /* no longer needed */
+    memcpy(fill, pred_first, sizeof(uint32_t)*n);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t succ[2];
+        uint32_t ns = successors(ir, base+order[i], succ);
+        for (uint32_t k = 0; k < ns; k++)
+            preds[fill[succ[k]-base]++] = order[i];
+    }
+
+    idom[0] = 0;
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (uint32_t i = 1; i < count; i++) {
+            uint32_t bl = order[i], new_idom = IR_NONE;
+            for (uint32_t p = pred_first[bl]; p < pred_first[bl+1]; p++) {
+                uint32_t x = preds[p];
+                if (idom[x] == IR_NONE)
+                    continue;
+                if (new_idom == IR_NONE) {
+                    new_idom = x;
+                    continue;
+                }
+                uint32_t y = new_idom;
+                while (x != y) {
+                    while (rpo[x] > rpo[y])
+                        x = idom[x];
+                    while (rpo[y] > rpo[x])
+                        y = idom[y];
+                }
+                new_idom = x;
+            }
+            if (idom[bl] != new_idom) {
+                idom[bl] = new_idom;
+                changed = 1;
+            }
+        }
+    }
+
+    /* number the tree, children are found by scanning the order, which is fine for a check */
+    Dominance d = {
+        .pre = arena_alloc(arena, sizeof(uint32_t)*n),
+        .post = arena_alloc(arena, sizeof(uint32_t)*n),
+    };
+    uint32_t* child_first = pred_first; /* reused, children grouped by parent */
+    uint32_t* children = preds;
+    memset(child_first, 0, sizeof(uint32_t)*(n+1));
+    for (uint32_t i = 1; i < count; i++)
+        child_first[idom[order[i]]+1]++;
+    for (uint32_t i = 0; i < n; i++)
+        child_first[i+1] += child_first[i];
+    memcpy(fill, child_first, sizeof(uint32_t)*n);
+    for (uint32_t i = 1; i < count; i++)
+        children[fill[idom[order[i]]]++] = order[i];
+
+    for (uint32_t i = 0; i < n; i++) {
+        d.pre[i] = IR_NONE;
+        d.post[i] = IR_NONE;
+    }
+    uint32_t clock = 0;
+    top = 0;
+    stack[top++] = 0;
+    stack[top++] = child_first[0];
+    d.pre[0] = clock++;
+    while (top > 0) {
+        uint32_t bl = stack[top-2], k = stack[top-1];
+        if (k < child_first[bl+1]) {
+            stack[top-1]++;
+            uint32_t c = children[k];
+            d.pre[c] = clock++;
+            stack[top++] = c;
+            stack[top++] = child_first[c];
+            continue;
+        }
+        d.post[bl] = clock++;
+        top -= 2;
+    }
+    return d;
+}
+
+typedef struct Verifier {
+    const IrModule* ir;
+    const IrFunc* f;
+    uint32_t block; /* function relative */
+    int problems;
+} Verifier;
+
+static void verify_fail(Verifier* v, IrRef at, const char* what) {
+    fprintf(stderr, "PyToASM: IR of ");
+    if (v->f->name == SYM_Empty)
+        fprintf(stderr, "<top>");
+    else
+        fprintf(stderr, "%.*s", (int)symbol_len(v->ir->symbols, v->f->name), symbol_name(v->ir->symbols, v->f->name));
+    fprintf(stderr, ", b%u", v->block);
+    if (at != IR_NONE)
+        fprintf(stderr, ", %%%u", at - v->f->first_inst);
+    fprintf(stderr, ": %s\n", what);
+    v->problems++;
+}
+
+/* <ref> is a value of this function */
+static int check_value(Verifier* v, IrRef at, IrRef ref) {
+    if (ref < v->f->first_inst || ref >= v->f->first_inst + v->f->insts || v->ir->insts.v[ref].type == IR_Void) {
+        verify_fail(v, at, "operand is not a value of the function");
+        return 0;
+    }
+    return 1;
+}
+
+static int check_block(Verifier* v, IrRef at, uint32_t block) {
+    if (block < v->f->first_block || block >= v->f->first_block + v->f->blocks) {
+        verify_fail(v, at, "target is not a block of the function");
+        return 0;
+    }
+    return 1;
+}
+
+#define check(_v, _at, _cond, _what) do { if (!(_cond)) verify_fail(_v, _at, _what); } while (0)
+
+/* types and shape of one instruction, operands known to be values */
+static void verify_inst(Verifier* v, IrRef at) {
+    const IrModule* ir = v->ir;
+    const IrInst* in = &ir->insts.v[at];
+    const IrType type = (IrType)in->type;
+    switch ((IrOp)in->op) {
+        case IR_Const: check(v, at, (ir_is_int(type) || type == IR_Dyn) && ir_wrap(type, (uint64_t)in->a | (uint64_t)in->b << 32) == ((uint64_t)in->a | (uint64_t)in->b << 32), "constant out of its type"); break;
+        case IR_String: check(v, at, type == IR_Str && in->a < ir->symbols->siz, "bad string"); break;
+        case IR_Param: check(v, at, ir_is_int(type) || type == IR_Str, "bad parameter type"); break;
+        case IR_Add: case IR_Sub: case IR_Mul: case IR_Div: case IR_Mod: {
+            if (check_value(v, at, in->a) && check_value(v, at, in->b))
+                check(v, at, (ir_is_int(type) || type == IR_Dyn) && type != IR_Bool && type_of(ir, in->a) == type && type_of(ir, in->b) == type, "operand types differ from the result");
+            break;
+        }
+        case IR_Neg: {
+            if (check_value(v, at, in->a))
+                check(v, at, (ir_is_int(type) || type == IR_Dyn) && type != IR_Bool && type_of(ir, in->a) == type, "operand type differs from the result");
+            break;
+        }
+        case IR_Eq: case IR_Ne: case IR_Lt: case IR_Le: case IR_Gt: case IR_Ge: {
+            if (check_value(v, at, in->a) && check_value(v, at, in->b))
+                check(v, at, type == IR_Bool && (ir_is_int(type_of(ir, in->a)) || type_of(ir, in->a) == IR_Dyn) && type_of(ir, in->a) == type_of(ir, in->b), "bad comparison types");
+            break;
+        }
+        case IR_Conv: {
+            if (check_value(v, at, in->a))
+                check(v, at, ir_is_int(type) && ir_is_int(type_of(ir, in->a)), "conversion of a non integer");
+            break;
+        }
+        case IR_Tag: {
+            if (check_value(v, at, in->a))
+                check(v, at, type == IR_Dyn && (ir_is_int(type_of(ir, in->a)) || type_of(ir, in->a) == IR_Str), "tag of a dynamic value");
+            break;
+        }
+        case IR_Untag: {
+            if (check_value(v, at, in->a))
+                check(v, at, (ir_is_int(type) || type == IR_Str) && type_of(ir, in->a) == IR_Dyn, "untag of a static value");
+            break;
+        }
+        case IR_Phi: {
+            for (uint32_t i = 0; i < in->b; i++)
+                if (check_value(v, at, ir->extra.v[in->a + i*2+1]))
+                    check(v, at, type_of(ir, ir->extra.v[in->a + i*2+1]) == type, "phi operand of another type");
+            break;
+        }
+        case IR_LoadGlobal: check(v, at, in->a < ir->symbols->siz && type != IR_Void, "bad load"); break;
+        case IR_StoreGlobal: {
+            if (check_value(v, at, in->b))
+                check(v, at, in->a < ir->symbols->siz && type == IR_Void, "bad store");
+            break;
+        }
+        case IR_Call: {
+            const uint32_t fn = ir->extra.v[in->a];
+            if (fn == 0 || fn >= ir->funcs.siz) {
+                verify_fail(v, at, "call of an unknown function");
+                break;
+            }
+            const IrFunc* callee = &ir->funcs.v[fn];
+            check(v, at, callee->params == in->b && callee->ret == type, "call does not match the function");
+            for (uint32_t i = 0; i < in->b && i < callee->params; i++) {
+                IrRef arg = ir->extra.v[in->a+1+i];
+                if (check_value(v, at, arg) && callee->insts > i)
+                    check(v, at, type_of(ir, arg) == ir->insts.v[callee->first_inst+i].type, "argument of another type");
+            }
+            break;
+        }
+        case IR_Print: {
+            for (uint32_t i = 0; i < in->b; i++)
+                check_value(v, at, ir->extra.v[in->a+i]);
+            break;
+        }
+        case IR_Jmp: check_block(v, at, in->a); break;
+        case IR_Br: {
+            if (check_value(v, at, in->a))
+                check(v, at, type_of(ir, in->a) == IR_Bool, "branch on a non boolean");
+            check_block(v, at, ir->extra.v[in->b]);
+            check_block(v, at, ir->extra.v[in->b+1]);
+            break;
+        }
+        case IR_Ret: {
+            if (in->a == IR_NONE)
+                check(v, at, v->f->ret == IR_Void, "missing return value");
+            else if (check_value(v, at, in->a))
+                check(v, at, type_of(ir, in->a) == v->f->ret, "return value of another type");
+            break;
+        }
+        default: verify_fail(v, at, "unknown instruction");
+    }
+}
+
+/* every operand is defined before it is used, on every path */
+static void verify_dominance(Verifier* v, const Dominance* d, const uint32_t* block_of, IrRef at) {
+    const IrModule* ir = v->ir;
+    const IrInst* in = &ir->insts.v[at];
+    const uint32_t base = v->f->first_inst;
+    IrRef ops[2] = {IR_NONE, IR_NONE};
+    const uint32_t* list = NULL;
+    uint32_t list_siz = 0;
+    switch ((IrOp)in->op) {
+        case IR_Add: case IR_Sub: case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_Eq: case IR_Ne: case IR_Lt: case IR_Le: case IR_Gt: case IR_Ge: ops[0] = in->a; ops[1] = in->b; break;
+        case IR_Neg: case IR_Conv: case IR_Tag: case IR_Untag: case IR_Br: case IR_Ret: ops[0] = in->a; break;
+        case IR_StoreGlobal: ops[0] = in->b; break;
+        case IR_Call: list = &ir->extra.v[in->a+1]; list_siz = in->b; break;
+        case IR_Print: list = &ir->extra.v[in->a]; list_siz = in->b; break;
+        case IR_Phi: {
+            for (uint32_t i = 0; i < in->b; i++) {
+                uint32_t pred = ir->extra.v[in->a + i*2] - v->f->first_block;
+                IrRef op = ir->extra.v[in->a + i*2+1];
+                if (!dom_reachable(d, pred))
+                    continue;
+                if (!dom_reachable(d, block_of[op-base]) || !dominates(d, block_of[op-base], pred))
+                    verify_fail(v, at, "phi operand does not reach its predecessor");
+            }
+            return;
+        }
+        default: return;
+    }
+
+    const uint32_t here = block_of[at-base];
+    for (uint32_t i = 0; i < 2 + list_siz; i++) {
+        IrRef op = i < 2 ? ops[i] : list[i-2];
+        if (op == IR_NONE)
+            continue;
+        const uint32_t def = block_of[op-base];
+        if (def == here ? op >= at : !dom_reachable(d, def) || !dominates(d, def, here))
+            verify_fail(v, at, "operand used before it is defined");
+    }
+}
+
+static void verify_function(Verifier* v, Arena* arena) {
+    const IrModule* ir = v->ir;
+    const IrFunc* f = v->f;
+    if (f->blocks == 0 || f->first_block + f->blocks > ir->blocks.siz || f->first_inst + f->insts > ir->insts.siz) {
+        v->block = 0;
+        verify_fail(v, IR_NONE, "function out of the module");
+        return;
+    }
+
+    /* shape, blocks in order and covering the instructions */
+    uint32_t* block_of = arena_alloc(arena, sizeof(uint32_t)*(f->insts+1));
+    uint32_t* pred_count = arena_alloc(arena, sizeof(uint32_t)*f->blocks);
+    memset(pred_count, 0, sizeof(uint32_t)*f->blocks);
+    uint32_t next = f->first_inst;
+    int broken = 0;
+    for (v->block = 0; v->block < f->blocks; v->block++) {
+        const IrBlock* bl = &ir->blocks.v[f->first_block + v->block];
+        if (bl->first != next || bl->count == 0 || bl->first + bl->count > f->first_inst + f->insts) {
+            verify_fail(v, IR_NONE, "block is empty or out of order");
+            broken = 1;
+            break;
+        }
+        for (IrRef at = bl->first; at < bl->first + bl->count; at++) {
+            const IrInst* in = &ir->insts.v[at];
+            block_of[at - f->first_inst] = v->block;
+            if (in->op >= IR_OpCount) {
+                verify_fail(v, at, "unknown instruction");
+                broken = 1;
+                continue;
+            }
+            if (ir_is_terminator(in->op) != (at == bl->first + bl->count-1)) {
+                verify_fail(v, at, "terminator not at the end of the block");
+                broken = 1;
+            }
+            if (in->op == IR_Phi && at > bl->first && ir->insts.v[at-1].op != IR_Phi)
+                verify_fail(v, at, "phi after other instructions");
+            if (in->op == IR_Param && (v->block != 0 || at - bl->first != in->a || in->a >= f->params))
+                verify_fail(v, at, "parameter out of place");
+            verify_inst(v, at);
+        }
+        next = bl->first + bl->count;
+    }
+    if (!broken && next != f->first_inst + f->insts) {
+        v->block = f->blocks-1;
+        verify_fail(v, IR_NONE, "instructions outside of the blocks");
+        broken = 1;
+    }
+    if (broken || v->problems > 0)
+        return;
+
+    /* phis name each predecessor once */
+    for (v->block = 0; v->block < f->blocks; v->block++) {
+        uint32_t succ[2];
+        uint32_t ns = successors(ir, f->first_block + v->block, succ);
+        for (uint32_t k = 0; k < ns; k++)
+            pred_count[succ[k] - f->first_block]++;
+    }
+    for (v->block = 0; v->block < f->blocks; v->block++) {
+        const IrBlock* bl = &ir->blocks.v[f->first_block + v->block];
+        for (IrRef at = bl->first; ir->insts.v[at].op == IR_Phi; at++) {
+            const IrInst* in = &ir->insts.v[at];
+            if (in->b != pred_count[v->block]) {
+                verify_fail(v, at, "phi does not cover every predecessor");
+                continue;
+            }
+            for (uint32_t i = 0; i < in->b; i++) {
+                uint32_t pred = ir->extra.v[in->a + i*2], succ[2];
+                uint32_t ns = pred >= f->first_block && pred < f->first_block + f->blocks ? successors(ir, pred, succ) : 0;
+                int found = 0;
+                for (uint32_t k = 0; k < ns; k++)
+                    found |= succ[k] == f->first_block + v->block;
+                if (!found)
+                    verify_fail(v, at, "phi names a block that is not a predecessor");
+            }
+        }
+    }
+    if (v->problems > 0)
+        return;
+
+    Dominance d = dominance(ir, f, arena);
+    for (v->block = 0; v->block < f->blocks; v->block++) {
+        const IrBlock* bl = &ir->blocks.v[f->first_block + v->block];
+        if (!dom_reachable(&d, v->block))
+            continue;
+        for (IrRef at = bl->first; at < bl->first + bl->count; at++)
+            verify_dominance(v, &d, block_of, at);
+    }
+}
+
+/*
+** Printer
+*/
+#define print_name(_out, _ir, _sym) fprintf(_out, "%.*s", (int)symbol_len((_ir)->symbols, _sym), symbol_name((_ir)->symbols, _sym))
+
+static void print_string(FILE* out, const IrModule* ir, Symbol str) {
+    const char* txt = symbol_name(ir->symbols, str);
+    const uint32_t len = symbol_len(ir->symbols, str);
+    fputc('"', out);
+    for (uint32_t i = 0; i < len; i++) {
+        const unsigned char c = (unsigned char)txt[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 32 || c > 126)
+            fprintf(out, "\\x%02x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void print_inst(FILE* out, const IrModule* ir, const IrFunc* f, IrRef at) {
+    const IrInst* in = &ir->insts.v[at];
+    const uint32_t vb = f->first_inst, bb = f->first_block;
+    fprintf(out, "    ");
+    if (in->op == IR_String)
+        fprintf(out, "%%%u = %s", at - vb, OP_NAMES[in->op]);
+    else if (in->type != IR_Void)
+        fprintf(out, "%%%u = %s %s", at - vb, OP_NAMES[in->op], TYPE_NAMES[in->type]);
+    else
+        fprintf(out, "%s", OP_NAMES[in->op]);
+
+    switch ((IrOp)in->op) {
+        case IR_Const: {
+            uint64_t value = (uint64_t)in->a | (uint64_t)in->b << 32;
+            if (ir_is_signed(in->type))
+                fprintf(out, " %lld", (long long)value);
+            else
+                fprintf(out, " %llu", (unsigned long long)value);
+            break;
+        }
+        case IR_String: fputc(' ', out); print_string(out, ir, in->a); break;
+        case IR_Param: fprintf(out, " %u", in->a); break;
+        case IR_Add: case IR_Sub: case IR_Mul: case IR_Div: case IR_Mod:
+        case IR_Eq: case IR_Ne: case IR_Lt: case IR_Le: case IR_Gt: case IR_Ge: fprintf(out, " %%%u, %%%u", in->a - vb, in->b - vb); break;
+        case IR_Neg: case IR_Conv: case IR_Tag: case IR_Untag: fprintf(out, " %%%u", in->a - vb); break;
+        case IR_Phi: {
+            for (uint32_t i = 0; i < in->b; i++)
+                fprintf(out, "%s[b%u: %%%u]", i ? ", " : " ", ir->extra.v[in->a + i*2] - bb, ir->extra.v[in->a + i*2+1] - vb);
+            break;
+        }
+        case IR_LoadGlobal: fputc(' ', out); print_name(out, ir, in->a); break;
+        case IR_StoreGlobal: fputc(' ', out); print_name(out, ir, in->a); fprintf(out, ", %%%u", in->b - vb); break;
+        case IR_Call: {
+            fputc(' ', out);
+            print_name(out, ir, ir->funcs.v[ir->extra.v[in->a]].name);
+            fputc('(', out);
+            for (uint32_t i = 0; i < in->b; i++)
+                fprintf(out, "%s%%%u", i ? ", " : "", ir->extra.v[in->a+1+i] - vb);
+            fputc(')', out);
+            break;
+        }
+        case IR_Print: {
+            for (uint32_t i = 0; i < in->b; i++)
+                fprintf(out, "%s%%%u", i ? ", " : " ", ir->extra.v[in->a+i] - vb);
+            break;
+        }
+        case IR_Jmp: fprintf(out, " b%u", in->a - bb); break;
+        case IR_Br: fprintf(out, " %%%u, b%u, b%u", in->a - vb, ir->extra.v[in->b] - bb, ir->extra.v[in->b+1] - bb); break;
+        case IR_Ret: if (in->a != IR_NONE) fprintf(out, " %%%u", in->a - vb); break;
+        default: break;
+    }
+    fputc('\n', out);
+}
+
+/*{==================================*/
+/*
+** API
+*/
+uint64_t ir_wrap(IrType type, uint64_t value) {
+    switch (type) {
+        case IR_Bool: return value & 1;
+        case IR_I8: return (uint64_t)(int64_t)(int8_t)value;
+        case IR_I16: return (uint64_t)(int64_t)(int16_t)value;
+        case IR_I32: return (uint64_t)(int64_t)(int32_t)value;
+        case IR_U8: return (uint8_t)value;
+        case IR_U16: return (uint16_t)value;
+        case IR_U32: return (uint32_t)value;
+        default: return value;
+    }
+}
+
+IrModule* ir_lower(AbstractSyntaxTree* ast, int trap, Arena* arena) {
+    IrModule* ir = arena_alloc(arena, sizeof(IrModule));
+    ir->symbols = ast->symbols;
+    ir->arena = arena;
+    ir->trap = trap;
+    ir_init(arena, ir->insts);
+    ir_init(arena, ir->blocks);
+    ir_init(arena, ir->extra);
+    ir_init(arena, ir->funcs);
+    ir_init(arena, ir->globals);
+    ir_init(arena, ir->notes);
+
+    IrBuilder b = {
+        .ast = ast,
+        .ir = ir,
+        .arena = arena,
+        .print = intern(ast->symbols, "print", 5),
+        .func = 0,
+        .block = IR_NONE,
+    };
+    ir_init(arena, b.locals);
+    ir_init(arena, b.expr.pending);
+    ir_init(arena, b.expr.values);
+
+    /* tables by name, after "print" is interned so they cover it */
+    const size_t names = ast->symbols->siz;
+    b.funcs = arena_alloc(arena, sizeof(uint32_t)*names);
+    b.generics = arena_alloc(arena, sizeof(NodeId)*names);
+    b.vars = arena_alloc(arena, sizeof(IrRef)*names);
+    b.global_types = arena_alloc(arena, names);
+    b.global_notes = arena_alloc(arena, sizeof(IrNote)*names);
+    b.declared = arena_alloc(arena, names);
+    memset(b.funcs, 0xFF, sizeof(uint32_t)*names); /* IR_NONE */
+    memset(b.generics, 0xFF, sizeof(NodeId)*names); /* NODE_NONE */
+    memset(b.vars, 0xFF, sizeof(IrRef)*names);
+    memset(b.global_types, IR_Void, names);
+    memset(b.declared, IR_Void, names);
+
+    /* signatures first, defs can be called before they show up */
+    /* generic ones only get functions when they are instantiated */
+    ir_push(arena, ir->funcs, ((IrFunc){.name = SYM_Empty, .ret = IR_Void}));
+    ir_init(arena, b.defs);
+    ir_push(arena, b.defs, ((IrDef){.node = 0, .type_args = NULL}));
+    b.instances.cap = IR_INSTANCES_INIT_CAPACITY;
+    b.instances.slots = arena_alloc(arena, sizeof(IrInstance)*b.instances.cap);
+    memset(b.instances.slots, 0, sizeof(IrInstance)*b.instances.cap);
+    for (size_t i = 0; i < ast->siz; i++) {
+        const Symbol name = ast->nodes[i].value;
+        if (ast->nodes[i].kind != ND_FunctionDefStatement)
+            continue;
+        if (name == b.print || b.funcs[name] != IR_NONE || b.generics[name] != NODE_NONE)
+            lower_error(&b, &ast->nodes[i], "Function defined twice.");
+        if (def_generic(&b, (NodeId)i)) {
+            b.generics[name] = (NodeId)i;
+            continue;
+        }
+        b.funcs[name] = (uint32_t)ir->funcs.siz;
+        ir_push(arena, b.defs, ((IrDef){.node = (NodeId)i, .type_args = NULL}));
+        ir_push(arena, ir->funcs, ((IrFunc){
+            .name = name,
+            .ret = def_return(&b, b.funcs[name]),
+            .params = def_params(&b, (NodeId)i)->count,
+        }));
+    }
+
+    /* the top level goes first, it decides the globals the defs see */
+    do {
+        b.widened = 0;
+        b.error[0] = '\0';
+        b.block = IR_NONE;
+        ir->insts.siz = ir->blocks.siz = ir->extra.siz = ir->notes.siz = 0;
+        lower_guarded(&b, 0, &ast->nodes[0], 0);
+        for (uint32_t fn = 1; fn < ir->funcs.siz; fn++) /* instances made on the way are lowered too */
+            lower_guarded(&b, fn, node_of(&b, b.defs.v[fn].node), def_body(&b, b.defs.v[fn].node)); /* after the arguments and the return type */
+    } while (b.widened);
+    if (b.error[0] != '\0')
+        logger_compile_error((int)b.error_line, (int)b.error_column, b.error);
+    for (size_t i = 0; i < ir->globals.siz; i++) {
+        ir->globals.v[i].type = (IrType)b.global_types[ir->globals.v[i].name];
+        ir_push(arena, ir->notes, b.global_notes[ir->globals.v[i].name]);
+    }
+    return ir;
+}
+
+int ir_verify(const IrModule* ir) {
+    Verifier v = {.ir = ir, .problems = 0};
+    for (size_t i = 0; i < ir->funcs.siz; i++) {
+        v.f = &ir->funcs.v[i];
+        verify_function(&v, ir->arena);
+    }
+    return v.problems;
+}
+
+void ir_explain_types(const IrModule* ir, FILE* out) {
+    Symbol func = SYM_Empty;
+    for (size_t i = 0; i < ir->notes.siz; i++) {
+        const IrNote* n = &ir->notes.v[i];
+        if (i == 0 || n->func != func) {
+            if (n->func == SYM_Empty) {
+                fprintf(out, "globals\n");
+            } else {
+                fprintf(out, "def ");
+                print_name(out, ir, n->func);
+                fputc('\n', out);
+            }
+            func = n->func;
+        }
+        fprintf(out, "    %u:%u ", n->line, n->column);
+        print_name(out, ir, n->name);
+        fprintf(out, ": %s", TYPE_NAMES[n->type]);
+        switch ((IrNoteKind)n->kind) {
+            case IR_NoteValue: break;
+            case IR_NoteConstant: fprintf(out, ", constant"); break;
+            case IR_NoteJoin: fprintf(out, ", %s before the if and %s after it", TYPE_NAMES[n->from[0]], TYPE_NAMES[n->from[1]]); break;
+            case IR_NoteWidened: fprintf(out, ", stored %s and %s", TYPE_NAMES[n->from[0]], TYPE_NAMES[n->from[1]]); break;
+        }
+        fputc('\n', out);
+    }
+}
+
+void ir_print(const IrModule* ir, FILE* out) {
+    for (size_t i = 0; i < ir->globals.siz; i++) {
+        fprintf(out, "global ");
+        print_name(out, ir, ir->globals.v[i].name);
+        fprintf(out, " %s\n", TYPE_NAMES[ir->globals.v[i].type]);
+    }
+    for (size_t i = 0; i < ir->funcs.siz; i++) {
+        const IrFunc* f = &ir->funcs.v[i];
+        fprintf(out, "\nfn ");
+        if (i == 0)
+            fprintf(out, "<top>");
+        else
+            print_name(out, ir, f->name);
+        fputc('(', out);
+        for (uint32_t p = 0; p < f->params; p++)
+            fprintf(out, "%s%s", p ? ", " : "", TYPE_NAMES[ir->insts.v[f->first_inst+p].type]);
+        fprintf(out, ") -> %s\n", TYPE_NAMES[f->ret]);
+
+        for (uint32_t bl = 0; bl < f->blocks; bl++) {
+            const IrBlock* block = &ir->blocks.v[f->first_block + bl];
+            fprintf(out, "b%u:\n", bl);
+            for (IrRef at = block->first; at < block->first + block->count; at++)
+                print_inst(out, ir, f, at);
+        }
+    }
+}
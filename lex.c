@@ -6,477 +6,844 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
 #include "head.h"
 
+#if !defined(_WIN32)
+#define LEX_THREADS 1
+#include <pthread.h>
+#else
+#define LEX_THREADS 0 /* no pool, chunks are lexed one after another */
+#endif
+
 /* config */
-#define LEX_TKS_INIT_CAPACITY       4
-#define LEX_TKS_REALLOC_CAPACITY    4
-#define DEBUG_PRINT_TOKENS          1
+#define LEX_TKS_INIT_CAPACITY       256
+#define LEX_TKS_GROWTH              2 /* capacity multiplier, arena memory can't be reused in place */
+#define LEX_CHUNKS_PER_THREAD       4 /* parallel lexing, for balancing uneven chunks */
+#define LEX_CHUNK_ARENA_SIZE        (1 << 16)
+#define LEX_CHUNK_ARENA_RATIO       4 /* arena bytes per source byte, so a chunk usually fits in one block */
+#ifndef DEBUG_PRINT_TOKENS
+#define DEBUG_PRINT_TOKENS          0 /* 1 dumps every token to stderr */
+#endif
 
 /* dictionary */
-static const char* KEYWORDS[] = {
-    "class", "and", "as", "async", "await", "break", "continue", "def",
-    "del", "elif", "else", "except", "finally", "for", "from", "global",
-    "if", "import", "in", "is", "lambda", "nonlocal", "not", "or", "pass",
-    "raise", "return", "try", "while", "with", "yield", "def", "end"
-};
-static const char SYMBOLS[] = { /* flags to start the symbol reader, not the actual symbol defs */
-    '(', ')', '{', '}', ':', '-', '+', '*', '/', '#', '=', ','
-};
-static const char* TYPES[] = {
-    "i8", "i16", "i32", "i64",
-    "u8", "u16", "u32", "u64",
-    "string", "boolean",
-};
 
-#define in_str_dict_tab(tab, str) {                                 \
-    for (int i = 0; i < sizeof(tab)/sizeof(tab[0]); i++)            \
-        if (strcmp(str, tab[i]) == 0)                               \
-            return 1;                                               \
-    return 0;}
-
-
-static inline int is_a_symbol(char CHR) {
-   for (int i = 0; i < sizeof(SYMBOLS)/sizeof(SYMBOLS[0]); i++) {
-        if (CHR == SYMBOLS[i])
-            return 1;
-   }
-   return 0; 
+/*
+** Perfect hash over the first and last character, collision free for every word below.
+** lex_verify_words checks that every word still lands in a slot of its own.
+*/
+#define WORD_HASH_SIZE              128
+#define word_hash(first, last)      ((((unsigned)(first))*2 + ((unsigned)(last))*49) & (WORD_HASH_SIZE-1))
+
+typedef struct LexWord {
+    const char* word;
+    uint32_t len;
+    TK_Kind kind;
+    Symbol sym;
+} LexWord;
+
+/* X(first, last, spelling, kind, symbol) */
+#define LEX_WORDS(X) \
+    /* keywords */ \
+    X('c', 's', "class", TK_Keyword, SYM_class) \
+    X('a', 'd', "and", TK_Keyword, SYM_and) \
+    X('a', 's', "as", TK_Keyword, SYM_as) \
+    X('a', 'c', "async", TK_Keyword, SYM_async) \
+    X('a', 't', "await", TK_Keyword, SYM_await) \
+    X('b', 'k', "break", TK_Keyword, SYM_break) \
+    X('c', 'e', "continue", TK_Keyword, SYM_continue) \
+    X('d', 'f', "def", TK_Keyword, SYM_def) \
+    X('d', 'l', "del", TK_Keyword, SYM_del) \
+    X('e', 'f', "elif", TK_Keyword, SYM_elif) \
+    X('e', 'e', "else", TK_Keyword, SYM_else) \
+    X('e', 't', "except", TK_Keyword, SYM_except) \
+    X('f', 'y', "finally", TK_Keyword, SYM_finally) \
+    X('f', 'r', "for", TK_Keyword, SYM_for) \
+    X('f', 'm', "from", TK_Keyword, SYM_from) \
+    X('g', 'l', "global", TK_Keyword, SYM_global) \
+    X('i', 'f', "if", TK_Keyword, SYM_if) \
+    X('i', 't', "import", TK_Keyword, SYM_import) \
+    X('i', 'n', "in", TK_Keyword, SYM_in) \
+    X('i', 's', "is", TK_Keyword, SYM_is) \
+    X('l', 'a', "lambda", TK_Keyword, SYM_lambda) \
+    X('n', 'l', "nonlocal", TK_Keyword, SYM_nonlocal) \
+    X('n', 't', "not", TK_Keyword, SYM_not) \
+    X('o', 'r', "or", TK_Keyword, SYM_or) \
+    X('p', 's', "pass", TK_Keyword, SYM_pass) \
+    X('r', 'e', "raise", TK_Keyword, SYM_raise) \
+    X('r', 'n', "return", TK_Keyword, SYM_return) \
+    X('t', 'y', "try", TK_Keyword, SYM_try) \
+    X('w', 'e', "while", TK_Keyword, SYM_while) \
+    X('w', 'h', "with", TK_Keyword, SYM_with) \
+    X('y', 'd', "yield", TK_Keyword, SYM_yield) \
+    X('e', 'd', "end", TK_Keyword, SYM_end) \
+    /* types */ \
+    X('i', '8', "i8", TK_Type, SYM_i8) \
+    X('i', '6', "i16", TK_Type, SYM_i16) \
+    X('i', '2', "i32", TK_Type, SYM_i32) \
+    X('i', '4', "i64", TK_Type, SYM_i64) \
+    X('u', '8', "u8", TK_Type, SYM_u8) \
+    X('u', '6', "u16", TK_Type, SYM_u16) \
+    X('u', '2', "u32", TK_Type, SYM_u32) \
+    X('u', '4', "u64", TK_Type, SYM_u64) \
+    X('s', 'g', "string", TK_Type, SYM_string) \
+    X('b', 'n', "boolean", TK_Type, SYM_boolean) \
+    /* constants */ \
+    X('T', 'e', "True", TK_Boolean, SYM_True) \
+    X('F', 'e', "False", TK_Boolean, SYM_False) \
+    X('N', 'e', "None", TK_None, SYM_None)
+
+#define word_entry(_first, _last, _word, _kind, _sym) [word_hash(_first, _last)] = {_word, sizeof(_word)-1, _kind, _sym},
+#define word_spelling(_first, _last, _word, _kind, _sym) _word,
+static const LexWord WORDS[WORD_HASH_SIZE] = {LEX_WORDS(word_entry)};
+static const char* const WORD_SPELLINGS[] = {LEX_WORDS(word_spelling)};
+/*
+** Keyword/type/boolean/None entry of a finished identifier, NULL for a plain identifier, O(1).
+*/
+static inline const LexWord* classify_word(const char* STR, uint32_t len) {
+    const LexWord* w = &WORDS[word_hash(STR[0], STR[len-1])];
+    if (w->len == len && memcmp(w->word, STR, len) == 0)
+        return w;
+    return NULL;
 }
 
-static inline int is_a_keyword(char* STR) in_str_dict_tab(KEYWORDS, STR);
-static inline int is_a_type(char* STR) in_str_dict_tab(TYPES, STR);
-static inline int is_a_bool(char* STR) {return strcmp(STR, "True") == 0 || strcmp(STR, "False") == 0;}
-
-/*}=======================*/
-
 
 /*
-** Creates a new token.
-** strdup's the value parameter (heap alloc).
+** Character classes, every byte of the source maps to exactly one.
 */
-static Token* make_token(TK_Kind kind, char* value, int line, int column, int columns_traversed) {
-    Token* tk = malloc(sizeof(Token));
-    tk->kind = kind;
-    tk->value = strdup(value);
-    tk->line = line;
-    tk->column = column-strlen(value)+1;
-    tk->columns_traversed = columns_traversed;
-    tk->next = NULL;
-    tk->prev = NULL;
-    return tk;
-}
+typedef enum CharClass {
+    CC_Bad, /* anything not listed, bad character */
+    CC_End, /* past the last character, a \0 in the source is just a bad character */
+    CC_Newline,
+    CC_Space,
+    CC_Alpha, /* A-Z a-z _ */
+    CC_X, /* x, identifier character that is also the hexadecimal marker */
+    CC_Digit,
+    CC_SQuote,
+    CC_DQuote,
+    CC_Backslash,
+    CC_Hash,
+    CC_Single, /* ( ) { } : , */
+    CC_Op, /* + - * / % < ! */
+    CC_Equals,
+    CC_Greater,
+    CC_COUNT,
+} CharClass;
+
+/* half an alphabet, A-M and N-Z cover exactly A-Z */
+#define CC_ALPHA_13(_f) [_f]=CC_Alpha, [_f+1]=CC_Alpha, [_f+2]=CC_Alpha, [_f+3]=CC_Alpha, [_f+4]=CC_Alpha, [_f+5]=CC_Alpha, [_f+6]=CC_Alpha, \
+    [_f+7]=CC_Alpha, [_f+8]=CC_Alpha, [_f+9]=CC_Alpha, [_f+10]=CC_Alpha, [_f+11]=CC_Alpha, [_f+12]=CC_Alpha
+static const uint8_t CHAR_CLASS[256] = {
+    ['\n'] = CC_Newline, ['\r'] = CC_Newline,
+    [' '] = CC_Space, ['\f'] = CC_Space, ['\t'] = CC_Space, ['\v'] = CC_Space,
+    CC_ALPHA_13('A'), CC_ALPHA_13('N'),
+    CC_ALPHA_13('a'), CC_ALPHA_13('n'),
+    ['_'] = CC_Alpha,
+    ['x'] = CC_X, /* after the range, overrides it */
+    ['0'] = CC_Digit, ['1'] = CC_Digit, ['2'] = CC_Digit, ['3'] = CC_Digit, ['4'] = CC_Digit,
+    ['5'] = CC_Digit, ['6'] = CC_Digit, ['7'] = CC_Digit, ['8'] = CC_Digit, ['9'] = CC_Digit,
+    ['\''] = CC_SQuote, ['"'] = CC_DQuote, ['\\'] = CC_Backslash, ['#'] = CC_Hash,
+    ['('] = CC_Single, [')'] = CC_Single, ['{'] = CC_Single, ['}'] = CC_Single, [':'] = CC_Single, [','] = CC_Single,
+    ['+'] = CC_Op, ['-'] = CC_Op, ['*'] = CC_Op, ['/'] = CC_Op, ['%'] = CC_Op,
+    ['<'] = CC_Op, ['!'] = CC_Op,
+    ['='] = CC_Equals, ['>'] = CC_Greater,
+};
+
+/* token kind of a symbol on its own */
+static const uint8_t SYMBOL_KIND[256] = {
+    ['('] = TK_OpenParenthesis, [')'] = TK_CloseParenthesis,
+    ['{'] = TK_OpenSquirly, ['}'] = TK_CloseSquirly,
+    [':'] = TK_Colon, [','] = TK_Comma,
+    ['+'] = TK_Add, ['-'] = TK_Sub, ['*'] = TK_Mul, ['/'] = TK_Div, ['%'] = TK_Mod,
+    ['='] = TK_Equals, ['<'] = TK_Less, ['>'] = TK_Greater,
+    ['\''] = TK_Quote, ['"'] = TK_Quote,
+};
+/* token kind of a symbol followed by =, TK_Identifier when they don't pair */
+static const uint8_t SYMBOL_EQUALS_KIND[256] = {
+    ['+'] = TK_Increment, ['-'] = TK_Decrement, ['*'] = TK_Multiment, ['/'] = TK_Divement,
+    ['='] = TK_EqualsEquals, ['!'] = TK_NotEquals, ['<'] = TK_LessEquals, ['>'] = TK_GreaterEquals,
+};
 
 /*
-** Inserts character into tk_buf (buffer_write).
+** States of the scanner.
 */
-static inline void insert_char_into_ls(LexState* ls, char CHR) {
-    buffer_write(ls->tk_buf, ls->tk_buf->siz, CHR);
-}
+typedef enum LexDfaState {
+    ST_Start, /* in between tokens */
+    ST_Ident,
+    ST_Number,
+    ST_Op, /* an operator character that might pair with the next one */
+    ST_String,
+    ST_StringEscape,
+    ST_Comment,
+    ST_MultiComment, /* ''' ... ''' */
+    ST_COUNT,
+} LexDfaState;
 
 /*
-** Inserts a valid token into the lexer state.
+** What to do with the current character when taking a transition.
+** The Emit* actions end the pending token before the character and process it again in the next state.
 */
-static void insert_tk_into_ls(LexState* ls, Token* tk) {
-    if (ls->tks.siz + 1 > ls->tks.cap) {
-        ls->tks.cap += LEX_TKS_REALLOC_CAPACITY;
-        ls->tks.v = realloc(ls->tks.v, sizeof(void*)*ls->tks.cap);
-    }
+typedef enum LexAction {
+    A_Next, /* just consume */
+    A_Newline,
+    A_BeginToken,
+    A_BeginIdent,
+    A_Space,
+    A_BeginComment,
+    A_EmitIdent,
+    A_EmitNumber,
+    A_NumberX,
+    A_BadNumber,
+    A_Symbol,
+    A_EmitOp,
+    A_EmitOpEquals,
+    A_EmitArrow,
+    A_Quote, /* opening quote, or ''' */
+    A_StringQuote, /* a quote inside a string, closes it if it matches */
+    A_BeginEscape,
+    A_Escape,
+    A_Unclosed,
+    A_MultiQuote, /* a quote inside a multiline comment, closes it on ''' */
+    A_MultiNewline,
+    A_End,
+    A_Bad,
+} LexAction;
+
+typedef struct LexTransition {
+    uint8_t next; /* LexDfaState */
+    uint8_t action; /* LexAction */
+} LexTransition;
+
+#define T(_state, _action) {_state, _action}
+static const LexTransition TRANSITIONS[ST_COUNT][CC_COUNT] = {
+    [ST_Start] = {
+        [CC_Bad] = T(ST_Start, A_Bad),          [CC_End] = T(ST_Start, A_End),
+        [CC_Newline] = T(ST_Start, A_Newline),  [CC_Space] = T(ST_Start, A_Space),
+        [CC_Alpha] = T(ST_Ident, A_BeginIdent), [CC_X] = T(ST_Ident, A_BeginIdent),
+        [CC_Digit] = T(ST_Number, A_BeginToken),
+        [CC_SQuote] = T(ST_String, A_Quote),    [CC_DQuote] = T(ST_String, A_Quote),
+        [CC_Backslash] = T(ST_Start, A_Bad),    [CC_Hash] = T(ST_Comment, A_BeginComment),
+        [CC_Single] = T(ST_Start, A_Symbol),
+        [CC_Op] = T(ST_Op, A_BeginToken),       [CC_Equals] = T(ST_Op, A_BeginToken),
+        [CC_Greater] = T(ST_Op, A_BeginToken),
+    },
+    [ST_Ident] = {
+        [CC_Bad] = T(ST_Start, A_EmitIdent),    [CC_End] = T(ST_Start, A_EmitIdent),
+        [CC_Newline] = T(ST_Start, A_EmitIdent),[CC_Space] = T(ST_Start, A_EmitIdent),
+        [CC_Alpha] = T(ST_Ident, A_Next),       [CC_X] = T(ST_Ident, A_Next),
+        [CC_Digit] = T(ST_Ident, A_Next),
+        [CC_SQuote] = T(ST_Start, A_EmitIdent), [CC_DQuote] = T(ST_Start, A_EmitIdent),
+        [CC_Backslash] = T(ST_Start, A_EmitIdent), [CC_Hash] = T(ST_Start, A_EmitIdent),
+        [CC_Single] = T(ST_Start, A_EmitIdent),
+        [CC_Op] = T(ST_Start, A_EmitIdent),     [CC_Equals] = T(ST_Start, A_EmitIdent),
+        [CC_Greater] = T(ST_Start, A_EmitIdent),
+    },
+    [ST_Number] = {
+        [CC_Bad] = T(ST_Start, A_EmitNumber),   [CC_End] = T(ST_Start, A_EmitNumber),
+        [CC_Newline] = T(ST_Start, A_EmitNumber), [CC_Space] = T(ST_Start, A_EmitNumber),
+        [CC_Alpha] = T(ST_Number, A_BadNumber), [CC_X] = T(ST_Number, A_NumberX),
+        [CC_Digit] = T(ST_Number, A_Next),
+        [CC_SQuote] = T(ST_Start, A_EmitNumber), [CC_DQuote] = T(ST_Start, A_EmitNumber),
+        [CC_Backslash] = T(ST_Start, A_EmitNumber), [CC_Hash] = T(ST_Start, A_EmitNumber),
+        [CC_Single] = T(ST_Start, A_EmitNumber),
+        [CC_Op] = T(ST_Start, A_EmitNumber),    [CC_Equals] = T(ST_Start, A_EmitNumber),
+        [CC_Greater] = T(ST_Start, A_EmitNumber),
+    },
+    [ST_Op] = {
+        [CC_Bad] = T(ST_Start, A_EmitOp),       [CC_End] = T(ST_Start, A_EmitOp),
+        [CC_Newline] = T(ST_Start, A_EmitOp),   [CC_Space] = T(ST_Start, A_EmitOp),
+        [CC_Alpha] = T(ST_Start, A_EmitOp),     [CC_X] = T(ST_Start, A_EmitOp),
+        [CC_Digit] = T(ST_Start, A_EmitOp),
+        [CC_SQuote] = T(ST_Start, A_EmitOp),    [CC_DQuote] = T(ST_Start, A_EmitOp),
+        [CC_Backslash] = T(ST_Start, A_EmitOp), [CC_Hash] = T(ST_Start, A_EmitOp),
+        [CC_Single] = T(ST_Start, A_EmitOp),
+        [CC_Op] = T(ST_Start, A_EmitOp),        [CC_Equals] = T(ST_Start, A_EmitOpEquals),
+        [CC_Greater] = T(ST_Start, A_EmitArrow),
+    },
+    [ST_String] = {
+        [CC_Bad] = T(ST_String, A_Next),        [CC_End] = T(ST_String, A_Unclosed),
+        [CC_Newline] = T(ST_String, A_Unclosed),[CC_Space] = T(ST_String, A_Next),
+        [CC_Alpha] = T(ST_String, A_Next),      [CC_X] = T(ST_String, A_Next),
+        [CC_Digit] = T(ST_String, A_Next),
+        [CC_SQuote] = T(ST_String, A_StringQuote), [CC_DQuote] = T(ST_String, A_StringQuote),
+        [CC_Backslash] = T(ST_StringEscape, A_BeginEscape), [CC_Hash] = T(ST_String, A_Next),
+        [CC_Single] = T(ST_String, A_Next),
+        [CC_Op] = T(ST_String, A_Next),         [CC_Equals] = T(ST_String, A_Next),
+        [CC_Greater] = T(ST_String, A_Next),
+    },
+    [ST_StringEscape] = {
+        [CC_Bad] = T(ST_String, A_Escape),      [CC_End] = T(ST_String, A_Unclosed),
+        [CC_Newline] = T(ST_String, A_Escape),  [CC_Space] = T(ST_String, A_Escape),
+        [CC_Alpha] = T(ST_String, A_Escape),    [CC_X] = T(ST_String, A_Escape),
+        [CC_Digit] = T(ST_String, A_Escape),
+        [CC_SQuote] = T(ST_String, A_Escape),   [CC_DQuote] = T(ST_String, A_Escape),
+        [CC_Backslash] = T(ST_String, A_Escape),[CC_Hash] = T(ST_String, A_Escape),
+        [CC_Single] = T(ST_String, A_Escape),
+        [CC_Op] = T(ST_String, A_Escape),       [CC_Equals] = T(ST_String, A_Escape),
+        [CC_Greater] = T(ST_String, A_Escape),
+    },
+    [ST_Comment] = {
+        [CC_Bad] = T(ST_Comment, A_Next),       [CC_End] = T(ST_Comment, A_End),
+        [CC_Newline] = T(ST_Start, A_Newline),  [CC_Space] = T(ST_Comment, A_Next),
+        [CC_Alpha] = T(ST_Comment, A_Next),     [CC_X] = T(ST_Comment, A_Next),
+        [CC_Digit] = T(ST_Comment, A_Next),
+        [CC_SQuote] = T(ST_Comment, A_Next),    [CC_DQuote] = T(ST_Comment, A_Next),
+        [CC_Backslash] = T(ST_Comment, A_Next), [CC_Hash] = T(ST_Comment, A_Next),
+        [CC_Single] = T(ST_Comment, A_Next),
+        [CC_Op] = T(ST_Comment, A_Next),        [CC_Equals] = T(ST_Comment, A_Next),
+        [CC_Greater] = T(ST_Comment, A_Next),
+    },
+    [ST_MultiComment] = {
+        [CC_Bad] = T(ST_MultiComment, A_Next),  [CC_End] = T(ST_MultiComment, A_End),
+        [CC_Newline] = T(ST_MultiComment, A_MultiNewline), [CC_Space] = T(ST_MultiComment, A_Next),
+        [CC_Alpha] = T(ST_MultiComment, A_Next),[CC_X] = T(ST_MultiComment, A_Next),
+        [CC_Digit] = T(ST_MultiComment, A_Next),
+        [CC_SQuote] = T(ST_MultiComment, A_MultiQuote), [CC_DQuote] = T(ST_MultiComment, A_Next),
+        [CC_Backslash] = T(ST_MultiComment, A_Next), [CC_Hash] = T(ST_MultiComment, A_Next),
+        [CC_Single] = T(ST_MultiComment, A_Next),
+        [CC_Op] = T(ST_MultiComment, A_Next),   [CC_Equals] = T(ST_MultiComment, A_Next),
+        [CC_Greater] = T(ST_MultiComment, A_Next),
+    },
+};
+#undef T
 
-    /* next and prev */
-    if (ls->tks.siz > 0) {
-        ls->tks.v[ls->tks.siz-1]->next = tk;
-        tk->prev = ls->tks.v[ls->tks.siz-1];
-    }
+/*}=======================*/
 
-    ls->tks.v[ls->tks.siz] = tk;
-    ls->tks.siz++;
-}
 
 /*
-** Creates a token from the lexer state, into the lexer state.
-** (insert_tk_into_ls(make_token(ls info))
+** Grows every array of the token stream together.
 */
-static inline void create_tk_into_ls(LexState* ls, TK_Kind kind) {
-    insert_tk_into_ls(ls, make_token(kind, ls->tk_buf->data, ls->line, ls->column, ls->columns_traversed));
+static void grow_token_stream(LexState* ls) {
+    TokenStream* ts = ls->ts;
+    size_t cap = ts->cap*LEX_TKS_GROWTH;
+    ts->kind = arena_realloc(ls->arena, ts->kind, ts->cap, cap);
+    ts->offset = arena_realloc(ls->arena, ts->offset, sizeof(uint32_t)*ts->cap, sizeof(uint32_t)*cap);
+    ts->sym = arena_realloc(ls->arena, ts->sym, sizeof(Symbol)*ts->cap, sizeof(Symbol)*cap);
+    ts->cap = cap;
 }
 
 /*
-** Token maker for symbols. 
+** Creates a token starting at <at> into the lexer state, spelled <sym>.
 */
-#define tk_symbol(k, v)                      \
-    if (ls->tk_buf->siz > 0) {               \
-        create_tk_into_ls(ls, TK_Identifier);\
-        zero_buffer(ls->tk_buf);             \
-    }                                        \
-    insert_tk_into_ls(ls, make_token(k, v, ls->line, ls->column, ls->columns_traversed))
-
-static inline int next_char(char** _i, const int steps, const char CHR) {
-    if ((*_i)[steps] == CHR)
-        return 1;
-    return 0;
+static inline void create_tk_into_ls(LexState* ls, TK_Kind kind, const char* at, Symbol sym) {
+    TokenStream* ts = ls->ts;
+    if (ts->siz + 1 > ts->cap && ts->mask == TS_NO_RING)
+        grow_token_stream(ls);
+
+    /* error check, no second pass needed */
+    switch (kind) {
+        case TK_OpenParenthesis: ls->parenthesis_balance++; break;
+        case TK_CloseParenthesis: ls->parenthesis_balance--; break;
+        default: break;
+    }
+
+    const size_t slot = ts->siz & ts->mask; /* ring mode recycles slots the parser moved past */
+    ts->kind[slot] = kind;
+    ts->offset[slot] = at - ls->src;
+    ts->sym[slot] = sym;
+    ts->siz++;
 }
 
+/* token whose spelling is the source text at <at> */
+#define create_text_tk_into_ls(_ls, _kind, _at, _len) create_tk_into_ls(_ls, _kind, _at, intern((_ls)->ts->symbols, _at, _len))
+/* single character symbol token */
+#define create_char_tk_into_ls(_ls, _kind, _at) create_tk_into_ls(_ls, _kind, _at, symbol_of_char(*(_at)))
+
 /*}=======================*/
 // real code starts here
 
-#define is_valid_chr(CHR) ((CHR >= 'A' && CHR <= 'Z') || (CHR >= 'a' && CHR <= 'z') || (CHR == '_') || (CHR >= '0' && CHR <= '9'))
-
-static void advance(LexState* ls, char** _i) {
-    (*_i)++;
-    ls->column++;
-    ls->columns_traversed++;
+/*
+** Syntax error at <at>, the column is relative to the current line.
+** Speculative chunks only record it and leave, it counts once the chunk is picked.
+*/
+static void lex_error(LexState* ls, const char* at, const char* code) {
+    if (ls->on_error != NULL) {
+        ls->error_at = at;
+        ls->error_code = code;
+        longjmp(*(jmp_buf*)ls->on_error, 1);
+    }
+    logger_token_error(ls->line, (int)(at - ls->line_start), code);
 }
 
-static void newline(LexState* ls) {
+static void newline(LexState* ls, const char* at) {
+    TokenStream* ts = ls->ts;
     ls->line++;
-    ls->column = 0;
-    ls->newline_column = ls->columns_traversed;
+    ls->line_start = at+1;
 
-    if (ls->in_comment == 1 && ls->is_comment_multiline == 0) ls->in_comment = 0;
+    /* line table, for going from an offset back to line and column */
+    if (ts->line_starts.siz + 1 > ts->line_starts.cap) {
+        ts->line_starts.v = arena_realloc(ls->arena, ts->line_starts.v, sizeof(uint32_t)*ts->line_starts.cap, sizeof(uint32_t)*ts->line_starts.cap*LEX_TKS_GROWTH);
+        ts->line_starts.cap *= LEX_TKS_GROWTH;
+    }
+    ts->line_starts.v[ts->line_starts.siz++] = ls->line_start - ls->src;
 }
 
-static void whitespace(LexState* ls) {
-    if (ls->tk_buf->siz > 0) {
-        create_tk_into_ls(ls, TK_Identifier);
-        zero_buffer(ls->tk_buf);
+/*
+** Decodes the escape sequences of <raw> into <out>, returns the decoded length.
+** <raw> was already validated by the scanner.
+*/
+static uint32_t decode_escapes(char* out, const char* raw, uint32_t len) {
+    uint32_t k = 0;
+    for (uint32_t j = 0; j < len; j++) {
+        if (raw[j] != '\\') {
+            out[k++] = raw[j];
+            continue;
+        }
+        j++;
+        switch (raw[j]) {
+            case 'n': out[k++] = '\n'; break;
+            case 't': out[k++] = '\t'; break;
+            case 'r': out[k++] = '\r'; break;
+            case 'b': out[k++] = '\b'; break;
+            case 'f': out[k++] = '\f'; break;
+            default: out[k++] = raw[j]; break; /* \\, \' and \" */
+        }
     }
+    return k;
 }
 
-/* pause main loop */
-static void read_string_literal(LexState* ls, char** _i) {
-    char* iptr = *_i;
-    char clause_type = *iptr;
-
-    /* creates token if not empty buffer & inserts quote */
-    tk_symbol(TK_Quote, ((char[2]){clause_type, '\0'}));
-
-    advance(ls, _i);
-
-    for (;;) {
-        switch (*(*_i)) {
-            case '\n': case '\r':
-            case '\0': {
-                /* unclosed string literal error */
-                logger_token_error(ls->line, ls->tks.v[ls->tks.siz-1]->columns_traversed-ls->newline_column, "Unclosed string literal.");
-            }
-            
-            case '\\': { /* escape characters */
-                switch ((*_i)[1]) { /* the next character */
-                    case '\'': case '"': {
-                        advance(ls, _i);
-                        insert_char_into_ls(ls, *(*_i));
-                        break;
-                    }
-                    case 'n': {
-                        insert_char_into_ls(ls, '\n');
-                        goto stop;
-                    }
-                    case '\\': {
-                        insert_char_into_ls(ls, '\\');
-                        goto stop;
-                    }
-                    case 't': {
-                        insert_char_into_ls(ls, '\t');
-                        goto stop;
-                    }
-                    case 'r': {
-                        insert_char_into_ls(ls, '\r');
-                        goto stop;
-                    }
-                    case 'b': {
-                        insert_char_into_ls(ls, '\b');
-                        goto stop;
-                    }
-                    case 'f': {
-                        insert_char_into_ls(ls, '\f');
-                        goto stop;
-                    }
-
-                    default: {
-                        logger_token_error(ls->line, ls->columns_traversed-ls->newline_column, "Invalid escape character.");
-                    }
-
-                    stop:
-                        advance(ls, _i);
-                        advance(ls, _i);
-                        break;
-                }
-            }
-
-            default: {
-                if ((*(*_i)) == clause_type) {
-                    /* close string */
-                    create_tk_into_ls(ls, TK_String);
-                    zero_buffer(ls->tk_buf);
-                    tk_symbol(TK_Quote, ((char[2]){clause_type, '\0'})); /* close symbol */
-                    return;
-                }
+/*
+** Closes the string literal at <iptr> (the closing quote).
+** Only escaped strings get a decoded copy.
+*/
+static void close_string_literal(LexState* ls, const char* iptr) {
+    uint32_t len = iptr - ls->tk_start;
+    if (ls->has_escape) {
+        char* decoded = arena_alloc(ls->arena, len);
+        len = decode_escapes(decoded, ls->tk_start, len);
+        create_tk_into_ls(ls, TK_String, ls->tk_start, intern(ls->ts->symbols, decoded, len));
+    } else {
+        create_text_tk_into_ls(ls, TK_String, ls->tk_start, len);
+    }
+    create_char_tk_into_ls(ls, TK_Quote, iptr); /* close symbol */
+}
 
-                /* regular character */
-                insert_char_into_ls(ls, *(*_i));
-            }
+/*
+** At the end of the source, syntax checks on what the loop counted.
+*/
+static void token_checks(LexState* ls) {
+    switch (ls->parenthesis_balance) {
+        case 0: break;
+        default: { /* parenthesis balance error, at the last token */
+            uint32_t offset = ts_offset(ls->ts, ls->ts->siz-2);
+            logger_token_error(ts_line(ls->ts, offset), ts_column(ls->ts, offset)-1, "Unclosed scope.");
         }
-
-        advance(ls, _i);
     }
 }
 
-/* pause main loop */
-static void read_numeric(LexState* ls, char** _i) {
-
-    /* create token if not empty buffer */
-    if (ls->tk_buf->siz > 0) {
-        create_tk_into_ls(ls, TK_Identifier);
-        zero_buffer(ls->tk_buf);
+#if(DEBUG_PRINT_TOKENS == 1)
+static void print_tokens(TokenStream* ts, size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+        fprintf(stderr, "kind: %d. value: %.*s. :%d:%d:\n", ts_kind(ts, i), (int)ts_len(ts, i), ts_value(ts, i), ts_line(ts, ts_offset(ts, i)), ts_column(ts, ts_offset(ts, i)));
     }
+}
+#endif
 
-    for (;;) {
-        switch (*(*_i)) {
-            case '\0':
-            case '\n': case '\r':
-            case ' ': case '\f': case '\t': case '\v': {
-                /* exit function */
-                create_tk_into_ls(ls, TK_Numeric);
-                zero_buffer(ls->tk_buf);
-                return;
+/*
+** Main loop.
+** One class lookup and one transition lookup per character, the actions only run on token edges.
+** Long runs (identifiers, indentation, comment and string bodies) are skipped by the scan.c kernels,
+** which stop on the next character that can change the state.
+** Runs until at least one token was made, the position and state are kept in <ls> for the next call.
+*/
+static void lex_head_loop(LexState* ls) {
+    const char* iptr = ls->iptr;
+    const char* end = ls->end;
+    uint8_t state = ls->state;
+    const size_t produced = ls->ts->siz;
+
+    while (ls->ts->siz == produced) {
+        const LexTransition t = TRANSITIONS[state][iptr < end ? CHAR_CLASS[(uint8_t)*iptr] : CC_End];
+        state = t.next;
+
+        switch (t.action) {
+            case A_Next: break;
+            case A_Newline: {
+                newline(ls, iptr);
+                if (iptr+1 == ls->stop)
+                    goto chunk_end;
+                break;
             }
+            case A_BeginToken: ls->tk_start = iptr; break;
 
-            case 'x': {
-                /* hexadecimal? */
-                if (ls->tk_buf->siz != 1)
-                    goto bad_number; /* invalid x placement */
-
-                insert_char_into_ls(ls, *(*_i));
-                break;
+            /* runs */
+            case A_BeginIdent: {
+                ls->tk_start = iptr;
+                iptr = scan_kernels.ident(iptr+1, end);
+                continue;
+            }
+            case A_Space: iptr = scan_kernels.space(iptr+1, end); continue;
+            case A_BeginComment: iptr = scan_kernels.line_comment(iptr+1, end); continue;
+
+            /* token ends before this character, process it again */
+            case A_EmitIdent: {
+                uint32_t len = iptr - ls->tk_start;
+                const LexWord* w = classify_word(ls->tk_start, len);
+                if (w != NULL)
+                    create_tk_into_ls(ls, w->kind, ls->tk_start, w->sym); /* preset, no hashing */
+                else
+                    create_text_tk_into_ls(ls, TK_Identifier, ls->tk_start, len);
+                continue;
+            }
+            case A_EmitNumber: {
+                create_text_tk_into_ls(ls, TK_Numeric, ls->tk_start, iptr - ls->tk_start);
+                continue;
+            }
+            case A_EmitArrow: {
+                if (*ls->tk_start == '-') {
+                    create_text_tk_into_ls(ls, TK_Arrow, ls->tk_start, 2);
+                    break;
+                }
+                /* only -> pairs with >, anything else ends before it */
+            } /* fallthrough */
+            case A_EmitOp: {
+                if (*ls->tk_start == '!')
+                    lex_error(ls, ls->tk_start, "Bad character."); /* ! only exists in != */
+                create_char_tk_into_ls(ls, SYMBOL_KIND[(uint8_t)*ls->tk_start], ls->tk_start);
+                continue;
             }
-            
-            case '0': case '1': case '2': case '3': case '4':
-            case '5': case '6': case '7': case '8': case '9': {
-                insert_char_into_ls(ls, *(*_i));
+            case A_EmitOpEquals: {
+                if (SYMBOL_EQUALS_KIND[(uint8_t)*ls->tk_start] == TK_Identifier) {
+                    /* no compound form (%=), the = starts the next token */
+                    create_char_tk_into_ls(ls, SYMBOL_KIND[(uint8_t)*ls->tk_start], ls->tk_start);
+                    continue;
+                }
+                create_text_tk_into_ls(ls, SYMBOL_EQUALS_KIND[(uint8_t)*ls->tk_start], ls->tk_start, 2);
                 break;
             }
-            default: goto bad_number; /* no other characters allowed */
-
-            bad_number:
-                    logger_token_error(ls->line, ls->columns_traversed-ls->newline_column, "Malformed number.");
-        }
-
-        advance(ls, _i);
-    }
-}
 
-static void read_symbol(LexState* ls, char** _i) {
-    for (;;) {
-        switch (*(*_i)) {
-            /* single-line comment */
-            case '#': ls->in_comment = 1; advance(ls, _i); return;
+            /* numbers */
+            case A_NumberX: {
+                /* hexadecimal? */
+                if (iptr - ls->tk_start != 1 || *ls->tk_start != '0')
+                    lex_error(ls, iptr, "Malformed number."); /* only 0x */
+                break;
+            }
+            case A_BadNumber: lex_error(ls, iptr, "Malformed number."); break;
 
             /* single char */
-            case '(': tk_symbol(TK_OpenParenthesis, "("); return;
-            case ')': tk_symbol(TK_CloseParenthesis, ")"); return;
-            case '{': tk_symbol(TK_OpenParenthesis, "{"); return;
-            case '}': tk_symbol(TK_CloseSquirly, "}"); return; 
-            case ':': tk_symbol(TK_Colon, ":"); return;
-            case ',': tk_symbol(TK_Comma, ","); return;
-            
-            /* operators */
-            case '+': {
-                if (next_char(_i, 1, '=')) {
-                    // +=
-                    tk_symbol(TK_Increment, "+=");
-                    advance(ls, _i);
-                    return;
+            case A_Symbol: create_char_tk_into_ls(ls, SYMBOL_KIND[(uint8_t)*iptr], iptr); break;
+
+            /* strings */
+            case A_Quote: {
+                /* multiline comment detection */
+                if (*iptr == '\'' && end - iptr > 2 && iptr[1] == '\'' && iptr[2] == '\'') {
+                    state = ST_MultiComment;
+                    iptr = scan_kernels.multi_comment(iptr+3, end);
+                    continue;
                 }
-                
-                // +
-                tk_symbol(TK_Add, "+");
-                return;
+                create_char_tk_into_ls(ls, TK_Quote, iptr);
+                ls->quote = *iptr;
+                ls->has_escape = 0;
+                ls->tk_start = iptr+1;
+                iptr = scan_kernels.string(iptr+1, end);
+                continue;
             }
-            case '-': { /* -, -=, -> */
-                if (next_char(_i, 1, '>')) {
-                    // arrow
-                    tk_symbol(TK_Arrow, "->");
-                    advance(ls, _i);
-                    return;
-                }
-                if (next_char(_i, 1, '=')) {
-                    // -=
-                    tk_symbol(TK_Decrement, "-=");
-                    advance(ls, _i);
-                    return;
+            case A_StringQuote: {
+                if (*iptr == ls->quote) {
+                    close_string_literal(ls, iptr);
+                    state = ST_Start;
+                    break;
                 }
-
-                // -
-                tk_symbol(TK_Sub, "-");
-                return;
+                iptr = scan_kernels.string(iptr+1, end);
+                continue;
             }
-            case '*': {
-                if (next_char(_i, 1, '=')) {
-                    // *=
-                    tk_symbol(TK_Multiment, "*=");
-                    advance(ls, _i);
-                    return;
+            case A_BeginEscape: ls->has_escape = 1; break;
+            case A_Escape: {
+                switch (*iptr) { /* the character after the backslash */
+                    case '\'': case '"':
+                    case 'n': case '\\': case 't':
+                    case 'r': case 'b': case 'f': break;
+
+                    default: lex_error(ls, iptr, "Invalid escape character.");
                 }
-
-                // *
-                tk_symbol(TK_Mul, "*");
-                return;
+                iptr = scan_kernels.string(iptr+1, end);
+                continue;
             }
-            case '/': {
-                if (next_char(_i, 1, '=')) {
-                    // /=
-                    tk_symbol(TK_Divement, "/=");
-                    advance(ls, _i);
-                    return;
-                }
-
-                // /
-                tk_symbol(TK_Div, "/");
-                return;
+            case A_Unclosed: {
+                /* unclosed string literal error */
+                lex_error(ls, ls->tk_start-1, "Unclosed string literal.");
+                break;
             }
-            /* comparisons */
-            case '=': {
-                if (next_char(_i, 1, '=')) {
-                    // ==
-                    tk_symbol(TK_EqualsEquals, "==");
-                    advance(ls, _i);
-                    return;
+
+            /* multiline comments */
+            case A_MultiQuote: {
+                if (end - iptr > 2 && iptr[1] == '\'' && iptr[2] == '\'') {
+                    state = ST_Start;
+                    iptr += 2;
+                    break;
                 }
+                iptr = scan_kernels.multi_comment(iptr+1, end);
+                continue;
+            }
+            case A_MultiNewline: {
+                newline(ls, iptr);
+                if (iptr+1 == ls->stop)
+                    goto chunk_end;
+                iptr = scan_kernels.multi_comment(iptr+1, end);
+                continue;
+            }
 
-                // =
-                tk_symbol(TK_Equals, "=");
+            case A_Bad: lex_error(ls, iptr, "Bad character."); break;
+            case A_End: { /* end of file */
+                create_tk_into_ls(ls, TK_End, iptr, SYM_Empty);
+                if (ls->on_error == NULL)
+                    token_checks(ls); /* chunks are checked once stitched */
+                ls->done = 1;
+                ls->iptr = iptr;
+                ls->state = state;
                 return;
             }
-
         }
 
-        advance(ls, _i);
+        iptr++;
     }
+
+    ls->iptr = iptr;
+    ls->state = state;
+    return;
+
+    chunk_end: /* parallel lexing, the next line belongs to another chunk */
+        ls->done = 1;
+        ls->iptr = iptr+1;
+        ls->state = state;
 }
 
+/*}=======================*/
+
 /*
-** Main loop.
+** Parallel lexing.
+** The source is cut into chunks right after newlines. A line start is either in between tokens or inside a
+** multiline comment (strings and # comments end at the newline), so every chunk is lexed speculatively in
+** both of those states on a thread pool. Stitching walks the chunks in order, picks the result matching the
+** state the previous chunk ended in, and concatenates. Offsets are absolute, lines and columns stay exact.
 */
-static void lex_head_loop(LexState* ls, char* txt) {
-    char* iptr = txt;
-
-    for (;;) {
-        switch (*iptr) {
-            case '\0': goto cleanup; /* end of file */
-            case '\n': case '\r': { /* new line */
-                newline(ls);
-            }
-            case ' ': case '\f': case '\t': case '\v': {
-                whitespace(ls); /* newline is also whitespace */
-                break;
-            }
+typedef struct LexChunk {
+    const char* begin;
+    const char* end;
+    int last; /* ends at the end of the source */
+    struct {
+        Arena* arena;
+        LexState* ls; /* NULL when not lexed (the first chunk only starts in ST_Start) */
+        int failed;
+    } spec[2]; /* by start state, 0: ST_Start, 1: ST_MultiComment */
+} LexChunk;
+
+typedef struct LexJobs {
+    const char* src;
+    size_t len;
+    LexChunk* chunks;
+    size_t siz;
+    size_t next; /* next chunk to take */
+#if LEX_THREADS
+    pthread_mutex_t lock;
+#endif
+} LexJobs;
+
+static void lex_chunk(LexJobs* jobs, LexChunk* chunk) {
+    static const uint8_t states[2] = {ST_Start, ST_MultiComment};
+    for (int k = 0; k < 2; k++) {
+        if (k == 1 && chunk->begin == jobs->src)
+            break; /* the source starts in between tokens */
+
+        chunk->spec[k].arena = arena_create(LEX_CHUNK_ARENA_SIZE + (chunk->end - chunk->begin)*LEX_CHUNK_ARENA_RATIO);
+        LexState* ls = lex_open(jobs->src, jobs->len, chunk->spec[k].arena, 0);
+        ls->ts->line_starts.siz = 0; /* only the lines of the chunk */
+        ls->iptr = chunk->begin;
+        ls->line_start = chunk->begin;
+        ls->state = states[k];
+        if (!chunk->last) {
+            ls->end = chunk->end;
+            ls->stop = chunk->end;
+        }
+        chunk->spec[k].ls = ls;
 
-            case '\'': {
-                /* multiline comment detection */
-                if (next_char(&iptr, 1, '\'') && next_char(&iptr, 2, '\'')) { 
-                        ls->in_comment = !ls->in_comment;
-                        ls->is_comment_multiline = 1;
-                        advance(ls, &iptr);
-                        advance(ls, &iptr);
-                        break;
-                }
-                // is also a string
-            }
-            case '"': { /* strings */
-                if (ls->in_comment == 1) break;
-                read_string_literal(ls, &iptr);
-                break;
-            }
+        jmp_buf on_error;
+        ls->on_error = &on_error;
+        if (setjmp(on_error) != 0) {
+            chunk->spec[k].failed = 1;
+            continue;
+        }
+        while (!ls->done)
+            lex_head_loop(ls);
+        ls->on_error = NULL;
+    }
+}
 
-            case '0': case '1': case '2': case '3': case '4':
-            case '5': case '6': case '7': case '8': case '9': {
-                if (ls->in_comment == 1) break;
-                if (ls->tk_buf->siz > 0)
-                    goto is_character; /* if number is part of a variable name */
+static void* lex_worker(void* _jobs) {
+    LexJobs* jobs = _jobs;
+    for (;;) {
+#if LEX_THREADS
+        pthread_mutex_lock(&jobs->lock);
+#endif
+        size_t i = jobs->next++;
+#if LEX_THREADS
+        pthread_mutex_unlock(&jobs->lock);
+#endif
+        if (i >= jobs->siz)
+            return NULL;
+        lex_chunk(jobs, &jobs->chunks[i]);
+    }
+}
 
-                read_numeric(ls, &iptr);
-                break;
-            }
+/*
+** Appends the tokens and lines of a chunk to <ts>, which is already big enough for the tokens.
+*/
+static void stitch_chunk(TokenStream* ts, TokenStream* part, size_t src_len, Arena* arena) {
+    /*
+    ** Chunk symbols go into the compilation table in their own first-use order, which is source order,
+    ** so every symbol gets the same id as with the sequential lexer.
+    */
+    InternTable* from = part->symbols;
+    Symbol* remap = malloc(sizeof(Symbol)*from->siz);
+    for (Symbol s = 0; s < from->siz; s++) {
+        if (s < SYM_PresetCount) {
+            remap[s] = s;
+            continue;
+        }
+        const char* name = from->v[s].name;
+        if (name < ts->src || name >= ts->src + src_len) { /* decoded strings move out of the chunk arena */
+            char* copy = arena_alloc(arena, from->v[s].len);
+            memcpy(copy, name, from->v[s].len);
+            name = copy;
+        }
+        remap[s] = intern(ts->symbols, name, from->v[s].len);
+    }
 
-            default: goto is_character;
-
-            /*
-            ** Goto here is necessary, as multiple cases need to go to the same code.
-            */
-            is_character:
-                if (ls->in_comment == 1) break;
-                if (!is_valid_chr(*iptr)) {
-                    if (is_a_symbol(*iptr)) { /* is it a symbol? */
-                        read_symbol(ls, &iptr);
-                        break;
-                    }
-
-                    /* bad character error */
-                    logger_token_error(ls->line, ls->columns_traversed-ls->newline_column, "Bad character.");
-                }
+    memcpy(ts->kind + ts->siz, part->kind, part->siz);
+    memcpy(ts->offset + ts->siz, part->offset, sizeof(uint32_t)*part->siz);
+    for (size_t i = 0; i < part->siz; i++)
+        ts->sym[ts->siz + i] = remap[part->sym[i]];
+    ts->siz += part->siz;
+    free(remap);
+
+    size_t lines = ts->line_starts.siz + part->line_starts.siz;
+    if (lines > ts->line_starts.cap) {
+        ts->line_starts.v = arena_realloc(arena, ts->line_starts.v, sizeof(uint32_t)*ts->line_starts.cap, sizeof(uint32_t)*lines*LEX_TKS_GROWTH);
+        ts->line_starts.cap = lines*LEX_TKS_GROWTH;
+    }
+    memcpy(ts->line_starts.v + ts->line_starts.siz, part->line_starts.v, sizeof(uint32_t)*part->line_starts.siz);
+    ts->line_starts.siz = lines;
+}
 
-                /* valid character, not symbol */
-                insert_char_into_ls(ls, *iptr);
-                break;
+/*
+** Cuts <jobs->src> into about <want> chunks, each ending right after a newline.
+*/
+static void cut_chunks(LexJobs* jobs, Arena* arena, size_t want) {
+    const char* at = jobs->src;
+    const char* end = jobs->src + jobs->len;
+    size_t step = jobs->len/want + 1;
+
+    jobs->chunks = arena_alloc(arena, sizeof(LexChunk)*(want+1));
+    jobs->siz = 0;
+    do {
+        const char* cut = end;
+        if ((size_t)(end - at) > step) {
+            const char* nl = memchr(at + step, '\n', end - (at + step));
+            if (nl != NULL && nl+1 < end)
+                cut = nl+1;
+        }
+        jobs->chunks[jobs->siz++] = (LexChunk){.begin = at, .end = cut, .last = cut == end};
+        at = cut;
+    } while (at < end);
+}
 
+TokenStream* lex_parallel(const char* txt, size_t len, Arena* arena, int threads) {
+    LexJobs jobs = {.src = txt, .len = len, .next = 0};
+    if (threads < 1)
+        threads = 1;
+    cut_chunks(&jobs, arena, (size_t)threads*LEX_CHUNKS_PER_THREAD);
+
+    /* lex on the pool, the calling thread is a worker too */
+#if LEX_THREADS
+    pthread_mutex_init(&jobs.lock, NULL);
+    pthread_t* pool = malloc(sizeof(pthread_t)*threads);
+    int started = 0;
+    for (int i = 1; i < threads; i++)
+        if (pthread_create(&pool[started], NULL, lex_worker, &jobs) == 0)
+            started++;
+    lex_worker(&jobs);
+    for (int i = 0; i < started; i++)
+        pthread_join(pool[i], NULL);
+    free(pool);
+    pthread_mutex_destroy(&jobs.lock);
+#else
+    lex_worker(&jobs);
+#endif
 
-            cleanup: /* wraps up lexer, exits function */
-                if (ls->tk_buf->siz > 0) {
-                    //ls->line--;
-                    create_tk_into_ls(ls, TK_Identifier);
-                    //ls->line++; /* -- and ++ because it'll spawn it with an extra line */
-                    zero_buffer(ls->tk_buf);
-                }
-                return;
+    /* stitch */
+    size_t total = 1;
+    for (size_t i = 0; i < jobs.siz; i++) {
+        size_t a = jobs.chunks[i].spec[0].ls->ts->siz;
+        size_t b = jobs.chunks[i].spec[1].ls != NULL ? jobs.chunks[i].spec[1].ls->ts->siz : 0;
+        total += a > b ? a : b;
+    }
+    LexState* ls = lex_open(txt, jobs.len, arena, 0);
+    TokenStream* ts = ls->ts;
+    ts->kind = arena_alloc(arena, total);
+    ts->offset = arena_alloc(arena, sizeof(uint32_t)*total);
+    ts->sym = arena_alloc(arena, sizeof(Symbol)*total);
+    ts->cap = total;
+    ts->line_starts.siz = 1; /* line 1 at offset 0, the chunks add the rest */
+
+    int k = 0;
+    for (size_t i = 0; i < jobs.siz; i++) {
+        LexState* part = jobs.chunks[i].spec[k].ls;
+        stitch_chunk(ts, part->ts, jobs.len, arena);
+        ls->parenthesis_balance += part->parenthesis_balance;
+
+        if (jobs.chunks[i].spec[k].failed) {
+            /* this is the path the sequential lexer takes, so the error is real */
+            ls->line = (int)ts->line_starts.siz;
+            ls->line_start = txt + ts->line_starts.v[ts->line_starts.siz-1];
+            lex_error(ls, part->error_at, part->error_code);
         }
-
-        advance(ls, &iptr);
+        k = part->state == ST_MultiComment;
     }
+    for (size_t i = 0; i < jobs.siz; i++)
+        for (int j = 0; j < 2; j++)
+            if (jobs.chunks[i].spec[j].arena != NULL)
+                arena_free(jobs.chunks[i].spec[j].arena);
+
+    token_checks(ls);
+    ls->done = 1;
+    ts->lex = NULL; /* complete */
+
+    /* optional printing */
+#if(DEBUG_PRINT_TOKENS == 1)
+    print_tokens(ts, 0, ts->siz);
+#endif
+    return ts;
 }
 
 /*
-** After the main loop, detect and make new types.
-** Also syntax checks.
+** Lexes <txt> sequentially and in parallel and compares every token, value, line and column.
+** Returns 0 when both agree.
 */
-static void token_checks(LexState* ls) {
-    // error check vars
-    int parenthesis_balance = 0;
+int lex_compare(const char* txt, size_t len, Arena* arena, int threads) {
+    TokenStream* a = lex_generate(txt, len, arena);
+    TokenStream* b = lex_parallel(txt, len, arena, threads);
 
-    for (int i = 0; i < ls->tks.siz; i++) {
-        Token* tk = ls->tks.v[i];
-
-        switch (tk->kind) {
-            case TK_Identifier: {
-                if (is_a_keyword(tk->value)) {
-                    tk->kind = TK_Keyword;
-                    break;
-                }
-                if (is_a_type(tk->value)) {
-                    tk->kind = TK_Type;
-                    break;
-                }
-                if (is_a_bool(tk->value)) {
-                    tk->kind = TK_Boolean;
-                    break;
-                }
-                if (strcmp(tk->value, "None") == 0) {
-                    tk->kind = TK_None;
-                    break;
-                }
-                break;
-            }
-            case TK_OpenParenthesis: parenthesis_balance++; break;
-            case TK_CloseParenthesis: parenthesis_balance--; break;
+    if (a->siz != b->siz) {
+        printf("PyToASM: Lexer mismatch, %lu tokens sequential and %lu parallel.\n", (unsigned long)a->siz, (unsigned long)b->siz);
+        return 1;
+    }
+    for (size_t i = 0; i < a->siz; i++) {
+        uint32_t offset = a->offset[i];
+        if (a->kind[i] != b->kind[i] || offset != b->offset[i] || a->sym[i] != b->sym[i] || ts_len(a, i) != ts_len(b, i)
+            || memcmp(ts_value(a, i), ts_value(b, i), ts_len(a, i)) != 0
+            || ts_line(a, offset) != ts_line(b, offset) || ts_column(a, offset) != ts_column(b, offset)) {
+            printf("PyToASM: Lexer mismatch at token %lu (line %d).\n", (unsigned long)i, ts_line(a, offset));
+            return 1;
         }
     }
-
-    switch (parenthesis_balance) {
-        case 0: break;
-        default: /* parenthesis balance error */
-            logger_token_error(ls->line-1, ls->tks.v[ls->tks.siz-1]->columns_traversed-ls->newline_column+1, "Unclosed scope.");
+    if (a->line_starts.siz != b->line_starts.siz || memcmp(a->line_starts.v, b->line_starts.v, sizeof(uint32_t)*a->line_starts.siz) != 0) {
+        printf("PyToASM: Lexer mismatch in the line table.\n");
+        return 1;
     }
-    
+    printf("PyToASM: Lexers agree on %lu tokens.\n", (unsigned long)a->siz);
+    return 0;
 }
 
 /*}=======================*/
@@ -484,54 +851,105 @@ static void token_checks(LexState* ls) {
 /*
 ** API
 */
-LexOut* lex_generate(char* txt) {
-    LexOut* lo = malloc(sizeof(LexOut)); /* the final result */
-    
-    LexState ls = {
-        .tk_buf = buffer_create(64),
-        .tks = {
-            .v = malloc(sizeof(void*)*LEX_TKS_INIT_CAPACITY),
-            .siz = 0,
+LexState* lex_open(const char* txt, size_t len, Arena* arena, size_t ring) {
+    TokenStream* ts = arena_alloc(arena, sizeof(TokenStream));
+    size_t cap = ring > 0 ? ring : LEX_TKS_INIT_CAPACITY;
+    *ts = (TokenStream){
+        .src = txt,
+        .kind = arena_alloc(arena, cap),
+        .offset = arena_alloc(arena, sizeof(uint32_t)*cap),
+        .sym = arena_alloc(arena, sizeof(Symbol)*cap),
+        .siz = 0,
+        .cap = cap,
+        .mask = ring > 0 ? ring-1 : TS_NO_RING,
+        .symbols = intern_create(arena),
+        .line_starts = {
+            .v = arena_alloc(arena, sizeof(uint32_t)*LEX_TKS_INIT_CAPACITY),
+            .siz = 1,
             .cap = LEX_TKS_INIT_CAPACITY,
         },
-
+    };
+    ts->line_starts.v[0] = 0;
+
+    LexState* ls = arena_alloc(arena, sizeof(LexState));
+    *ls = (LexState){
+        .arena = arena,
+        .ts = ts,
+        .src = txt,
+        .end = txt + len,
+        .iptr = txt,
+        .state = ST_Start,
+        .line_start = txt,
+        .tk_start = NULL,
         .line = 1,
-        .column = 1,
-        .columns_traversed = 1,
-        .newline_column = 1,
-        
     };
-    zero_buffer(ls.tk_buf);
+    ts->lex = ls;
+    return ls;
+}
 
-    /* main code */
-    lex_head_loop(&ls, txt);
-    token_checks(&ls);
+TK_Kind lex_next(LexState* ls) {
+    TokenStream* ts = ls->ts;
+    if (ls->done)
+        return TK_End;
 
-    /* transport state into out */
-    lo->siz = ls.tks.siz;
-    lo->tks = malloc(sizeof(void*)*lo->siz);
-    for (int i = 0; i < ls.tks.siz; i++)
-        lo->tks[i] = ls.tks.v[i];
+    size_t first = ts->siz;
+    lex_head_loop(ls);
+    if (ls->done)
+        ts->lex = NULL; /* complete, nothing left to pull */
 
     /* optional printing */
 #if(DEBUG_PRINT_TOKENS == 1)
-    for (int i = 0; i < lo->siz; i++) {
-        Token* tk = lo->tks[i];
-        printf("kind: %d. value: %s. :%d:%d:\n", tk->kind, tk->value, tk->line, tk->column);
-    }
+    print_tokens(ts, first, ts->siz);
+#else
+    (void)first;
 #endif
+    return ts_kind(ts, ts->siz-1);
+}
+
+TokenStream* lex_generate(const char* txt, size_t len, Arena* arena) {
+    LexState* ls = lex_open(txt, len, arena, 0);
+    while (lex_next(ls) != TK_End);
+    return ls->ts;
+}
 
-    /* clean up memory */
-    buffer_free(ls.tk_buf);
-    free(ls.tks.v);
-    return lo;
+TK_Kind ts_kind(TokenStream* ts, size_t i) {
+    /* pull until token i exists */
+    while (i >= ts->siz && ts->lex != NULL)
+        lex_next(ts->lex);
+    if (i >= ts->siz)
+        return TK_End;
+    if (ts->siz - i > ts->cap) {
+        fprintf(stderr, "lex.c: Token %lu was already recycled.\n", (unsigned long)i);
+        exit(1);
+    }
+    return (TK_Kind)ts->kind[i & ts->mask];
 }
 
-void lex_free(LexOut* lo) {
-    for (int i = 0; i < lo->siz; i++) {
-        free(lo->tks[i]->value);
-        free(lo->tks[i]);
+int ts_line(TokenStream* ts, uint32_t offset) {
+    /* last line starting at or before offset */
+    size_t lo = 0, hi = ts->line_starts.siz;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (ts->line_starts.v[mid] <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (int)lo + 1;
+}
+
+int ts_column(TokenStream* ts, uint32_t offset) {
+    return (int)(offset - ts->line_starts.v[ts_line(ts, offset)-1]) + 1;
+}
+
+int lex_verify_words(void) {
+    int problems = 0;
+    for (size_t i = 0; i < sizeof(WORD_SPELLINGS)/sizeof(*WORD_SPELLINGS); i++) {
+        const char* word = WORD_SPELLINGS[i];
+        if (classify_word(word, (uint32_t)strlen(word)) == NULL) { /* another word took its slot, or its designator is off */
+            fprintf(stderr, "lex.c: \"%s\" is not in its own slot of the word hash.\n", word);
+            problems++;
+        }
     }
-    free(lo->tks);
-    free(lo);
+    return problems;
 }
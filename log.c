@@ -1,6 +1,6 @@
 /*
 ** Error logger.
-! loggings a lil weird rn
+** Nothing is done up front, the failing line is found and printed only when an error fires.
 */
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,102 +9,46 @@
 #include "head.h"
 
 
-static char* lines = NULL;
-static char** formatted_lines = NULL;
-static int total_lines = 1;
+static const char* source = NULL; /* not owned, lives for the whole compilation */
+static size_t source_len = 0;
+static const LineTable* line_table = NULL; /* the lexer's, can still be growing */
 static char* current_filename = NULL;
 
-static void _newline(int* counter, size_t* line_siz, int* start_line) {
-    formatted_lines[*counter] = calloc(*line_siz, 1);
-    char* formatted = formatted_lines[*counter];
-    *start_line += *line_siz;
-    int k = 0;
-    int stop_skipping_trailings = 0;
-    for (int j = (*start_line)-(*line_siz); j < (*start_line); j++) {
-        /* j is the line position, k is the formatted position */
-        switch (lines[j]) {
-            /* skip all newlines */
-            case '\n': case '\r': {
-                                      continue;
-                                  }
-            /* skip trailing whitespaces */
-            case ' ': case '\f': case '\t': case '\v': {
-                if (stop_skipping_trailings < 1 && lines[j+1] != ' ' && lines[j+1] != '\f' && lines[j+1] != '\t' && lines[j+1] != '\v') {
-                    stop_skipping_trailings = 1;
-                    continue;
-                }
-                if (stop_skipping_trailings == 0)
-                    continue;
-            }
+/* line breaks, same as the lexer */
+#define is_line_end(_chr) ((_chr) == '\n' || (_chr) == '\r')
 
-            default: {
-                if (stop_skipping_trailings == 0 && k < 1) {
-                    stop_skipping_trailings = 1;
-                }
-            }
-        }
-        formatted[k] = lines[j];
-        k++;
+/*
+** Offset of the first character of <line_num> (1 based).
+** The lexer's table has every line it went past, lines after that are searched for.
+*/
+static size_t line_start(int line_num) {
+    size_t at = 0;
+    int line = 1;
+    if (line_table != NULL && line_table->siz > 0) {
+        size_t known = line_table->siz < (size_t)line_num ? line_table->siz : (size_t)line_num;
+        at = line_table->v[known-1];
+        line = (int)known;
     }
-    *line_siz = 1;
-    (*counter)++;
+    while (line < line_num && at < source_len) {
+        if (is_line_end(source[at]))
+            line++;
+        at++;
+    }
+    return at;
 }
 
 /*
 ** API
 */
-void logger_init(char *_lines, char *filename) {
-    /* cleanup */
-    if (lines != NULL) {
-        free(lines);
-    }
-    lines = NULL;
-    if (formatted_lines != NULL) {
-        for (int i = 0; i < total_lines; i++) {
-            free(formatted_lines[i]);
-        }
-        free(formatted_lines);
-        formatted_lines = NULL;
-    }
-    total_lines = 1;
-
-    lines = strdup(_lines);
+void logger_init(const char* src, size_t len, char* filename) {
+    source = src;
+    source_len = len;
+    line_table = NULL;
     current_filename = filename;
+}
 
-    /* count the total lines */
-    char* i = lines;
-    while (*i != '\0') {
-        switch (*i) {
-            case '\n': case '\r': {
-                                      total_lines++;
-                                      break;
-                                  }
-          
-        }
-        *i++;
-    }
-
-    /* formatted lines */
-    formatted_lines = malloc(sizeof(void*)*total_lines);
-    i = lines;
-    int counter = 0;
-    int start_line = 0;
-    size_t line_siz = 1;
-
-    while (*i != '\0') {
-        switch (*i) {
-            case '\n': case '\r': {
-                                      _newline(&counter, &line_siz, &start_line);
-                                  }
-            default: {
-                         line_siz++;
-                         break;
-                     }
-        }
-        *i++;
-    }
-
-    _newline(&counter, &line_siz, &start_line);
+void logger_use_lines(const LineTable* lines) {
+    line_table = lines;
 }
 
 void logger_error(int line_num, int start, int end, const char *code, const char *type_of_err) {
@@ -119,26 +63,31 @@ void logger_error(int line_num, int start, int end, const char *code, const char
         printf("%d | ...\n", line_num-1);
     }
 
+    /* only the failing line is looked at */
+    size_t begin = line_start(line_num);
+    size_t stop = begin;
+    while (stop < source_len && !is_line_end(source[stop]))
+        stop++;
+
     VGA_CYAN();
-    printf("%d ", line_num);
+    int prefix = printf("%d ", line_num);
     VGA_RESET();
-    printf("| %s\n", formatted_lines[line_num-1]);
+    prefix += printf("| ");
+    printf("%.*s\n", (int)(stop - begin), source + begin);
 
-    /* print spaces before ^ */
-        for (int i = 0; i < start+4; i++)
+    /* print spaces before ^, tabs stay tabs so it lines up */
+    for (int i = 0; i < prefix; i++)
         printf(" ");
+    for (int i = 0; i < start; i++)
+        printf("%c", begin + i < stop && source[begin + i] == '\t' ? '\t' : ' ');
 
     VGA_MAGENTA();
     for (int i = start; i < end; i++)
         printf("^");
-    
-    char* buf = malloc(strlen(code)+15);
-    sprintf(buf, "%s", code);
-    printf(" %s\n", buf);
-    free(buf);
-    
+    printf(" %s\n", code);
+
     VGA_RESET();
-    if (line_num+1 <= total_lines) {
+    if (stop < source_len) { /* there is a next line */
         printf("%d | ...\n", line_num+1);
     }
     exit(EXIT_FAILURE);
@@ -9,7 +9,8 @@
 
 /* command strings */
 #define NO_ARGUMENTS_STRING "PyToASM: A python to assembly compiler.\nType --help for commands or --info for more information.\n"
-#define HELP_STRING         "--version (--v) -- Version string.\n--playground (--p) -- Playground mode.\n"
+#define HELP_STRING         "<file> -- Compile a file.\n--version (--v) -- Version string.\n--playground (--p) -- Playground mode.\n" \
+                            "Options, before the command:\n-o <file> -- Build an executable (x86-64 Linux).\n-S -- With -o, write assembly instead.\n-c -- With -o, write an ELF object instead.\n--emit-ir -- Print the IR.\n--explain-types -- Print the type inferred for every unannotated variable and why.\n--peep-stats -- Print the peephole rules that fired.\n--overflow=wrap|trap -- Integers that leave their type wrap (default) or end the program.\n--lex-threads=N -- Lex big sources on N threads.\n--lex-compare -- Check the parallel lexer against the sequential one.\n"
 #define PLAYGROUND_STRING   "PyToASM CLI mode.\nType RUN to run code or EXIT.\n"
 #define VERSION_STRING      "PyToASM Version %s. (C) All rights reserved.\n"
 
@@ -24,7 +25,7 @@
 ** Run any string.
 */
 static void run_string(char* STR) {
-   compile_text(STR, "CLI"); 
+   compile_text(STR, strlen(STR), "CLI"); 
 }
 
 
@@ -67,8 +68,8 @@ static void playground() {
         }
 
         /* Is a line of code. */
-        if (line_buffer->siz+inputs->cap+1 > inputs->cap) {
-            buffer_expand(inputs, inputs->cap + 128);
+        if (inputs->siz+line_buffer->siz+1 > inputs->cap) { /* only grow when needed, keeps repeated RUNs flat */
+            buffer_expand(inputs, inputs->siz+line_buffer->siz+128);
         }
         buffer_write_long(inputs, inputs->siz, line_buffer->data);
 
@@ -90,20 +91,47 @@ int main(int argc, char** argv) {
         printf_esc(NO_ARGUMENTS_STRING);
     }
 
-    /* There is a parameter. */
-    const char* cmd = argv[1];
-
-    if (strcmp(cmd, "--help") == 0) {
-        printf_esc(HELP_STRING);
-    }
-    if (strcmp(cmd, "--playground") == 0 || strcmp(cmd, "--p") == 0) {
-        playground();
-    }
-    if (strcmp(cmd, "--version") == 0 || strcmp(cmd, "--v") == 0) {
-        printf_esc(VERSION_STRING, "unknown");
+    /* Options come first, the command (a file or one of the -- ones) ends the line. */
+    for (int arg = 1; arg < argc; arg++) {
+        const char* opt = argv[arg];
+        if (strcmp(opt, "-o") == 0) {
+            if (++arg >= argc) {
+                fprintf(stderr, "Missing file after -o.");
+                return 1;
+            }
+            compile_options.output = argv[arg];
+        } else if (strcmp(opt, "-S") == 0) {
+            compile_options.emit_asm = 1;
+        } else if (strcmp(opt, "-c") == 0) {
+            compile_options.emit_object = 1;
+        } else if (strcmp(opt, "--emit-ir") == 0) {
+            compile_options.emit_ir = 1;
+        } else if (strcmp(opt, "--explain-types") == 0) {
+            compile_options.explain_types = 1;
+        } else if (strcmp(opt, "--peep-stats") == 0) {
+            compile_options.peep_stats = 1;
+        } else if (strcmp(opt, "--overflow=wrap") == 0 || strcmp(opt, "--overflow=trap") == 0) {
+            compile_options.overflow_trap = opt[11] == 't';
+        } else if (strncmp(opt, "--lex-threads=", 14) == 0) {
+            compile_options.lex_threads = atoi(opt + 14);
+        } else if (strcmp(opt, "--lex-compare") == 0) {
+            compile_options.lex_compare = 1;
+
+        /* commands */
+        } else if (strcmp(opt, "--help") == 0) {
+            printf_esc(HELP_STRING);
+        } else if (strcmp(opt, "--playground") == 0 || strcmp(opt, "--p") == 0) {
+            playground();
+        } else if (strcmp(opt, "--version") == 0 || strcmp(opt, "--v") == 0) {
+            printf_esc(VERSION_STRING, "unknown");
+        } else if (opt[0] != '-') { /* anything else that is not an option is a file */
+            return compile_file(argv[arg]);
+        } else {
+            fprintf(stderr, "Invalid option %s.", opt);
+            return 1;
+        }
     }
 
-    /* Invalid command. */
-    fprintf(stderr, "Invalid command %s.", cmd);
-    return 1;
+    /* Only options. */
+    printf_esc(NO_ARGUMENTS_STRING);
 }
@@ -8,122 +8,187 @@
 #include "head.h"
 
 /* config */
-#define AST_INIT_CAPACITY       4
-#define AST_REALLOC_CAPACITY    4
-#define DEBUG_PRINT_NODES       1
+#define AST_INIT_CAPACITY       64
+#define AST_GROWTH              2 /* capacity multiplier, arena memory can't be reused in place */
+#define PARSE_VARS_INIT_CAPACITY 64 /* variable hash slots, power of 2 */
+#define PARSE_EXPR_INIT_CAPACITY 16 /* expression stacks */
+#ifndef DEBUG_PRINT_NODES
+#define DEBUG_PRINT_NODES       0 /* 1 dumps the tree to stderr */
+#endif
 /*}==================================*/
 
-/*
-** Creates/allocates a node with no parent.
-*/
-static Node* create_node(ND_Kind kind, Token* tk) {
-    Node* nd = malloc(sizeof(Node));
-    nd->kind = kind;
-    nd->value = strdup(tk->value);
-    nd->line = tk->line;
-    nd->column = tk->column;
-    nd->columns_traversed = tk->columns_traversed;
-    nd->prev = NULL;
-    nd->next.siz = 0;
-    nd->next.cap = 4;
-    nd->next.refs = malloc(sizeof(void*)*4);
-    return nd;
-}
-
+/* the node behind an index, only valid until the next create_node */
+#define node_at(_ps, _id) (&(_ps)->nodes.v[_id])
 
 /*
-** Puts a node into ps->nodes.ptrs.
-** Also reallocates if needed.
+** Creates a node with no parent, from the token under the cursor.
+** Nodes and their links grow together, so indices stay valid where pointers would not.
 */
-static void put_node_into_ps(ParseState* ps, Node* nd) {
+static NodeId create_node(ParseState* ps, ND_Kind kind) {
     if (ps->nodes.siz + 1 > ps->nodes.cap) {
-        ps->nodes.cap += AST_REALLOC_CAPACITY;
-        ps->nodes.ptrs = realloc(ps->nodes.ptrs, sizeof(void*)*ps->nodes.cap);
+        ps->nodes.v = arena_realloc(ps->arena, ps->nodes.v, sizeof(Node)*ps->nodes.cap, sizeof(Node)*ps->nodes.cap*AST_GROWTH);
+        ps->nodes.links = arena_realloc(ps->arena, ps->nodes.links, sizeof(NodeLinks)*ps->nodes.cap, sizeof(NodeLinks)*ps->nodes.cap*AST_GROWTH);
+        ps->nodes.cap *= AST_GROWTH;
     }
 
-    ps->nodes.ptrs[ps->nodes.siz] = nd;
-    ps->nodes.siz++;
+    NodeId id = (NodeId)ps->nodes.siz++;
+    ps->nodes.v[id] = (Node){
+        .kind = kind,
+        .value = ts_sym(ps->ts, ps->cursor),
+        .offset = ts_offset(ps->ts, ps->cursor),
+        .parent = NODE_NONE,
+        .first = 0,
+        .count = 0,
+    };
+    ps->nodes.links[id] = (NodeLinks){NODE_NONE, NODE_NONE, NODE_NONE};
+    return id;
 }
 
 /*
-** Puts the <child> into <parent>->next.refs and reallocates if necessary.
-** <child>->prev is overriden to <parent>.
+** Appends <child> to the children of <parent>.
+** <child>'s parent is overriden to <parent>.
 */
-static void set_node_parent(Node* parent, Node* child) {
-    if (parent->next.siz + 1 > parent->next.cap) {
-        parent->next.cap += 2;
-        parent->next.refs = realloc(parent->next.refs, sizeof(void*)*parent->next.cap);
-    }
-
-    parent->next.refs[parent->next.siz] = child;
-    parent->next.siz++;
-
-    child->prev = parent;
+static void set_node_parent(ParseState* ps, NodeId parent, NodeId child) {
+    NodeLinks* links = &ps->nodes.links[parent];
+    if (links->last == NODE_NONE)
+        links->first = child;
+    else
+        ps->nodes.links[links->last].next = child;
+    links->last = child;
+
+    node_at(ps, parent)->count++;
+    node_at(ps, child)->parent = parent;
 }
 
 /*
-** Manually set a nodes value (strdup's <val> too).
+** Manually set a nodes value.
 */
-static void set_node_value(Node* nd, char* val) {
-    free(nd->value);
-    nd->value = strdup(val);
+static void set_node_value(ParseState* ps, NodeId nd, Symbol val) {
+    node_at(ps, nd)->value = val;
 }
 
-/* combines put_node_into_ps and set_node_parent */
-#define autoset_node_parent(_nd) put_node_into_ps(ps, _nd); set_node_parent(ps->current_node, _nd)
-
-
+/* parents the node to ps->current_node */
+#define autoset_node_parent(_nd) set_node_parent(ps, ps->current_node, _nd)
 
 /*
-** Is the given variable name in the variable tray?
+** Lays the finished tree out in preorder, child lists become ranges of one edge array.
+** Nodes that never got a parent are left out.
 */
-static int is_var_in_var_tray(ParseState* ps, char* name) {
-    for (int i = 0; i < ps->vars_allowed_in_scope.siz; i++)
-        if (strcmp(ps->vars_allowed_in_scope.v[i]->name, name) == 0)
-            return 1;
-    return 0;
+static void flatten_tree(ParseState* ps, AbstractSyntaxTree* ast) {
+    NodeId* new_id = arena_alloc(ps->arena, sizeof(NodeId)*ps->nodes.siz);
+    NodeId* order = arena_alloc(ps->arena, sizeof(NodeId)*ps->nodes.siz); /* old index of every new one */
+    NodeId* stack = arena_alloc(ps->arena, sizeof(NodeId)*ps->nodes.siz);
+    size_t sp = 0;
+
+    ast->siz = 0;
+    stack[sp++] = ps->root;
+    while (sp > 0) {
+        NodeId old = stack[--sp];
+        new_id[old] = (NodeId)ast->siz;
+        order[ast->siz++] = old;
+
+        /* children go on reversed, so the first one comes off next */
+        size_t base = sp;
+        for (NodeId c = ps->nodes.links[old].first; c != NODE_NONE; c = ps->nodes.links[c].next)
+            stack[sp++] = c;
+        for (size_t lo = base, hi = sp; hi - lo > 1; lo++, hi--) {
+            NodeId tmp = stack[lo];
+            stack[lo] = stack[hi-1];
+            stack[hi-1] = tmp;
+        }
+    }
+
+    ast->nodes = arena_alloc(ps->arena, sizeof(Node)*ast->siz);
+    ast->edges = arena_alloc(ps->arena, sizeof(NodeId)*ast->siz);
+    ast->edges_siz = 0;
+    for (size_t i = 0; i < ast->siz; i++) {
+        const Node* from = node_at(ps, order[i]);
+        ast->nodes[i] = (Node){
+            .kind = from->kind,
+            .value = from->value,
+            .offset = from->offset,
+            .parent = from->parent == NODE_NONE ? NODE_NONE : new_id[from->parent],
+            .first = (uint32_t)ast->edges_siz,
+            .count = from->count,
+        };
+        for (NodeId c = ps->nodes.links[order[i]].first; c != NODE_NONE; c = ps->nodes.links[c].next)
+            ast->edges[ast->edges_siz++] = new_id[c];
+    }
 }
 
+/* error at the token under the cursor */
+#define parse_error(_ps, _code) logger_parse_error(ts_line((_ps)->ts, ts_offset((_ps)->ts, (_ps)->cursor)), ts_column((_ps)->ts, ts_offset((_ps)->ts, (_ps)->cursor))-1, _code)
+
 /*
-** Inserts a variable name into the variable tray, and reallocates if necessary.
-** Also throws an error if a variable is already in it.
+** Variables.
+** One hash over every visible name, declarations shadow the outer binding of the same name and
+** are undone when their scope is killed, so lookups stay O(1) however many globals there are.
 */
-static void insert_var_into_tray(ParseState* ps, char* name, Node* nd) {
-    if (is_var_in_var_tray(ps, name)) {
-        logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Variable defined twice.");
-    }
+#define var_hash(_name) ((_name) * 2654435761u) /* symbols are dense, spread them (Fibonacci hashing) */
 
-    if (ps->vars_allowed_in_scope.siz + 1 > ps->vars_allowed_in_scope.cap) {
-        ps->vars_allowed_in_scope.cap += 2;
-        ps->vars_allowed_in_scope.v = realloc(ps->vars_allowed_in_scope.v, sizeof(void*)*ps->vars_allowed_in_scope.cap);
+/*
+** Slot of <name>, or the free slot where it would go.
+*/
+static VarSlot* find_var_slot(ParseState* ps, Symbol name) {
+    size_t mask = ps->vars.cap-1;
+    for (size_t i = var_hash(name) & mask;; i = (i+1) & mask) {
+        VarSlot* slot = &ps->vars.slots[i];
+        if (slot->name == name || slot->name == SYM_Empty)
+            return slot;
     }
+}
 
-
-    ps->vars_allowed_in_scope.v[ps->vars_allowed_in_scope.siz] = malloc(sizeof(ParseVariable));
-    ps->vars_allowed_in_scope.v[ps->vars_allowed_in_scope.siz]->name = strdup(name);
-    ps->vars_allowed_in_scope.v[ps->vars_allowed_in_scope.siz]->node = nd;
-    ps->vars_allowed_in_scope.siz++;
+static void place_var_slot(void* table, const void* slot) {
+    const VarSlot* s = slot;
+    if (s->name != SYM_Empty)
+        *find_var_slot(table, s->name) = *s;
 }
 
+/*
+** Is the given variable name visible in this scope?
+*/
+static int is_var_visible(ParseState* ps, Symbol name) {
+    return find_var_slot(ps, name)->var != NULL;
+}
 
 /*
-** Deletes and deallocates the given variable from the var tray.
+** Declares a variable in the top most scope.
+** Also throws an error if it is already visible.
 */
-static void wipe_var_from_var_tray(ParseState* ps, size_t location) {
-    free(ps->vars_allowed_in_scope.v[location]->name);
-    free(ps->vars_allowed_in_scope.v[location]);
-    ps->vars_allowed_in_scope.v[location] = NULL;
-    ps->vars_allowed_in_scope.siz--;
+static void declare_var(ParseState* ps, Symbol name, NodeId nd) {
+    VarSlot* slot = find_var_slot(ps, name);
+    if (slot->var != NULL) {
+        parse_error(ps, "Variable defined twice.");
+    }
+    if (slot->name == SYM_Empty) { /* new name */
+        if ((ps->vars.siz + 1)*2 > ps->vars.cap) {
+            arena_grow_slots(ps->arena, &ps->vars.slots, &ps->vars.cap, AST_GROWTH, sizeof(VarSlot), place_var_slot, ps);
+            slot = find_var_slot(ps, name);
+        }
+        *slot = (VarSlot){.name = name, .var = NULL};
+        ps->vars.siz++;
+    }
+
+    ParseVariable* var = arena_alloc(ps->arena, sizeof(ParseVariable));
+    *var = (ParseVariable){.name = name, .node = nd, .shadowed = slot->var};
+    slot->var = var;
+
+    if (ps->vars.declared.siz + 1 > ps->vars.declared.cap) {
+        ps->vars.declared.v = arena_realloc(ps->arena, ps->vars.declared.v, sizeof(void*)*ps->vars.declared.cap, sizeof(void*)*ps->vars.declared.cap*AST_GROWTH);
+        ps->vars.declared.cap *= AST_GROWTH;
+    }
+    ps->vars.declared.v[ps->vars.declared.siz++] = var;
 }
 
 
 /*
 ** Creates/allocates a scope.
 */
-static Scope* create_scope(ScopeKind kind, Node* nd) {
-    Scope* scp = malloc(sizeof(Scope));
+static Scope* create_scope(ParseState* ps, ScopeKind kind, NodeId nd) {
+    Scope* scp = arena_alloc(ps->arena, sizeof(Scope));
     scp->kind = kind;
     scp->node = nd;
+    scp->vars_mark = 0;
     return scp;
 }
 
@@ -133,31 +198,27 @@ static Scope* create_scope(ScopeKind kind, Node* nd) {
 */
 static void put_scope_into_ps(ParseState* ps, Scope* scp) {
     if (ps->scopes.siz + 1 > ps->scopes.cap) {
-        ps->scopes.cap += 2;
-        ps->scopes.ptrs = realloc(ps->scopes.ptrs, sizeof(void*)*ps->scopes.cap);
+        ps->scopes.ptrs = arena_realloc(ps->arena, ps->scopes.ptrs, sizeof(void*)*ps->scopes.cap, sizeof(void*)*ps->scopes.cap*AST_GROWTH);
+        ps->scopes.cap *= AST_GROWTH;
     }
 
+    scp->vars_mark = ps->vars.declared.siz; /* everything declared from here on dies with it */
     ps->scopes.ptrs[ps->scopes.siz] = scp;
     ps->scopes.siz++;
 }
 
 /*
-** Removes and frees the scope.
+** Kills the top most scope, its variables stop being visible (memory goes with the arena).
 */
-static void kill_scope(ParseState* ps, size_t location) {
-    /* wipe variables in the scope from the tray */
-    for (int i = 0; i < ps->vars_allowed_in_scope.siz; i++) {
-        if (ps->vars_allowed_in_scope.v[i]->node == ps->scopes.ptrs[location]->node) {
-            wipe_var_from_var_tray(ps, i);
-        }
+static void kill_this_scope(ParseState* ps) {
+    Scope* scp = ps->scopes.ptrs[ps->scopes.siz-1];
+    while (ps->vars.declared.siz > scp->vars_mark) {
+        ParseVariable* var = ps->vars.declared.v[--ps->vars.declared.siz];
+        find_var_slot(ps, var->name)->var = var->shadowed;
     }
-    free(ps->scopes.ptrs[location]);
-    ps->scopes.ptrs[location] = NULL;
+    ps->scopes.ptrs[ps->scopes.siz-1] = NULL;
     ps->scopes.siz--;
 }
-
-/* Kills the top most scope. */
-#define kill_this_scope(_ps) kill_scope(_ps, _ps->scopes.siz-1)
 /* Access the second top scope. */
 #define second_this_scope(_ps) _ps->scopes.ptrs[_ps->scopes.siz-2]
 /* Access the top most scope. */
@@ -165,6 +226,22 @@ static void kill_scope(ParseState* ps, size_t location) {
 /* Jump the ps->current_node back to this scope */
 #define jump_back_to_this_scope(_ps) _ps->current_node = this_scope(_ps)->node
 
+/*
+** Is <name> a type parameter of a def being parsed? Their lists are the first child of the def.
+*/
+static int is_type_param(ParseState* ps, Symbol name) {
+    for (size_t i = 0; i < ps->scopes.siz; i++) {
+        const NodeId def = ps->scopes.ptrs[i]->node;
+        const NodeId list = ps->nodes.links[def].first;
+        if (node_at(ps, def)->kind != ND_FunctionDefStatement || list == NODE_NONE || node_at(ps, list)->kind != ND_TypeParameterListExpression)
+            continue;
+        for (NodeId c = ps->nodes.links[list].first; c != NODE_NONE; c = ps->nodes.links[c].next)
+            if (node_at(ps, c)->value == name)
+                return 1;
+    }
+    return 0;
+}
+
 /* sets ps->current_expression and ps->current_statement to normal */
 static void erase_tmp_state(ParseState* ps) {
     ps->current_statement = ND_Unknown;
@@ -175,27 +252,242 @@ static void erase_tmp_state(ParseState* ps) {
 /*}=========================================================================================*/
 //* real code starts here
 
-/* Advance ps->current_token towards the next in line. */
-#define token_advance(_ps) _ps->current_token = _ps->current_token->next
+/* Is the token after the cursor on the cursor's line? Only valid once peeked. */
+#define on_same_line(_ps) (ts_line((_ps)->ts, ts_offset((_ps)->ts, (_ps)->cursor+1)) == ts_line((_ps)->ts, ts_offset((_ps)->ts, (_ps)->cursor)))
+/* Advance ps->cursor towards the next in line. */
+#define token_advance(_ps) _ps->cursor++
+/* Kind of the token <_n> away from the cursor (TK_End past either end). */
+#define peek(_ps, _n) ((int64_t)(_ps)->cursor + (int64_t)(_n) < 0 ? TK_End : ts_kind((_ps)->ts, (_ps)->cursor + (_n)))
+
+/* a builtin type or a type parameter <_n> away from the cursor */
+#define is_type_at(_ps, _n) (peek(_ps, _n) == TK_Type || (peek(_ps, _n) == TK_Identifier && is_type_param(_ps, ts_sym((_ps)->ts, (_ps)->cursor + (_n)))))
 
 /*
 ** Expressions
 */
 
+/* binding power and node of every binary operator, 0 for the tokens that can't continue an expression */
+static const struct {
+    uint8_t prec;
+    uint8_t kind; /* ND_Kind */
+} BINARY_OPS[TK_End+1] = {
+    [TK_EqualsEquals] = {1, ND_ConditionalExpression},  [TK_NotEquals] = {1, ND_ConditionalExpression},
+    [TK_Less] = {1, ND_ConditionalExpression},          [TK_Greater] = {1, ND_ConditionalExpression},
+    [TK_LessEquals] = {1, ND_ConditionalExpression},    [TK_GreaterEquals] = {1, ND_ConditionalExpression},
+    [TK_Add] = {2, ND_ArithmeticExpression},            [TK_Sub] = {2, ND_ArithmeticExpression},
+    [TK_Mul] = {3, ND_ArithmeticExpression},            [TK_Div] = {3, ND_ArithmeticExpression},
+    [TK_Mod] = {3, ND_ArithmeticExpression},
+};
+#define PREC_UNARY 4 /* - and + in front of an operand */
+
+static void push_expr_op(ParseState* ps, ExprOpKind kind, uint8_t prec, NodeId nd) {
+    if (ps->expr.ops.siz + 1 > ps->expr.ops.cap) {
+        ps->expr.ops.v = arena_realloc(ps->arena, ps->expr.ops.v, sizeof(ExprOp)*ps->expr.ops.cap, sizeof(ExprOp)*ps->expr.ops.cap*AST_GROWTH);
+        ps->expr.ops.cap *= AST_GROWTH;
+    }
+    ps->expr.ops.v[ps->expr.ops.siz++] = (ExprOp){.kind = kind, .prec = prec, .node = nd};
+}
+
+static void push_operand(ParseState* ps, NodeId nd) {
+    if (ps->expr.operands.siz + 1 > ps->expr.operands.cap) {
+        ps->expr.operands.v = arena_realloc(ps->arena, ps->expr.operands.v, sizeof(NodeId)*ps->expr.operands.cap, sizeof(NodeId)*ps->expr.operands.cap*AST_GROWTH);
+        ps->expr.operands.cap *= AST_GROWTH;
+    }
+    ps->expr.operands.v[ps->expr.operands.siz++] = nd;
+}
+#define pop_operand(_ps) (_ps)->expr.operands.v[--(_ps)->expr.operands.siz]
+/* the innermost pending operator or bracket, NULL if none */
+#define top_expr_op(_ps) ((_ps)->expr.ops.siz > 0 ? &(_ps)->expr.ops.v[(_ps)->expr.ops.siz-1] : NULL)
+
+/*
+** Applies the pending operators binding at least as tight as <prec>, stops at a bracket.
+*/
+static void reduce_expr(ParseState* ps, uint8_t prec) {
+    ExprOp* op;
+    while ((op = top_expr_op(ps)) != NULL && op->prec >= prec && op->prec > 0) {
+        NodeId rhs = pop_operand(ps);
+        if (op->kind == ExprBinary)
+            set_node_parent(ps, op->node, pop_operand(ps));
+        set_node_parent(ps, op->node, rhs);
+        push_operand(ps, op->node);
+        ps->expr.ops.siz--;
+    }
+}
+
+/*
+** <T, U> of a generic def, or <i32, T> of a call to one when <types> is set.
+** Starts with the cursor before the <, ends on the >. Returns the parentless list.
+*/
+static NodeId type_list(ParseState* ps, ND_Kind kind, int types) {
+    token_advance(ps);
+    NodeId list = create_node(ps, kind);
+    set_node_value(ps, list, SYM_Empty);
+    do {
+        token_advance(ps);
+        if (types ? !is_type_at(ps, 0) : peek(ps, 0) != TK_Identifier)
+            parse_error(ps, types ? "Invalid type." : "Invalid type parameter.");
+        for (NodeId c = ps->nodes.links[list].first; !types && c != NODE_NONE; c = ps->nodes.links[c].next)
+            if (node_at(ps, c)->value == ts_sym(ps->ts, ps->cursor))
+                parse_error(ps, "Type parameter defined twice.");
+        set_node_parent(ps, list, create_node(ps, types ? ND_TypeResolveExpression : ND_IdentifierExpression));
+        token_advance(ps);
+    } while (peek(ps, 0) == TK_Comma);
+    if (peek(ps, 0) != TK_Greater)
+        parse_error(ps, "Invalid type list (No >).");
+    if (peek(ps, 1) != TK_OpenParenthesis)
+        parse_error(ps, types ? "Invalid call (No arguments)." : "Invalid function definition (No arguments).");
+    return list;
+}
+#define TypeParameterListExpression(_ps) type_list(_ps, ND_TypeParameterListExpression, 0)
+#define TypeArgumentListExpression(_ps) type_list(_ps, ND_TypeArgumentListExpression, 1)
+
+/*
+** Operand under the cursor.
+** 1 once an operand is on the stack (cursor on its last token), 0 after a prefix operator or an
+** opening bracket, another operand follows those.
+*/
+static int expr_operand(ParseState* ps) {
+    switch (peek(ps, 0)) {
+        case TK_Add: case TK_Sub: {
+            push_expr_op(ps, ExprUnary, PREC_UNARY, create_node(ps, ND_ArithmeticExpression));
+            return 0;
+        }
+        case TK_OpenParenthesis: {
+            push_expr_op(ps, ExprParen, 0, NODE_NONE);
+            return 0;
+        }
+        case TK_Identifier: {
+            /* f<i32>(...), a < can't be followed by a type otherwise */
+            const int generic = peek(ps, 1) == TK_Less && is_type_at(ps, 2);
+            if (peek(ps, 1) != TK_OpenParenthesis && !generic) {
+                push_operand(ps, create_node(ps, ND_IdentifierExpression));
+                return 1;
+            }
+            /* call, the arguments go under an argument list */
+            NodeId call = create_node(ps, ND_CallExpressionStatement);
+            NodeId types = generic ? TypeArgumentListExpression(ps) : NODE_NONE;
+            token_advance(ps);
+            NodeId args = create_node(ps, ND_ArgumentListExpression);
+            set_node_value(ps, args, SYM_Empty);
+            set_node_parent(ps, call, args);
+            if (types != NODE_NONE)
+                set_node_parent(ps, call, types);
+            if (peek(ps, 1) == TK_CloseParenthesis) {
+                token_advance(ps);
+                push_operand(ps, call);
+                return 1;
+            }
+            push_expr_op(ps, ExprCall, 0, args);
+            return 0;
+        }
+        case TK_Quote: {
+            /* the string is between the quotes, peek pulls it from the lexer */
+            if (peek(ps, 1) != TK_String)
+                parse_error(ps, "Invalid expression.");
+            token_advance(ps);
+        } /* fallthrough */
+        case TK_String: {
+            push_operand(ps, create_node(ps, ND_StringLiteral));
+            if (peek(ps, 1) == TK_Quote)
+                token_advance(ps);
+            return 1;
+        }
+        case TK_Type: {
+            if (ts_sym(ps->ts, ps->cursor) != SYM_string || peek(ps, 1) != TK_OpenParenthesis)
+                parse_error(ps, "Invalid expression.");
+            /* string(x), the value goes under the cast */
+            NodeId cast = create_node(ps, ND_StringCastExpression);
+            token_advance(ps);
+            push_expr_op(ps, ExprCast, 0, cast);
+            return 0;
+        }
+        case TK_Numeric: push_operand(ps, create_node(ps, ND_NumberLiteral)); return 1;
+        case TK_Boolean: push_operand(ps, create_node(ps, ND_BooleanLiteral)); return 1;
+
+        default: {
+            parse_error(ps, "Invalid expression.");
+            return 0;
+        }
+    }
+}
+
+/*
+** After an operand, takes the closing brackets and the operator or comma that follows.
+** 1 when another operand follows (cursor on it), 0 at the end of the expression.
+*/
+static int expr_operator(ParseState* ps) {
+    for (;;) {
+        const TK_Kind next = peek(ps, 1);
+        if (BINARY_OPS[next].prec > 0) {
+            reduce_expr(ps, BINARY_OPS[next].prec); /* left associative */
+            token_advance(ps);
+            push_expr_op(ps, ExprBinary, BINARY_OPS[next].prec, create_node(ps, BINARY_OPS[next].kind));
+            token_advance(ps);
+            return 1;
+        }
+
+        reduce_expr(ps, 1);
+        ExprOp* bracket = top_expr_op(ps);
+        if (bracket == NULL)
+            return 0;
+
+        if (next == TK_Comma && bracket->kind == ExprCall) {
+            set_node_parent(ps, bracket->node, pop_operand(ps));
+            token_advance(ps);
+            token_advance(ps);
+            return 1;
+        }
+        if (next != TK_CloseParenthesis)
+            return 0;
+
+        token_advance(ps);
+        if (bracket->kind == ExprCall) {
+            set_node_parent(ps, bracket->node, pop_operand(ps));
+            push_operand(ps, node_at(ps, bracket->node)->parent);
+        } else if (bracket->kind == ExprCast) {
+            set_node_parent(ps, bracket->node, pop_operand(ps));
+            push_operand(ps, bracket->node);
+        }
+        ps->expr.ops.siz--;
+    }
+}
+
+/*
+** Parses the expression starting under the cursor, the cursor ends on its last token.
+** Precedence climbing over the explicit stacks of ps->expr, every token is looked at once.
+** Comparisons chain left to right like the arithmetic ((a < b) < c).
+** Returns the parentless root of the expression.
+*/
+static NodeId Expression(ParseState* ps) {
+    ps->expr.ops.siz = 0;
+    ps->expr.operands.siz = 0;
+
+    do {
+        while (!expr_operand(ps))
+            token_advance(ps);
+    } while (expr_operator(ps));
+
+    if (ps->expr.ops.siz > 0) { /* unclosed bracket, blame what came instead of the ) */
+        token_advance(ps);
+        parse_error(ps, "Invalid expression.");
+    }
+    return ps->expr.operands.v[0];
+}
+
 static void ArgumentListExpression(ParseState* ps) {
-    Node* child = create_node(ND_ArgumentListExpression, ps->current_token);
-    set_node_value(child, "");
+    NodeId child = create_node(ps, ND_ArgumentListExpression);
+    set_node_value(ps, child, SYM_Empty);
     autoset_node_parent(child);
     ps->current_node = child;
 
     /* create a scope */
-    Scope* scp = create_scope(ScopeTemporaryExpr, child);
+    Scope* scp = create_scope(ps, ScopeTemporaryExpr, child);
     put_scope_into_ps(ps, scp);
     ps->current_expression = ND_ArgumentListExpression;
 }
 
 static void TypeResolveExpression(ParseState* ps) {
-    Node* child = create_node(ND_TypeResolveExpression, ps->current_token);
+    NodeId child = create_node(ps, ND_TypeResolveExpression);
     autoset_node_parent(child);
     jump_back_to_this_scope(ps);
     ps->current_node = child;
@@ -203,17 +495,17 @@ static void TypeResolveExpression(ParseState* ps) {
 }
 
 static void ExplicitArgumentExpression(ParseState* ps) {
-    Node* child = create_node(ND_ExplicitArgumentExpression, ps->current_token);
+    NodeId child = create_node(ps, ND_ExplicitArgumentExpression);
     autoset_node_parent(child);
     ps->current_node = child;
 
     /* error checks */
-    if (ps->current_token->next == NULL || ps->current_token->next->kind != TK_Colon) {
-        logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid argument definition (No colon).");
+    if (peek(ps, 1) != TK_Colon) {
+        parse_error(ps, "Invalid argument definition (No colon).");
     }
     token_advance(ps); // go to colon
-    if (ps->current_token->next == NULL || ps->current_token->next->kind != TK_Type) { /* same scheise */
-        logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid argument definition (No type).");
+    if (!is_type_at(ps, 1)) { /* same scheise */
+        parse_error(ps, "Invalid argument definition (No type).");
     }
     token_advance(ps); // go to actual type
 
@@ -226,7 +518,7 @@ static void EqualsExpression(ParseState* ps) {
 }
 
 static void VarSeperationExpression(ParseState* ps) {
-    Node* child = create_node(ND_VarSeperationExpression, ps->current_token);
+    NodeId child = create_node(ps, ND_VarSeperationExpression);
     autoset_node_parent(child);
     ps->current_node = child;
     ps->current_expression = ND_VarSeperationExpression;
@@ -238,48 +530,114 @@ static void VarSeperationExpression(ParseState* ps) {
 
 static void VarDeclStatement(ParseState* ps) {
     /* VarReassignStatement is decided here, no func for it */
-    const int is_cur_node_in_var_tray = is_var_in_var_tray(ps, ps->current_node->value);
-    ps->current_node->kind = is_cur_node_in_var_tray ? ND_VarReassignStatement : ND_VarDeclStatement;
-    ps->current_statement = is_cur_node_in_var_tray ? ND_VarReassignStatement : ND_VarDeclStatement;
+    Node* cur = node_at(ps, ps->current_node);
+    const int is_cur_node_visible = is_var_visible(ps, cur->value);
+    cur->kind = is_cur_node_visible ? ND_VarReassignStatement : ND_VarDeclStatement;
+    ps->current_statement = is_cur_node_visible ? ND_VarReassignStatement : ND_VarDeclStatement;
 
     /* var seperation support */
-    if (ps->current_node->prev != NULL && ps->current_node->prev->kind == ND_VarSeperationExpression) {
-        Node* prev = ps->current_node->prev;
+    if (cur->parent != NODE_NONE && node_at(ps, cur->parent)->kind == ND_VarSeperationExpression) {
+        Node* prev = node_at(ps, cur->parent);
         while (prev->kind == ND_VarSeperationExpression || prev->kind == ND_IdentifierExpression) {
             if (prev->kind == ND_IdentifierExpression) {
-                const int is_prev_in_var_tray = is_var_in_var_tray(ps, prev->value);
-                prev->kind = is_prev_in_var_tray ? ND_VarReassignStatement : ND_VarDeclStatement;
+                const int is_prev_visible = is_var_visible(ps, prev->value);
+                prev->kind = is_prev_visible ? ND_VarReassignStatement : ND_VarDeclStatement;
             }
-            prev = prev->prev;
+            prev = node_at(ps, prev->parent);
         }
     }
 
-    if (is_cur_node_in_var_tray < 1) /* oopsies cant define twice */
-        insert_var_into_tray(ps, ps->current_node->value, ps->current_node);
+    if (is_cur_node_visible < 1) /* oopsies cant define twice */
+        declare_var(ps, cur->value, ps->current_node);
     EqualsExpression(ps);
 }
 
 static void FunctionDefStatement(ParseState* ps) {
     if (ps->current_expression != ND_Unknown) {
-        logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid expression.");
+        parse_error(ps, "Invalid expression.");
     }
     if (ps->current_statement != ND_Unknown) {
-        logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid statement.");
+        parse_error(ps, "Invalid statement.");
     }
 
     ps->current_statement = ND_FunctionDefStatement;
 
     // build node
-    Node* child = create_node(ND_FunctionDefStatement, ps->current_token);
-    set_node_value(child, ps->current_token->next->value);
+    NodeId child = create_node(ps, ND_FunctionDefStatement);
+    if (peek(ps, 1) != TK_Identifier)
+        parse_error(ps, "Invalid function name.");
+    set_node_value(ps, child, ts_sym(ps->ts, ps->cursor+1));
     autoset_node_parent(child);
     ps->current_node = child;
 
     // build scope
-    Scope* scp = create_scope(ScopeClause, child);
+    Scope* scp = create_scope(ps, ScopeClause, child);
     put_scope_into_ps(ps, scp);
 
     token_advance(ps); /* function name would be IdentifierExpression without this */
+    if (peek(ps, 1) == TK_Less) /* generic, the type parameters come before the arguments */
+        set_node_parent(ps, child, TypeParameterListExpression(ps));
+}
+
+static void ExpressionStatement(ParseState* ps) {
+    NodeId expr = Expression(ps);
+    autoset_node_parent(expr);
+    erase_tmp_state(ps);
+}
+
+static void ReturnStatement(ParseState* ps) {
+    int in_function = 0;
+    for (size_t i = 0; i < ps->scopes.siz; i++)
+        in_function |= node_at(ps, ps->scopes.ptrs[i]->node)->kind == ND_FunctionDefStatement;
+    if (!in_function)
+        parse_error(ps, "Return outside of a function.");
+
+    NodeId child = create_node(ps, ND_ReturnStatement);
+    set_node_value(ps, child, SYM_Empty);
+    autoset_node_parent(child);
+
+    /* the value is optional, it is whatever follows on the same line */
+    if (peek(ps, 1) != TK_End && on_same_line(ps)) {
+        token_advance(ps);
+        set_node_parent(ps, child, Expression(ps));
+    }
+    erase_tmp_state(ps);
+}
+
+static void IfStatement(ParseState* ps) {
+    NodeId child = create_node(ps, ND_IfStatement);
+    set_node_value(ps, child, SYM_Empty);
+    autoset_node_parent(child);
+
+    /* the condition is the first child, the body comes after it */
+    token_advance(ps);
+    set_node_parent(ps, child, Expression(ps));
+    token_advance(ps);
+    if (peek(ps, 0) != TK_Colon)
+        parse_error(ps, "Invalid if statement (No colon).");
+
+    ps->current_node = child;
+    Scope* scp = create_scope(ps, ScopeClause, child);
+    put_scope_into_ps(ps, scp);
+    erase_tmp_state(ps);
+}
+
+static void PassStatement(ParseState* ps) {
+    NodeId child = create_node(ps, ND_PassStatement);
+    set_node_value(ps, child, SYM_Empty);
+    autoset_node_parent(child);
+}
+
+/* these only start a statement, not continue one */
+#define statement_start_check(_ps) if ((_ps)->current_node != this_scope(_ps)->node) parse_error(_ps, "Invalid statement.")
+
+/* end closes the innermost def or if */
+static void EndStatement(ParseState* ps) {
+    if (ps->scopes.siz < 2)
+        parse_error(ps, "Nothing to end.");
+    kill_this_scope(ps);
+    jump_back_to_this_scope(ps);
+    erase_tmp_state(ps);
 }
 
 /*}==================================*/
@@ -287,10 +645,7 @@ static void FunctionDefStatement(ParseState* ps) {
 
 /* TK_Identifier */
 static void identifier_handler(ParseState* ps) {
-    int jump_back_to_this_scope_after = 0;
-    int erase_tmp_state_after = 0;
-
-    switch (ps->current_node->kind) {
+    switch (node_at(ps, ps->current_node)->kind) {
         /*
         ** FYI if the case doesn't have a return;, it'll do the default case below
         */
@@ -312,54 +667,40 @@ static void identifier_handler(ParseState* ps) {
             return;
         }
 
-        case ND_EqualsExpression: {
-
-            switch (ps->current_statement) { /* background check the statement */
-                case ND_VarReassignStatement: case ND_VarDeclStatement: {
-                    /* = this, go back to scope */
-                    jump_back_to_this_scope_after = 1;
-                    erase_tmp_state_after = 1;
-                    break;
-                }
-
-                default: {
-                    //! later
-                    break;
-                }
-            }
-            break;
-        }
-
         default: break;
     }
 
+    /* a call or an operator right after the statement starts, the whole line is one expression */
+    if (ps->current_node == this_scope(ps)->node && (peek(ps, 1) == TK_OpenParenthesis || BINARY_OPS[peek(ps, 1)].prec > 0)) {
+        ExpressionStatement(ps);
+        return;
+    }
+
     /* default case */
-    Node* child = create_node(ND_IdentifierExpression, ps->current_token);
+    NodeId child = create_node(ps, ND_IdentifierExpression);
     autoset_node_parent(child);
     ps->current_node = child;
     ps->current_expression = ND_IdentifierExpression;
-
-    if (jump_back_to_this_scope_after)
-        jump_back_to_this_scope(ps);
-    if (erase_tmp_state_after)
-        erase_tmp_state(ps);
 }
 
 
 /* TK_keyword */
 static void keyword_handler(ParseState* ps) {
-    
-    if (strcmp(ps->current_token->value, "def") == 0) {
-        FunctionDefStatement(ps);
+    switch (ts_sym(ps->ts, ps->cursor)) {
+        case SYM_def: FunctionDefStatement(ps); break;
+        case SYM_return: statement_start_check(ps); ReturnStatement(ps); break;
+        case SYM_if: statement_start_check(ps); IfStatement(ps); break;
+        case SYM_pass: statement_start_check(ps); PassStatement(ps); break;
+        case SYM_end: statement_start_check(ps); EndStatement(ps); break;
+        default: break;
     }
-
 }
 
 
 /* TK_Equals */
 static void equals_handler(ParseState* ps) {
 
-    switch (ps->current_node->kind) {
+    switch (node_at(ps, ps->current_node)->kind) {
         case ND_VarSeperationExpression: case ND_IdentifierExpression: {
             VarDeclStatement(ps);
             break;
@@ -367,21 +708,24 @@ static void equals_handler(ParseState* ps) {
         
 
         default: {
-            logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid symbol.");
+            parse_error(ps, "Invalid symbol.");
             break;
         }
     }
 
-    /* equals expression */
-    Node* child = create_node(ND_EqualsExpression, ps->current_token);
+    /* equals expression, = this, then go back to scope */
+    NodeId child = create_node(ps, ND_EqualsExpression);
     autoset_node_parent(child);
-    ps->current_node = child;
+    token_advance(ps);
+    set_node_parent(ps, child, Expression(ps));
+    jump_back_to_this_scope(ps);
+    erase_tmp_state(ps);
 }
 
 /* TK_OpenParenthesis */
 static void open_parenthesis_handler(ParseState* ps) {
     
-    switch (this_scope(ps)->node->kind) {
+    switch (node_at(ps, this_scope(ps)->node)->kind) {
         case ND_FunctionDefStatement: {
             ArgumentListExpression(ps);
             break;
@@ -395,7 +739,7 @@ static void open_parenthesis_handler(ParseState* ps) {
 /* TK_CloseParenthesis */
 static void close_parenthesis_handler(ParseState* ps) {
 
-    switch (this_scope(ps)->node->kind) {
+    switch (node_at(ps, this_scope(ps)->node)->kind) {
         case ND_ArgumentListExpression: {
             /* end the argument list */
             kill_this_scope(ps);
@@ -410,7 +754,7 @@ static void close_parenthesis_handler(ParseState* ps) {
 /* TK_Comma */
 static void comma_handler(ParseState* ps) {
 
-    switch (this_scope(ps)->node->kind) {
+    switch (node_at(ps, this_scope(ps)->node)->kind) {
         case ND_ArgumentListExpression: {
             /* jump back for the next argument */
             jump_back_to_this_scope(ps);
@@ -426,35 +770,15 @@ static void comma_handler(ParseState* ps) {
             return;
         }
 
-        default: logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid symbol.");
+        default: parse_error(ps, "Invalid symbol.");
     }
 
 }
 
 /* TK_Numeric, TK_String, TK_Boolean */
 static void literal_handler(ParseState* ps) {
-    ND_Kind chosen_kind = ND_Unknown;
-    switch (ps->current_token->kind) {
-        case TK_Numeric: chosen_kind = ND_NumberLiteral; break;
-        case TK_String: chosen_kind = ND_StringLiteral; break;
-        case TK_Boolean: chosen_kind = ND_BooleanLiteral; break;
-        default: break;
-    }
-    Node* child = create_node(chosen_kind, ps->current_token);
-    autoset_node_parent(child);
-    ps->current_node = child;
-
-    switch (ps->current_expression) {
-        case ND_EqualsExpression: {
-            /* = this, go back to scope */
-            jump_back_to_this_scope(ps);
-            erase_tmp_state(ps);
-            break;
-        }
-        default: {
-            logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid expression.");
-        };
-    }
+    //* literals only appear inside expressions, which parse their own tokens
+    parse_error(ps, "Invalid expression.");
 }
 
 /* TK_Arrow */
@@ -462,25 +786,31 @@ static void arrow_handler(ParseState* ps) {
 
     switch (ps->current_statement) {
         case ND_FunctionDefStatement: {
-            if (ps->current_token->next == NULL || ps->current_token->prev->kind != TK_CloseParenthesis)
-                logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid arrow use.");
+            if (peek(ps, 1) == TK_End || peek(ps, -1) != TK_CloseParenthesis)
+                parse_error(ps, "Invalid arrow use.");
 
             token_advance(ps); // jump to type
 
-            switch (ps->current_token->kind) {
+            switch (peek(ps, 0)) {
+                case TK_Identifier: {
+                    if (!is_type_param(ps, ts_sym(ps->ts, ps->cursor)))
+                        parse_error(ps, "Invalid type.");
+                    TypeResolveExpression(ps);
+                    break;
+                }
                 case TK_Type: case TK_None: {
                     TypeResolveExpression(ps);
                     break;
                 }
                 default: {
-                    logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid type.");
+                    parse_error(ps, "Invalid type.");
                 }
             }
 
             break;
         }
 
-        default: logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid arrow use.");
+        default: parse_error(ps, "Invalid arrow use.");
     }
 
 }
@@ -494,11 +824,12 @@ static void colon_handler(ParseState* ps) {
             switch (ps->current_statement) {
                 case ND_FunctionDefStatement: {
                     /* functions require a type before the colon */
-                    if (ps->current_node->kind != ND_TypeResolveExpression)
-                        logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "No return type!");
-                }
+                    if (node_at(ps, ps->current_node)->kind != ND_TypeResolveExpression)
+                        parse_error(ps, "No return type!");
+                } /* fallthrough */
                 default: {
                     jump_back_to_this_scope(ps);
+                    erase_tmp_state(ps);
                     break;
                 }
             }
@@ -506,7 +837,7 @@ static void colon_handler(ParseState* ps) {
         }
 
         default: {
-            logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid symbol.");
+            parse_error(ps, "Invalid symbol.");
         }
     }
 }
@@ -514,7 +845,7 @@ static void colon_handler(ParseState* ps) {
 /* TK_Type */
 static void type_handler(ParseState* ps) {
     //* this is just a error checker, all other instances of types are handled elsewhere
-    logger_parse_error(ps->current_token->line, ps->current_token->columns_traversed, "Invalid expression.");
+    parse_error(ps, "Invalid expression.");
 }
 
 /* TK_None */
@@ -528,11 +859,11 @@ static void none_handler(ParseState* ps) {
 /*
 ** Main loop.
 */
-static void consume_tokens(ParseState* ps, LexOut* lo) { 
-    ps->current_token = lo->tks[0];
+static void consume_tokens(ParseState* ps) { 
+    ps->cursor = 0;
 
-     while (ps->current_token != NULL) {
-        switch (ps->current_token->kind) {
+     while (peek(ps, 0) != TK_End) {
+        switch (peek(ps, 0)) {
             /* basic */
             case TK_Identifier: identifier_handler(ps); break;
             case TK_Keyword: keyword_handler(ps); break;
@@ -553,9 +884,9 @@ static void consume_tokens(ParseState* ps, LexOut* lo) {
             /* every other token */
             default: {
                 char buf[64];
-                sprintf(buf, "consume_tokens unsupported case %d.", ps->current_token->kind);
-                logger_dev_warning(ps->current_token->line, buf);
-                Node* child = create_node(ND_IdentifierExpression, ps->current_token);
+                sprintf(buf, "consume_tokens unsupported case %d.", peek(ps, 0));
+                logger_dev_warning(ts_line(ps->ts, ts_offset(ps->ts, ps->cursor)), buf);
+                NodeId child = create_node(ps, ND_IdentifierExpression);
                 autoset_node_parent(child);
                 ps->current_node = child;
                 break;
@@ -569,116 +900,127 @@ static void consume_tokens(ParseState* ps, LexOut* lo) {
 
 
 
+#if(DEBUG_PRINT_NODES == 1)
 /*
-** Prints node.
+** Prints the tree, one forward walk since it is stored in preorder.
 */
-static void _print_node(Node* nd, int layer) {
-    for (int i = 0; i < layer; i++)
-        printf("  ");
-    /* map back kind to name */
-    char kind_name[64];
-    switch (nd->kind) {
-        case ND_FunctionDefStatement: strcpy(kind_name, "FunctionDefStatement"); break;
-        case ND_IdentifierExpression: strcpy(kind_name, "IdentifierExpression"); break;
-        case ND_NumberLiteral: strcpy(kind_name, "NumberLiteral"); break;
-        case ND_StringLiteral: strcpy(kind_name, "StringLiteral"); break;
-        case ND_BooleanLiteral: strcpy(kind_name, "BooleanLiteral"); break;
-        case ND_ArgumentListExpression: strcpy(kind_name, "ArgumentListExpression"); break;
-        case ND_ExplicitArgumentExpression: strcpy(kind_name, "ExplicitArgumentExpression"); break;
-        case ND_TypeResolveExpression: strcpy(kind_name, "TypeResolveExpression"); break;
-        case ND_VarDeclStatement: strcpy(kind_name, "VarDeclStatement"); break;
-        case ND_VarReassignStatement: strcpy(kind_name, "VarReassignStatement"); break;
-        case ND_EqualsExpression: strcpy(kind_name, "EqualsExpression"); break;
-        case ND_VarSeperationExpression: strcpy(kind_name, "VarSeperationExpression"); break;
-
-        default: strcpy(kind_name, "Undefined"); break;
-    }
-    printf("kind: %s. value: %s.\n", kind_name, nd->value);
-    for (int i = 0; i < nd->next.siz; i++)
-        _print_node(nd->next.refs[i], layer+1);
+static void print_nodes(AbstractSyntaxTree* ast, Arena* arena) {
+    uint32_t* depth = arena_alloc(arena, sizeof(uint32_t)*ast->siz);
+    for (size_t i = 0; i < ast->siz; i++) {
+        const Node* nd = &ast->nodes[i];
+        depth[i] = nd->parent == NODE_NONE ? 0 : depth[nd->parent]+1;
+        for (uint32_t j = 0; j < depth[i]; j++)
+            fprintf(stderr, "  ");
+        /* map back kind to name */
+        char kind_name[64];
+        switch (nd->kind) {
+            case ND_FunctionDefStatement: strcpy(kind_name, "FunctionDefStatement"); break;
+            case ND_IdentifierExpression: strcpy(kind_name, "IdentifierExpression"); break;
+            case ND_NumberLiteral: strcpy(kind_name, "NumberLiteral"); break;
+            case ND_StringLiteral: strcpy(kind_name, "StringLiteral"); break;
+            case ND_BooleanLiteral: strcpy(kind_name, "BooleanLiteral"); break;
+            case ND_ArgumentListExpression: strcpy(kind_name, "ArgumentListExpression"); break;
+            case ND_ExplicitArgumentExpression: strcpy(kind_name, "ExplicitArgumentExpression"); break;
+            case ND_TypeResolveExpression: strcpy(kind_name, "TypeResolveExpression"); break;
+            case ND_TypeParameterListExpression: strcpy(kind_name, "TypeParameterListExpression"); break;
+            case ND_TypeArgumentListExpression: strcpy(kind_name, "TypeArgumentListExpression"); break;
+            case ND_VarDeclStatement: strcpy(kind_name, "VarDeclStatement"); break;
+            case ND_VarReassignStatement: strcpy(kind_name, "VarReassignStatement"); break;
+            case ND_EqualsExpression: strcpy(kind_name, "EqualsExpression"); break;
+            case ND_VarSeperationExpression: strcpy(kind_name, "VarSeperationExpression"); break;
+            case ND_ArithmeticExpression: strcpy(kind_name, "ArithmeticExpression"); break;
+            case ND_ConditionalExpression: strcpy(kind_name, "ConditionalExpression"); break;
+            case ND_StringCastExpression: strcpy(kind_name, "StringCastExpression"); break;
+            case ND_CallExpressionStatement: strcpy(kind_name, "CallExpressionStatement"); break;
+            case ND_ReturnStatement: strcpy(kind_name, "ReturnStatement"); break;
+            case ND_IfStatement: strcpy(kind_name, "IfStatement"); break;
+            case ND_PassStatement: strcpy(kind_name, "PassStatement"); break;
+
+            default: strcpy(kind_name, "Undefined"); break;
+        }
+        fprintf(stderr, "kind: %s. value: %.*s.\n", kind_name, (int)symbol_len(ast->symbols, nd->value), symbol_name(ast->symbols, nd->value));
+    }
 }
+#endif
 
 /*{==================================*/
 /*
 ** API
 */
-AbstractSyntaxTree* parse_generate(LexOut* lo) {
-    AbstractSyntaxTree* ast = malloc(sizeof(AbstractSyntaxTree));
+AbstractSyntaxTree* parse_generate(TokenStream* ts, Arena* arena) {
+    AbstractSyntaxTree* ast = arena_alloc(arena, sizeof(AbstractSyntaxTree));
 
     ParseState ps = {
+        .arena = arena,
         .nodes = {
-            .ptrs = malloc(sizeof(void*)*AST_INIT_CAPACITY),
+            .v = arena_alloc(arena, sizeof(Node)*AST_INIT_CAPACITY),
+            .links = arena_alloc(arena, sizeof(NodeLinks)*AST_INIT_CAPACITY),
             .cap = AST_INIT_CAPACITY,
             .siz = 0,
         },
         .scopes = {
-            .ptrs = malloc(sizeof(void*)*4),
+            .ptrs = arena_alloc(arena, sizeof(void*)*4),
             .cap = 4,
             .siz = 0,
         },
-        .vars_allowed_in_scope = {
-            .v = malloc(sizeof(void*)*4),
-            .cap = 4,
+        .vars = {
+            .slots = arena_alloc(arena, sizeof(VarSlot)*PARSE_VARS_INIT_CAPACITY),
+            .cap = PARSE_VARS_INIT_CAPACITY,
             .siz = 0,
+            .declared = {
+                .v = arena_alloc(arena, sizeof(void*)*PARSE_VARS_INIT_CAPACITY),
+                .cap = PARSE_VARS_INIT_CAPACITY,
+                .siz = 0,
+            },
+        },
+        .expr = {
+            .ops = {
+                .v = arena_alloc(arena, sizeof(ExprOp)*PARSE_EXPR_INIT_CAPACITY),
+                .cap = PARSE_EXPR_INIT_CAPACITY,
+                .siz = 0,
+            },
+            .operands = {
+                .v = arena_alloc(arena, sizeof(NodeId)*PARSE_EXPR_INIT_CAPACITY),
+                .cap = PARSE_EXPR_INIT_CAPACITY,
+                .siz = 0,
+            },
         },
 
-        .root = NULL,
-        .current_node = NULL,
+        .root = NODE_NONE,
+        .current_node = NODE_NONE,
         .current_statement = ND_Unknown,
         .current_expression = ND_Unknown,
-        .current_token = NULL,
+        .ts = ts,
+        .cursor = 0,
     };
 
+    memset(ps.vars.slots, 0, sizeof(VarSlot)*PARSE_VARS_INIT_CAPACITY);
+
     /* create root */
-    ps.root = create_node(ND_Unknown, &(Token){.value=""});
-    put_node_into_ps(&ps, ps.root);
+    ps.root = create_node(&ps, ND_Unknown);
+    set_node_value(&ps, ps.root, SYM_Empty);
     ps.current_node = ps.root;
-    Scope* root_scp = create_scope(ScopeUndefined, ps.root); /* root is the bottom scope */
+    Scope* root_scp = create_scope(&ps, ScopeUndefined, ps.root); /* root is the bottom scope */
     put_scope_into_ps(&ps, root_scp);
 
     /* main code */
-    consume_tokens(&ps, lo);
-
+    consume_tokens(&ps);
+    if (ps.scopes.siz > 1) { /* a def or if that is never ended, at its start */
+        const Node* open = node_at(&ps, ps.scopes.ptrs[ps.scopes.siz-1]->node);
+        logger_parse_error(ts_line(ts, open->offset), ts_column(ts, open->offset)-1, "Missing end.");
+    }
 
-    /* copy to ast */
-    ast->siz = ps.nodes.siz;
-    ast->nodes = malloc(sizeof(void*)*ast->siz);
-    for (int i = 0; i < ps.nodes.siz; i++)
-        ast->nodes[i] = ps.nodes.ptrs[i];
+    /* lay out the ast */
+    ast->symbols = ts->symbols;
+    ast->ts = ts;
+    flatten_tree(&ps, ast);
 
     /* print nodes */
 #if(DEBUG_PRINT_NODES == 1)
-    printf("AST:\n");
-    _print_node(ast->nodes[0], 0);
+    fprintf(stderr, "AST:\n");
+    print_nodes(ast, arena);
 #endif
 
-    /* free up memory */
-    /*
-    free(ps.nodes.ptrs);
-    for (int i = 0; i < ps.scopes.siz; i++)
-        free(ps.scopes.ptrs[i]);
-    free(ps.scopes.ptrs);
-    for (int i = 0; i < ps.vars_allowed_in_scope.siz; i++) {
-        free(ps.vars_allowed_in_scope.v[i]->name);
-        free(ps.vars_allowed_in_scope.v[i]);
-    }
-    free(ps.vars_allowed_in_scope.v);
-    */
+    /* nodes, scopes and variables are all freed with the arena */
     return ast;
-} // ! fix func def not freeing
-void parse_free(AbstractSyntaxTree *ast) {
-    //printf("FREE DEBUG:\n");
-    //_print_node(ast->nodes[0], 0);
-    for (int i = 0; i < ast->siz; i++) {
-        Node* nd = ast->nodes[i];
-        //puts("A");
-        free(nd->value);
-        //puts("B");
-        free(nd->next.refs);
-        //puts("C");
-        free(nd);
-        //puts("D");
-    }
-    free(ast->nodes);
-    free(ast);
-}
\ No newline at end of file
+}
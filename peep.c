@@ -0,0 +1,332 @@
+/*
+** Peephole optimizer over the machine instructions of x86.c.
+** Every rule looks at one instruction and the few around it, and rewrites or removes them in place.
+** Rules run from a table in order on every instruction, the whole list is gone over again until no rule fires.
+** Labels are never removed, calls and jumps refer to them.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define PEEP_MAX_PASSES         8
+#define PEEP_MAX_HOPS           8 /* jumps followed in a chain */
+#define PEEP_WINDOW             8 /* instructions looked back at for a register holding an immediate */
+/*}=======================*/
+
+#define NO_INST ((size_t)-1)
+
+typedef struct PeepState {
+    MachineCode* mc;
+    uint8_t* removed; /* by instruction, until the list is compacted */
+    uint32_t* label_at; /* by text label, its M_Label instruction */
+    uint32_t* uses; /* by label, instructions referring to it at the start of the pass */
+} PeepState;
+
+#define inst(_ps, _i) (&(_ps)->mc->insts.v[_i])
+#define is_jump(_op) ((_op) == M_Jmp || (_op) == M_Jcc)
+/* the instruction leaves the block, nothing after it runs in order */
+#define is_control(_op) ((_op) == M_Label || (_op) == M_Jmp || (_op) == M_Jcc || (_op) == M_Call || (_op) == M_Ret)
+
+static size_t next_of(const PeepState* ps, size_t i) {
+    for (i++; i < ps->mc->insts.siz && ps->removed[i]; i++);
+    return i;
+}
+
+static size_t prev_of(const PeepState* ps, size_t i) {
+    while (i-- > 0)
+        if (!ps->removed[i])
+            return i;
+    return NO_INST;
+}
+
+/* first instruction that runs after jumping to <label> */
+static size_t target_of(const PeepState* ps, uint32_t label) {
+    size_t i = ps->label_at[label];
+    while (i < ps->mc->insts.siz && (ps->removed[i] || inst(ps, i)->op == M_Label))
+        i++;
+    return i;
+}
+
+/* <label> is placed between <i> and the next instruction */
+static int falls_into(const PeepState* ps, size_t i, uint32_t label) {
+    for (size_t j = next_of(ps, i); j < ps->mc->insts.siz && inst(ps, j)->op == M_Label; j = next_of(ps, j))
+        if (inst(ps, j)->src.imm == label)
+            return 1;
+    return 0;
+}
+
+static int same_operand(MOperand a, MOperand b) {
+    if (a.kind != b.kind)
+        return 0;
+    switch (a.kind) {
+        case MO_Reg: return a.reg == b.reg;
+        case MO_Mem: return a.reg == b.reg && a.imm == b.imm;
+        case MO_Imm: case MO_Label: return a.imm == b.imm;
+        default: return 1;
+    }
+}
+
+/* nothing reads the flags <i> leaves behind */
+static int flags_dead(const PeepState* ps, size_t i) {
+    for (size_t j = next_of(ps, i); j < ps->mc->insts.siz; j = next_of(ps, j)) {
+        switch ((MOp)inst(ps, j)->op) {
+            case M_Jcc: case M_Setcc: return 0;
+            case M_Label: case M_Jmp: return 0; /* someone else's flags, don't know */
+            case M_Add: case M_Sub: case M_Imul: case M_Xor: case M_And: case M_Or: case M_Cmp: case M_Test: case M_Neg:
+            case M_Mul: case M_Div: case M_Idiv: case M_Call: case M_Ret: return 1;
+            default: break; /* inc and dec keep the carry */
+        }
+    }
+    return 1;
+}
+
+/* registers <in> writes */
+static uint32_t written(const MInst* in) {
+    switch ((MOp)in->op) {
+        case M_Neg: case M_Inc: case M_Dec: case M_Setcc: case M_Pop:
+            return in->src.kind == MO_Reg ? 1u << in->src.reg : 0;
+        case M_Mul: case M_Div: case M_Idiv: return 1u << RAX | 1u << RDX;
+        case M_RepMovsb: return 1u << RCX | 1u << RSI | 1u << RDI;
+        case M_Cqto: return 1u << RDX;
+        case M_Syscall: return 1u << RAX | 1u << RCX | 1u << R11;
+        case M_Leave: return 1u << RSP | 1u << RBP;
+        case M_Cmp: case M_Test: return 0;
+        default: return in->dst.kind == MO_Reg ? 1u << in->dst.reg : 0;
+    }
+}
+
+/*
+** Rules, each gets a live instruction that is not a label and says whether it changed anything.
+*/
+
+static int jump_to_next(PeepState* ps, size_t i) {
+    const MInst* in = inst(ps, i);
+    if (!is_jump(in->op) || !falls_into(ps, i, (uint32_t)in->src.imm))
+        return 0;
+    ps->removed[i] = 1;
+    return 1;
+}
+
+/* only chains that end somewhere within PEEP_MAX_HOPS, a loop of jumps stays as it is */
+static int jump_chain(PeepState* ps, size_t i) {
+    MInst* in = inst(ps, i);
+    if (!is_jump(in->op))
+        return 0;
+    uint32_t label = (uint32_t)in->src.imm;
+    for (int hops = 0;; hops++) {
+        const size_t t = target_of(ps, label);
+        if (t >= ps->mc->insts.siz || inst(ps, t)->op != M_Jmp)
+            break;
+        if (t == i || hops == PEEP_MAX_HOPS)
+            return 0;
+        label = (uint32_t)inst(ps, t)->src.imm;
+    }
+    if (label == in->src.imm)
+        return 0;
+    in->src.imm = label;
+    return 1;
+}
+
+static int branch_over_jump(PeepState* ps, size_t i) {
+    MInst* in = inst(ps, i);
+    if (in->op != M_Jcc)
+        return 0;
+    const size_t j = next_of(ps, i);
+    if (j >= ps->mc->insts.siz || inst(ps, j)->op != M_Jmp || !falls_into(ps, j, (uint32_t)in->src.imm))
+        return 0;
+    in->aux ^= 1; /* the opposite condition is the next one */
+    in->src = inst(ps, j)->src;
+    ps->removed[j] = 1;
+    return 1;
+}
+
+/* the counts only go down during a pass, a stale one keeps code alive */
+static int unreachable(PeepState* ps, size_t i) {
+    const MInst* in = inst(ps, i);
+    if (in->op != M_Jmp && in->op != M_Ret)
+        return 0;
+    int found = 0;
+    for (size_t j = next_of(ps, i); j < ps->mc->insts.siz; j = next_of(ps, j)) {
+        const MInst* at = inst(ps, j);
+        if (at->op == M_Label && ps->uses[at->src.imm] > 0)
+            break;
+        if (at->op != M_Label) {
+            ps->removed[j] = 1;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+static int shrink_immediate(PeepState* ps, size_t i) {
+    MInst* in = inst(ps, i);
+    if (in->src.kind != MO_Imm)
+        return 0;
+    const int64_t imm = in->src.imm;
+    if (in->op == M_Mov && in->width == 8 && in->dst.kind == MO_Reg && imm >= 0 && imm <= INT32_MAX) {
+        in->width = 4; /* zero extends, no REX.W */
+        return 1;
+    }
+    if (in->op == M_MovAbs && imm >= INT32_MIN && imm <= UINT32_MAX) {
+        in->op = M_Mov;
+        in->width = imm >= 0 ? 4 : 8;
+        return 1;
+    }
+    if (in->op == M_Cmp && imm == 0 && in->dst.kind == MO_Reg) {
+        in->op = M_Test;
+        in->src = in->dst;
+        return 1;
+    }
+    if ((in->op == M_Add || in->op == M_Sub) && imm == 128 && flags_dead(ps, i)) { /* -128 takes 8 bits */
+        in->op = in->op == M_Add ? M_Sub : M_Add;
+        in->src.imm = -128;
+        return 1;
+    }
+    return 0;
+}
+
+static int zero_to_xor(PeepState* ps, size_t i) {
+    MInst* in = inst(ps, i);
+    if (in->op != M_Mov || in->src.kind != MO_Imm || in->src.imm != 0 || in->dst.kind != MO_Reg || in->width < 4 || !flags_dead(ps, i))
+        return 0;
+    *in = (MInst){.op = M_Xor, .width = 4, .src = in->dst, .dst = in->dst};
+    return 1;
+}
+
+static int same_immediate(PeepState* ps, size_t i) {
+    MInst* in = inst(ps, i);
+    if (in->op != M_Mov || in->width != 4 || in->src.kind != MO_Imm || in->dst.kind != MO_Reg)
+        return 0;
+    uint32_t clobbered = 0;
+    size_t j = prev_of(ps, i);
+    for (int n = 0; n < PEEP_WINDOW && j != NO_INST && !is_control(inst(ps, j)->op); n++, j = prev_of(ps, j)) {
+        const MInst* at = inst(ps, j);
+        if (at->op == M_Mov && at->width == 4 && at->src.kind == MO_Imm && at->src.imm == in->src.imm &&
+            at->dst.kind == MO_Reg && at->dst.reg != in->dst.reg && !(clobbered >> at->dst.reg & 1)) {
+            in->src = at->dst;
+            return 1;
+        }
+        clobbered |= written(at);
+    }
+    return 0;
+}
+
+static int store_load(PeepState* ps, size_t i) {
+    const MInst* in = inst(ps, i);
+    if (in->op != M_Mov || in->width != 8 || in->src.kind != MO_Reg || (in->dst.kind != MO_Mem && in->dst.kind != MO_Label))
+        return 0;
+    const size_t j = next_of(ps, i);
+    if (j >= ps->mc->insts.siz)
+        return 0;
+    MInst* load = inst(ps, j);
+    if (load->op != M_Mov || load->width != 8 || load->dst.kind != MO_Reg || !same_operand(load->src, in->dst))
+        return 0;
+    if (load->dst.reg == in->src.reg)
+        ps->removed[j] = 1;
+    else
+        load->src = in->src;
+    return 1;
+}
+
+static int redundant_move(PeepState* ps, size_t i) {
+    const MInst* in = inst(ps, i);
+    if (in->op != M_Mov || in->width != 8)
+        return 0;
+    if (same_operand(in->src, in->dst)) {
+        ps->removed[i] = 1;
+        return 1;
+    }
+    /* the load changed its own base */
+    if (in->dst.kind != MO_Reg || in->src.kind == MO_Imm || (in->src.kind == MO_Mem && in->src.reg == in->dst.reg))
+        return 0;
+    const size_t j = next_of(ps, i);
+    if (j >= ps->mc->insts.siz)
+        return 0;
+    const MInst* back = inst(ps, j);
+    if (back->op != M_Mov || back->width != 8 || !same_operand(back->src, in->dst) || !same_operand(back->dst, in->src))
+        return 0;
+    ps->removed[j] = 1;
+    return 1;
+}
+
+static const struct {
+    const char* name;
+    int (*apply)(PeepState* ps, size_t i);
+} RULES[PEEP_RuleCount] = {
+    [PEEP_JumpToNext] = {"jump-to-next", jump_to_next},
+    [PEEP_JumpChain] = {"jump-chain", jump_chain},
+    [PEEP_BranchOverJump] = {"branch-over-jump", branch_over_jump},
+    [PEEP_Unreachable] = {"unreachable", unreachable},
+    [PEEP_ShrinkImmediate] = {"shrink-immediate", shrink_immediate},
+    [PEEP_ZeroToXor] = {"zero-to-xor", zero_to_xor},
+    [PEEP_SameImmediate] = {"same-immediate", same_immediate},
+    [PEEP_StoreLoad] = {"store-load", store_load},
+    [PEEP_RedundantMove] = {"redundant-move", redundant_move},
+};
+
+static uint32_t count_insts(const MachineCode* mc) {
+    uint32_t n = 0;
+    for (size_t i = 0; i < mc->insts.siz; i++)
+        n += mc->insts.v[i].op != M_Label;
+    return n;
+}
+
+/*{==================================*/
+/*
+** API
+*/
+void peep_optimize(MachineCode* mc, PeepStats* stats) {
+    PeepStats local;
+    if (stats == NULL)
+        stats = &local;
+    memset(stats, 0, sizeof(PeepStats));
+    stats->before = count_insts(mc);
+
+    PeepState ps = {
+        .mc = mc,
+        .removed = arena_alloc(mc->arena, mc->insts.siz+1),
+        .label_at = arena_alloc(mc->arena, sizeof(uint32_t)*(mc->labels.siz+1)),
+        .uses = arena_alloc(mc->arena, sizeof(uint32_t)*(mc->labels.siz+1)),
+    };
+    memset(ps.removed, 0, mc->insts.siz+1);
+    for (int changed = 1; changed && stats->passes < PEEP_MAX_PASSES; stats->passes++) {
+        changed = 0;
+        for (size_t l = 0; l < mc->labels.siz; l++)
+            ps.uses[l] = mc->labels.v[l].global;
+        for (size_t i = 0; i < mc->insts.siz; i++) {
+            const MInst* in = &mc->insts.v[i];
+            if (in->op == M_Label)
+                ps.label_at[in->src.imm] = (uint32_t)i;
+            else if (in->src.kind == MO_Label)
+                ps.uses[in->src.imm]++;
+            else if (in->dst.kind == MO_Label)
+                ps.uses[in->dst.imm]++;
+        }
+        for (size_t i = 0; i < mc->insts.siz; i++) {
+            for (uint32_t r = 0; r < PEEP_RuleCount && !ps.removed[i] && mc->insts.v[i].op != M_Label; r++) {
+                if (RULES[r].apply(&ps, i)) {
+                    stats->hits[r]++;
+                    changed = 1;
+                }
+            }
+        }
+
+        /* compact */
+        size_t kept = 0;
+        for (size_t i = 0; i < mc->insts.siz; i++) {
+            if (!ps.removed[i])
+                mc->insts.v[kept++] = mc->insts.v[i];
+            ps.removed[i] = 0;
+        }
+        mc->insts.siz = kept;
+    }
+    stats->after = count_insts(mc);
+}
+
+void peep_print_stats(const PeepStats* stats, FILE* out) {
+    fprintf(out, "Peephole: %u -> %u instructions in %u passes.\n", stats->before, stats->after, stats->passes);
+    for (uint32_t r = 0; r < PEEP_RuleCount; r++)
+        fprintf(out, "    %-18s %u\n", RULES[r].name, stats->hits[r]);
+}
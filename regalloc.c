@@ -0,0 +1,358 @@
+/*
+** Linear scan register allocation over the SSA values of one function.
+** Every value has a live interval from its definition to its last use, intervals that don't fit are split:
+** the value goes to its spill slot and comes back into a register right before its next use.
+** Calls clobber the caller saved registers, intervals crossing one get a callee saved register or get split there.
+** The phis of a block are all defined at its first instruction, the edges into it write them at once.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define RA_INIT_CAPACITY        64
+#define RA_GROWTH               2
+/*}=======================*/
+
+#define POS_NONE ((uint32_t)-1)
+
+/* tried in this order, caller saved first so short intervals leave the callee saved ones alone */
+static const uint8_t ALLOCATABLE[] = {RSI, RDI, R8, R9, R10, RCX, RBX, R12, R13, R14, R15};
+#define ALLOCATABLE_COUNT (sizeof(ALLOCATABLE)/sizeof(ALLOCATABLE[0]))
+#define CALLER_SAVED_MASK ((1u << RAX) | (1u << RCX) | (1u << RDX) | (1u << RSI) | (1u << RDI) | (1u << R8) | (1u << R9) | (1u << R10) | (1u << R11))
+#define is_caller_saved(_reg) ((CALLER_SAVED_MASK >> (_reg)) & 1)
+
+/* argument registers, parameters would like to stay where they arrive */
+static const uint8_t PARAM_HINTS[IR_MAX_PARAMS] = {RDI, RSI, RDX, RCX, R8, R9};
+
+#define ra_push(_arena, _arr, _val) do {                                                                            \
+    if ((_arr).siz + 1 > (_arr).cap) {                                                                              \
+        (_arr).v = arena_realloc(_arena, (_arr).v, sizeof(*(_arr).v)*(_arr).cap, sizeof(*(_arr).v)*(_arr).cap*RA_GROWTH); \
+        (_arr).cap *= RA_GROWTH;                                                                                    \
+    }                                                                                                               \
+    (_arr).v[(_arr).siz++] = (_val);                                                                                \
+} while (0)
+
+typedef struct Allocator {
+    const IrModule* ir;
+    const IrFunc* f;
+    RegAlloc* ra;
+    Arena* arena;
+    uint32_t* use_first; /* uses of value i are use_pos[use_first[i]..use_first[i+1]), sorted */
+    uint32_t* use_pos;
+    uint32_t* calls; /* positions where the caller saved registers die, sorted */
+    uint32_t calls_siz;
+    uint32_t* tail; /* last segment of every value */
+    struct {
+        RaInterval* v;
+        size_t siz;
+        size_t cap;
+    } unhandled; /* split children, min heap on start */
+    RaInterval active[16]; /* by register, value IR_NONE if free */
+} Allocator;
+
+#define use_count(_al, _v) ((_al)->use_first[(_v)+1] - (_al)->use_first[_v])
+#define last_use(_al, _v) ((_al)->use_pos[(_al)->use_first[(_v)+1]-1])
+
+/* first use of <v> at or after <pos>, POS_NONE if none */
+static uint32_t next_use(const Allocator* al, IrRef v, uint32_t pos) {
+    uint32_t lo = al->use_first[v], hi = al->use_first[v+1];
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (al->use_pos[mid] < pos)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo < al->use_first[v+1] ? al->use_pos[lo] : POS_NONE;
+}
+
+/* where <v> is defined, a phi where the first phi of its block is (blocks never end in one) */
+static uint32_t def_position(const Allocator* al, IrRef v) {
+    const IrInst* insts = &al->ir->insts.v[al->f->first_inst];
+    while (v > 0 && insts[v].op == IR_Phi && insts[v-1].op == IR_Phi)
+        v--;
+    return 2*v+1;
+}
+
+/* <fn> is called with every (value, use position) of the function */
+#define for_each_use(_ir, _f, _fn, _arg)                                                               \
+    for (IrRef at = (_f)->first_inst; at < (_f)->first_inst + (_f)->insts; at++) {                    \
+        const IrInst* in = &(_ir)->insts.v[at];                                                        \
+        const uint32_t pos = 2*(at - (_f)->first_inst);                                                \
+        switch ((IrOp)in->op) {                                                                        \
+            case IR_Add: case IR_Sub: case IR_Mul: case IR_Div: case IR_Mod:                           \
+            case IR_Eq: case IR_Ne: case IR_Lt: case IR_Le: case IR_Gt: case IR_Ge: {                  \
+                _fn(_arg, in->a, pos);                                                                 \
+                _fn(_arg, in->b, pos);                                                                 \
+                break;                                                                                 \
+            }                                                                                          \
+            case IR_Neg: case IR_Conv: case IR_Tag: case IR_Untag: case IR_Br: _fn(_arg, in->a, pos); break; \
+            case IR_Ret: if (in->a != IR_NONE) _fn(_arg, in->a, pos); break;                           \
+            case IR_StoreGlobal: _fn(_arg, in->b, pos); break;                                         \
+            case IR_Call: for (uint32_t i = 0; i < in->b; i++) _fn(_arg, (_ir)->extra.v[in->a+1+i], pos); break; \
+            case IR_Print: for (uint32_t i = 0; i < in->b; i++) _fn(_arg, (_ir)->extra.v[in->a+i], pos); break; \
+            case IR_Phi: { /* read at the end of the predecessor */                                   \
+                for (uint32_t i = 0; i < in->b; i++) {                                                 \
+                    const IrBlock* pred = &(_ir)->blocks.v[(_ir)->extra.v[in->a + i*2]];               \
+                    _fn(_arg, (_ir)->extra.v[in->a + i*2+1], 2*(pred->first + pred->count-1 - (_f)->first_inst)); \
+                }                                                                                      \
+                break;                                                                                 \
+            }                                                                                          \
+            default: break;                                                                            \
+        }                                                                                              \
+    }
+
+#define count_use(_al, _v, _pos) ((void)(_pos), (_al)->use_first[(_v) - (_al)->f->first_inst + 1]++) /* only counts, the position is for fill_use */
+#define fill_use(_fill, _v, _pos) use_pos[(_fill)[(_v) - al->f->first_inst]++] = (_pos)
+
+static void build_uses(Allocator* al) {
+    const IrModule* ir = al->ir;
+    const IrFunc* f = al->f;
+    al->use_first = arena_alloc(al->arena, sizeof(uint32_t)*(f->insts+1));
+    memset(al->use_first, 0, sizeof(uint32_t)*(f->insts+1));
+    for_each_use(ir, f, count_use, al);
+    for (uint32_t i = 0; i < f->insts; i++)
+        al->use_first[i+1] += al->use_first[i];
+
+    uint32_t* use_pos = arena_alloc(al->arena, sizeof(uint32_t)*(al->use_first[f->insts]+1));
+    uint32_t* fill = arena_alloc(al->arena, sizeof(uint32_t)*(f->insts+1));
+    memcpy(fill, al->use_first, sizeof(uint32_t)*f->insts);
+    for_each_use(ir, f, fill_use, fill);
+    al->use_pos = use_pos;
+
+    /* phi operands come in out of order, lists are short */
+    for (uint32_t v = 0; v < f->insts; v++) {
+        for (uint32_t i = al->use_first[v]+1; i < al->use_first[v+1]; i++) {
+            uint32_t pos = use_pos[i], j = i;
+            for (; j > al->use_first[v] && use_pos[j-1] > pos; j--)
+                use_pos[j] = use_pos[j-1];
+            use_pos[j] = pos;
+        }
+    }
+
+    al->calls = arena_alloc(al->arena, sizeof(uint32_t)*(f->insts+1));
+    al->calls_siz = 0;
+    for (uint32_t i = 0; i < f->insts; i++) {
+        uint8_t op = ir->insts.v[f->first_inst + i].op;
+        if (op == IR_Call || op == IR_Print)
+            al->calls[al->calls_siz++] = 2*i+1;
+    }
+}
+
+/*
+** Unhandled children
+*/
+static void heap_push(Allocator* al, RaInterval it) {
+    ra_push(al->arena, al->unhandled, it);
+    RaInterval* h = al->unhandled.v;
+    for (size_t i = al->unhandled.siz-1; i > 0 && h[(i-1)/2].start > h[i].start; i = (i-1)/2) {
+        RaInterval t = h[i];
+        h[i] = h[(i-1)/2];
+        h[(i-1)/2] = t;
+    }
+}
+
+static RaInterval heap_pop(Allocator* al) {
+    RaInterval* h = al->unhandled.v;
+    RaInterval top = h[0];
+    h[0] = h[--al->unhandled.siz];
+    for (size_t i = 0;;) {
+        size_t l = i*2+1, r = l+1, min = i;
+        if (l < al->unhandled.siz && h[l].start < h[min].start)
+            min = l;
+        if (r < al->unhandled.siz && h[r].start < h[min].start)
+            min = r;
+        if (min == i)
+            break;
+        RaInterval t = h[i];
+        h[i] = h[min];
+        h[min] = t;
+        i = min;
+    }
+    return top;
+}
+
+/*
+** Segments
+*/
+static uint32_t add_segment(Allocator* al, IrRef v, uint32_t from, uint32_t to, uint8_t reg) {
+    RegAlloc* ra = al->ra;
+    ra_push(al->arena, ra->segs, ((RaSegment){.from = from, .to = to, .next = IR_NONE, .reg = reg}));
+    uint32_t seg = (uint32_t)ra->segs.siz-1;
+    if (al->tail[v] == IR_NONE)
+        ra->segs_of[v] = seg;
+    else
+        ra->segs.v[al->tail[v]].next = seg;
+    al->tail[v] = seg;
+    if (reg == RA_MEMORY && ra->slots[v] == IR_NONE)
+        ra->slots[v] = ra->slot_count++;
+    return seg;
+}
+
+/*
+** <it> leaves its register at <pos>, it stays in memory up to its next use where a child takes over.
+*/
+static void split_at(Allocator* al, RaInterval* it, uint32_t pos) {
+    uint32_t use = next_use(al, it->value, pos);
+    al->ra->segs.v[it->seg].to = pos-1;
+    add_segment(al, it->value, pos, use == POS_NONE ? it->end : use-1, RA_MEMORY);
+    if (use != POS_NONE)
+        heap_push(al, (RaInterval){.value = it->value, .start = use, .end = it->end, .seg = IR_NONE});
+}
+
+/* <it> goes to memory until its next use after <pos> */
+static void spill(Allocator* al, RaInterval* it) {
+    uint32_t use = next_use(al, it->value, it->start+1);
+    add_segment(al, it->value, it->start, use == POS_NONE ? it->end : use-1, RA_MEMORY);
+    if (use != POS_NONE)
+        heap_push(al, (RaInterval){.value = it->value, .start = use, .end = it->end, .seg = IR_NONE});
+}
+
+static void assign(Allocator* al, RaInterval* it, uint8_t reg, uint32_t free_until) {
+    it->seg = add_segment(al, it->value, it->start, it->end, reg);
+    if (!is_caller_saved(reg))
+        al->ra->callee_saved |= (uint16_t)(1u << reg);
+    if (it->seg != al->ra->segs_of[it->value]) /* a child, loaded back from the slot */
+        ra_push(al->arena, al->ra->reloads, ((RaReload){.value = it->value, .pos = it->start}));
+    if (free_until <= it->end)
+        split_at(al, it, free_until);
+    it->end = al->ra->segs.v[it->seg].to;
+    al->active[reg] = *it;
+}
+
+static void allocate(Allocator* al, RaInterval it, uint32_t next_call) {
+    const uint32_t s = it.start;
+    uint32_t free_until[16];
+    for (uint32_t i = 0; i < ALLOCATABLE_COUNT; i++) {
+        uint8_t reg = ALLOCATABLE[i];
+        if (al->active[reg].value != IR_NONE && al->active[reg].end < s)
+            al->active[reg].value = IR_NONE; /* expired */
+        free_until[reg] = al->active[reg].value != IR_NONE ? 0 : is_caller_saved(reg) ? next_call : POS_NONE;
+    }
+
+    /* a free register for the whole interval, the hint, then any caller saved, then callee saved ones already pushed */
+    const IrInst* in = &al->ir->insts.v[al->f->first_inst + it.value];
+    if (in->op == IR_Param && it.seg == IR_NONE && al->ra->segs_of[it.value] == IR_NONE) {
+        uint8_t hint = PARAM_HINTS[in->a];
+        for (uint32_t i = 0; i < ALLOCATABLE_COUNT; i++) {
+            if (ALLOCATABLE[i] == hint && free_until[hint] > it.end) {
+                assign(al, &it, hint, free_until[hint]);
+                return;
+            }
+        }
+    }
+    int best = -1;
+    for (uint32_t i = 0; i < ALLOCATABLE_COUNT; i++) {
+        uint8_t reg = ALLOCATABLE[i];
+        if (free_until[reg] <= it.end)
+            continue;
+        if (is_caller_saved(reg) || (al->ra->callee_saved >> reg & 1)) {
+            best = reg;
+            break;
+        }
+        if (best < 0)
+            best = reg;
+    }
+    if (best >= 0) {
+        assign(al, &it, (uint8_t)best, free_until[best]);
+        return;
+    }
+
+    /* free for a part, split where the register stops being free */
+    for (uint32_t i = 0; i < ALLOCATABLE_COUNT; i++)
+        if (best < 0 || free_until[ALLOCATABLE[i]] > free_until[best])
+            best = ALLOCATABLE[i];
+    if (free_until[best] > s) {
+        assign(al, &it, (uint8_t)best, free_until[best]);
+        return;
+    }
+
+    /* all taken, the interval used furthest away goes to memory */
+    uint32_t victim_use = 0;
+    best = -1;
+    for (uint32_t i = 0; i < ALLOCATABLE_COUNT; i++) {
+        uint8_t reg = ALLOCATABLE[i];
+        uint32_t use = next_use(al, al->active[reg].value, s);
+        if (use > victim_use || best < 0) {
+            victim_use = use;
+            best = reg;
+        }
+    }
+    if (next_use(al, it.value, s) >= victim_use) {
+        spill(al, &it);
+        return;
+    }
+    split_at(al, &al->active[best], s);
+    al->active[best].value = IR_NONE;
+    assign(al, &it, (uint8_t)best, is_caller_saved(best) ? next_call : POS_NONE);
+}
+
+/*{==================================*/
+/*
+** API
+*/
+RegAlloc* regalloc_function(const IrModule* ir, const IrFunc* f, Arena* arena) {
+    RegAlloc* ra = arena_alloc(arena, sizeof(RegAlloc));
+    *ra = (RegAlloc){
+        .segs_of = arena_alloc(arena, sizeof(uint32_t)*(f->insts+1)),
+        .slots = arena_alloc(arena, sizeof(uint32_t)*(f->insts+1)),
+        .slot_count = 0,
+        .callee_saved = 0,
+    };
+    ra->segs.v = arena_alloc(arena, sizeof(RaSegment)*RA_INIT_CAPACITY);
+    ra->segs.cap = RA_INIT_CAPACITY;
+    ra->reloads.v = arena_alloc(arena, sizeof(RaReload)*RA_INIT_CAPACITY);
+    ra->reloads.cap = RA_INIT_CAPACITY;
+    memset(ra->segs_of, 0xFF, sizeof(uint32_t)*(f->insts+1));
+    memset(ra->slots, 0xFF, sizeof(uint32_t)*(f->insts+1));
+
+    Allocator al = {
+        .ir = ir,
+        .f = f,
+        .ra = ra,
+        .arena = arena,
+        .tail = arena_alloc(arena, sizeof(uint32_t)*(f->insts+1)),
+    };
+    memset(al.tail, 0xFF, sizeof(uint32_t)*(f->insts+1));
+    al.unhandled.v = arena_alloc(arena, sizeof(RaInterval)*RA_INIT_CAPACITY);
+    al.unhandled.cap = RA_INIT_CAPACITY;
+    for (uint32_t r = 0; r < 16; r++)
+        al.active[r].value = IR_NONE;
+    build_uses(&al);
+
+    /* values come in order of definition, split children from the heap */
+    uint32_t call = 0;
+    for (IrRef v = 0; v < f->insts || al.unhandled.siz > 0;) {
+        while (v < f->insts && use_count(&al, v) == 0)
+            v++; /* never used, nothing to keep */
+        RaInterval it;
+        if (v < f->insts && (al.unhandled.siz == 0 || def_position(&al, v) < al.unhandled.v[0].start))
+            it = (RaInterval){.value = v, .start = def_position(&al, v), .end = last_use(&al, v), .seg = IR_NONE}, v++;
+        else if (al.unhandled.siz > 0)
+            it = heap_pop(&al);
+        else
+            break;
+
+        while (call < al.calls_siz && al.calls[call] <= it.start)
+            call++;
+        allocate(&al, it, call < al.calls_siz ? al.calls[call] : POS_NONE);
+    }
+
+    /* values that end up in more than one place, their location can differ across an edge */
+    ra->split.v = arena_alloc(arena, sizeof(IrRef)*RA_INIT_CAPACITY);
+    ra->split.cap = RA_INIT_CAPACITY;
+    ra->split.siz = 0;
+    for (IrRef v = 0; v < f->insts; v++)
+        if (ra->segs_of[v] != IR_NONE && ra->segs.v[ra->segs_of[v]].next != IR_NONE)
+            ra_push(arena, ra->split, v);
+    return ra;
+}
+
+uint8_t regalloc_location(const RegAlloc* ra, IrRef v, uint32_t pos) {
+    for (uint32_t seg = ra->segs_of[v]; seg != IR_NONE; seg = ra->segs.v[seg].next)
+        if (ra->segs.v[seg].from <= pos && pos <= ra->segs.v[seg].to)
+            return ra->segs.v[seg].reg;
+    return RA_MEMORY;
+}
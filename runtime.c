@@ -0,0 +1,414 @@
+/*
+** Runtime of the generated programs, appended to their machine code.
+** Freestanding, no libc: stdout goes through a buffer in .bss that is written out with the write
+** syscall when it is full and when the program ends, so a print costs no syscall on its own.
+** A trap (overflow, division by zero) flushes it too before it reports on stderr and exits.
+** The routines are leaves as far as the program is concerned, they clobber
+** %rax %rcx %rdx %rsi %rdi %r8 %r9 %r10 %r11, all caller saved.
+** The slow paths of dynamic values are called in the middle of a computation instead,
+** they only clobber the generator's scratch registers %rax %rdx %r11.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define RUNTIME_OUT_SIZE        (1 << 16) /* bytes of stdout kept before a write */
+#define RUNTIME_HEAP_SIZE       (1 << 20) /* bytes of strings joined at run time */
+#define RUNTIME_GROWTH          2
+/*}=======================*/
+
+#define RUNTIME_ROOM 24 /* bytes an integer needs free in the buffer, its 20 at most rounded up to whole words */
+
+static const char* ROUTINE_NAMES[RT_Count] = {
+    [RT_PrintUint] = "__pya_print_uint", [RT_PrintInt] = "__pya_print_int",
+    [RT_PrintStr] = "__pya_print_str", [RT_PrintChar] = "__pya_print_char",
+    [RT_Flush] = "__pya_flush", [RT_Overflow] = "__pya_overflow", [RT_DivZero] = "__pya_div_zero",
+    [RT_PrintDyn] = "__pya_print_dyn", [RT_DynInts] = "__pya_dyn_ints", [RT_DynAdd] = "__pya_dyn_add",
+    [RT_DynEq] = "__pya_dyn_eq", [RT_TypeError] = "__pya_type_error", [RT_OutOfMemory] = "__pya_out_of_memory",
+};
+
+/* what a trap writes to stderr, NULL for the routines that aren't */
+static const struct {
+    const char* label;
+    const char* text;
+} TRAP_TEXTS[RT_Count] = {
+    [RT_Overflow] = {"__pya_overflow_text", "Integer overflow.\n"},
+    [RT_DivZero] = {"__pya_div_zero_text", "Division by zero.\n"},
+    [RT_TypeError] = {"__pya_type_error_text", "Type error.\n"},
+    [RT_OutOfMemory] = {"__pya_out_of_memory_text", "Out of memory.\n"},
+};
+
+/* "00" to "99", integers are formatted two digits at a time */
+static const char DIGIT_PAIRS[200] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839" "40414243444546474849"
+    "50515253545556575859" "60616263646566676869" "70717273747576777879" "80818283848586878889" "90919293949596979899";
+
+#define rt_push(_arena, _arr, _val) do {                                                                            \
+    if ((_arr).siz + 1 > (_arr).cap) {                                                                              \
+        (_arr).v = arena_realloc(_arena, (_arr).v, sizeof(*(_arr).v)*(_arr).cap, sizeof(*(_arr).v)*(_arr).cap*RUNTIME_GROWTH); \
+        (_arr).cap *= RUNTIME_GROWTH;                                                                               \
+    }                                                                                                               \
+    (_arr).v[(_arr).siz++] = (_val);                                                                                \
+} while (0)
+
+#define local(_mc, _name) x86_label(_mc, MS_Text, _name, sizeof(_name)-1)
+#define place(_mc, _label) x86_put(_mc, M_Label, 0, mo_label(_label), mo_none)
+
+static void jcc(MachineCode* mc, X86Cond cc, uint32_t label) {
+    x86_put(mc, M_Jcc, 0, mo_label(label), mo_none);
+    mc->insts.v[mc->insts.siz-1].aux = (uint8_t)cc;
+}
+
+/* the two digits of <value> < 100 go to -1(%rsi), %r10 is the pair table, <value> is lost */
+static void put_pair(MachineCode* mc, uint8_t value) {
+    x86_put(mc, M_Add, 8, mo_reg(value), mo_reg(value));
+    x86_put(mc, M_Add, 8, mo_reg(R10), mo_reg(value));
+    x86_put(mc, M_Mov, 2, mo_mem(value, 8), mo_reg(RDX)); /* past the length */
+    x86_put(mc, M_Mov, 2, mo_reg(RDX), mo_mem(RSI, -1));
+    x86_put(mc, M_Sub, 8, mo_imm(2), mo_reg(RSI));
+}
+
+/*
+** Integers in decimal, 64 bits covers every width since values are kept extended.
+** Two digits at a time from the back into the red zone, divided out with a multiply by the reciprocal
+** of 100 instead of div. Room in the buffer is made first so nothing is called after, the digits are
+** then copied as three whole words.
+*/
+static void emit_integers(MachineCode* mc, const Runtime* rt) {
+    const uint32_t room = local(mc, ".Lrt_room"), has_room = local(mc, ".Lrt_has_room"), magnitude = local(mc, ".Lrt_magnitude");
+    const uint32_t pair = local(mc, ".Lrt_pair"), last = local(mc, ".Lrt_last"), one = local(mc, ".Lrt_one");
+    const uint32_t sign = local(mc, ".Lrt_sign"), copy = local(mc, ".Lrt_copy_digits");
+    const MOperand len = mo_label(rt->out_len);
+
+    /* %rdi = value */
+    place(mc, rt->routines[RT_PrintUint]);
+    x86_put(mc, M_Xor, 4, mo_reg(R8), mo_reg(R8));
+    x86_put(mc, M_Jmp, 0, mo_label(room), mo_none);
+    place(mc, rt->routines[RT_PrintInt]);
+    x86_put(mc, M_Mov, 8, mo_reg(RDI), mo_reg(R8)); /* the sign */
+    place(mc, room);
+    x86_put(mc, M_Cmp, 8, mo_imm(RUNTIME_OUT_SIZE - RUNTIME_ROOM), len);
+    jcc(mc, CC_BE, has_room);
+    x86_put(mc, M_Push, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Push, 8, mo_reg(R8), mo_none);
+    x86_put(mc, M_Call, 0, mo_label(rt->routines[RT_Flush]), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(R8), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RDI), mo_none);
+    place(mc, has_room);
+    x86_put(mc, M_Mov, 8, mo_reg(RDI), mo_reg(RAX));
+    x86_put(mc, M_Test, 8, mo_reg(R8), mo_reg(R8));
+    jcc(mc, CC_NS, magnitude);
+    x86_put(mc, M_Neg, 8, mo_reg(RAX), mo_none);
+    place(mc, magnitude);
+    x86_put(mc, M_Lea, 8, mo_mem(RSP, -1), mo_reg(RSI));
+    x86_put(mc, M_MovAbs, 8, mo_imm(0x28F5C28F5C28F5C3ull), mo_reg(R9)); /* ceil(2^66 / 25) */
+    x86_put(mc, M_Lea, 8, mo_label(rt->pairs), mo_reg(R10));
+
+    place(mc, pair);
+    x86_put(mc, M_Cmp, 8, mo_imm(100), mo_reg(RAX));
+    jcc(mc, CC_B, last);
+    x86_put(mc, M_Mov, 8, mo_reg(RAX), mo_reg(RCX));
+    x86_put(mc, M_Shr, 8, mo_imm(2), mo_reg(RAX));
+    x86_put(mc, M_Mul, 8, mo_reg(R9), mo_none);
+    x86_put(mc, M_Shr, 8, mo_imm(2), mo_reg(RDX)); /* value / 100 */
+    x86_put(mc, M_Mov, 8, mo_reg(RDX), mo_reg(RAX));
+    x86_put(mc, M_Imul, 8, mo_imm(100), mo_reg(RDX));
+    x86_put(mc, M_Sub, 8, mo_reg(RDX), mo_reg(RCX)); /* value % 100 */
+    put_pair(mc, RCX);
+    x86_put(mc, M_Jmp, 0, mo_label(pair), mo_none);
+    place(mc, last);
+    x86_put(mc, M_Cmp, 8, mo_imm(10), mo_reg(RAX));
+    jcc(mc, CC_B, one);
+    put_pair(mc, RAX);
+    x86_put(mc, M_Jmp, 0, mo_label(sign), mo_none);
+    place(mc, one);
+    x86_put(mc, M_Add, 1, mo_imm('0'), mo_reg(RAX));
+    x86_put(mc, M_Mov, 1, mo_reg(RAX), mo_mem(RSI, 0));
+    x86_put(mc, M_Dec, 8, mo_reg(RSI), mo_none);
+
+    place(mc, sign);
+    x86_put(mc, M_Test, 8, mo_reg(R8), mo_reg(R8));
+    jcc(mc, CC_NS, copy);
+    x86_put(mc, M_Mov, 1, mo_imm('-'), mo_mem(RSI, 0));
+    x86_put(mc, M_Dec, 8, mo_reg(RSI), mo_none);
+    place(mc, copy);
+    x86_put(mc, M_Inc, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Mov, 8, mo_reg(RSP), mo_reg(RCX));
+    x86_put(mc, M_Sub, 8, mo_reg(RSI), mo_reg(RCX)); /* length */
+    x86_put(mc, M_Mov, 8, len, mo_reg(RAX));
+    x86_put(mc, M_Lea, 8, mo_label(rt->out), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RAX), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RCX), mo_reg(RAX));
+    x86_put(mc, M_Mov, 8, mo_reg(RAX), len);
+    for (int i = 0; i < RUNTIME_ROOM; i += 8) { /* what follows the digits is left out by the length */
+        x86_put(mc, M_Mov, 8, mo_mem(RSI, i), mo_reg(RDX));
+        x86_put(mc, M_Mov, 8, mo_reg(RDX), mo_mem(RDI, i));
+    }
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+}
+
+/* ZF set when <reg> holds a string, %edx is lost */
+static void is_string(MachineCode* mc, uint8_t reg) {
+    x86_put(mc, M_Mov, 4, mo_reg(reg), mo_reg(RDX));
+    x86_put(mc, M_And, 4, mo_imm(7), mo_reg(RDX));
+    x86_put(mc, M_Cmp, 4, mo_imm(IR_DYN_STRING), mo_reg(RDX));
+}
+
+/*
+** Slow paths of dynamic values, see IR_Dyn.
+** The generator checks that both operands are integers with one branch and calls these for anything else,
+** what comes back is two integers it goes over again, or for joined strings the result.
+*/
+static void emit_dynamic(MachineCode* mc, const Runtime* rt) {
+    const uint32_t a_int = local(mc, ".Lrt_a_int"), b_int = local(mc, ".Lrt_b_int"), tagged = local(mc, ".Lrt_print_tagged");
+    const uint32_t boolean = local(mc, ".Lrt_print_bool"), same = local(mc, ".Lrt_same"), differ = local(mc, ".Lrt_differ");
+    const uint32_t not_string = local(mc, ".Lrt_not_string"), loop = local(mc, ".Lrt_compare");
+    const uint32_t pop_same = local(mc, ".Lrt_pop_same"), pop_differ = local(mc, ".Lrt_pop_differ");
+    const uint32_t type_error = rt->routines[RT_TypeError];
+
+    /* %rdi, printed like a value of its static type would be */
+    place(mc, rt->routines[RT_PrintDyn]);
+    x86_put(mc, M_Test, 1, mo_imm(1), mo_reg(RDI));
+    jcc(mc, CC_NE, tagged);
+    x86_put(mc, M_Sar, 8, mo_imm(IR_DYN_INT_BITS), mo_reg(RDI));
+    x86_put(mc, M_Jmp, 0, mo_label(rt->routines[RT_PrintInt]), mo_none);
+    place(mc, tagged);
+    x86_put(mc, M_Test, 1, mo_imm(2), mo_reg(RDI));
+    jcc(mc, CC_NE, boolean);
+    x86_put(mc, M_Dec, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Jmp, 0, mo_label(rt->routines[RT_PrintStr]), mo_none);
+    place(mc, boolean);
+    x86_put(mc, M_Shr, 8, mo_imm(IR_DYN_BOOL_BITS), mo_reg(RDI));
+    x86_put(mc, M_Jmp, 0, mo_label(rt->routines[RT_PrintInt]), mo_none);
+
+    /* a boolean b<<3|3 shifted down by two is the integer b */
+    place(mc, rt->routines[RT_DynInts]);
+    x86_put(mc, M_Test, 1, mo_imm(1), mo_reg(RAX));
+    jcc(mc, CC_E, a_int);
+    x86_put(mc, M_Test, 1, mo_imm(2), mo_reg(RAX));
+    jcc(mc, CC_E, type_error);
+    x86_put(mc, M_Shr, 8, mo_imm(IR_DYN_BOOL_BITS - IR_DYN_INT_BITS), mo_reg(RAX));
+    place(mc, a_int);
+    x86_put(mc, M_Test, 1, mo_imm(1), mo_reg(R11));
+    jcc(mc, CC_E, b_int);
+    x86_put(mc, M_Test, 1, mo_imm(2), mo_reg(R11));
+    jcc(mc, CC_E, type_error);
+    x86_put(mc, M_Shr, 8, mo_imm(IR_DYN_BOOL_BITS - IR_DYN_INT_BITS), mo_reg(R11));
+    place(mc, b_int);
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+
+    /* two strings into a new one on the heap: the total length, then the bytes of each */
+    place(mc, rt->routines[RT_DynAdd]);
+    is_string(mc, RAX);
+    jcc(mc, CC_NE, rt->routines[RT_DynInts]);
+    is_string(mc, R11);
+    jcc(mc, CC_NE, rt->routines[RT_DynInts]);
+    x86_put(mc, M_Push, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Push, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Push, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Mov, 8, mo_mem(RAX, -IR_DYN_STRING), mo_reg(RCX));
+    x86_put(mc, M_Mov, 8, mo_mem(R11, -IR_DYN_STRING), mo_reg(RDX));
+    x86_put(mc, M_Mov, 8, mo_label(rt->heap_len), mo_reg(RSI));
+    x86_put(mc, M_Mov, 8, mo_reg(RCX), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RDX), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_imm(8 + 7), mo_reg(RDI)); /* the length, then up to whole words */
+    x86_put(mc, M_And, 8, mo_imm(-8), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RSI), mo_reg(RDI));
+    x86_put(mc, M_Cmp, 8, mo_imm(RUNTIME_HEAP_SIZE), mo_reg(RDI));
+    jcc(mc, CC_A, rt->routines[RT_OutOfMemory]);
+    x86_put(mc, M_Mov, 8, mo_reg(RDI), mo_label(rt->heap_len));
+    x86_put(mc, M_Lea, 8, mo_label(rt->heap), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RSI), mo_reg(RDI));
+    x86_put(mc, M_Push, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Mov, 8, mo_reg(RCX), mo_mem(RDI, 0));
+    x86_put(mc, M_Add, 8, mo_reg(RDX), mo_mem(RDI, 0));
+    x86_put(mc, M_Add, 8, mo_imm(8), mo_reg(RDI));
+    x86_put(mc, M_Lea, 8, mo_mem(RAX, 8 - IR_DYN_STRING), mo_reg(RSI));
+    x86_put(mc, M_RepMovsb, 0, mo_none, mo_none);
+    x86_put(mc, M_Lea, 8, mo_mem(R11, 8 - IR_DYN_STRING), mo_reg(RSI));
+    x86_put(mc, M_Mov, 8, mo_reg(RDX), mo_reg(RCX));
+    x86_put(mc, M_RepMovsb, 0, mo_none, mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RAX), mo_none);
+    x86_put(mc, M_Or, 8, mo_imm(IR_DYN_STRING), mo_reg(RAX));
+    x86_put(mc, M_Pop, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+
+    /* strings by their bytes, a string and anything else differ, the rest as integers */
+    place(mc, rt->routines[RT_DynEq]);
+    x86_put(mc, M_Cmp, 8, mo_reg(R11), mo_reg(RAX));
+    jcc(mc, CC_E, same);
+    is_string(mc, RAX);
+    jcc(mc, CC_NE, not_string);
+    is_string(mc, R11);
+    jcc(mc, CC_NE, differ);
+    x86_put(mc, M_Push, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Push, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Push, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Mov, 8, mo_mem(RAX, -IR_DYN_STRING), mo_reg(RCX));
+    x86_put(mc, M_Cmp, 8, mo_mem(R11, -IR_DYN_STRING), mo_reg(RCX));
+    jcc(mc, CC_NE, pop_differ);
+    x86_put(mc, M_Lea, 8, mo_mem(RAX, 8 - IR_DYN_STRING), mo_reg(RSI));
+    x86_put(mc, M_Lea, 8, mo_mem(R11, 8 - IR_DYN_STRING), mo_reg(RDI));
+    place(mc, loop);
+    x86_put(mc, M_Test, 8, mo_reg(RCX), mo_reg(RCX));
+    jcc(mc, CC_E, pop_same);
+    x86_put(mc, M_Mov, 1, mo_mem(RSI, 0), mo_reg(RDX));
+    x86_put(mc, M_Cmp, 1, mo_mem(RDI, 0), mo_reg(RDX));
+    jcc(mc, CC_NE, pop_differ);
+    x86_put(mc, M_Inc, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Inc, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Dec, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Jmp, 0, mo_label(loop), mo_none);
+    place(mc, pop_same);
+    x86_put(mc, M_Pop, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Jmp, 0, mo_label(same), mo_none);
+    place(mc, pop_differ);
+    x86_put(mc, M_Pop, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Jmp, 0, mo_label(differ), mo_none);
+    place(mc, not_string);
+    is_string(mc, R11);
+    jcc(mc, CC_NE, rt->routines[RT_DynInts]);
+    place(mc, differ);
+    x86_put(mc, M_Xor, 4, mo_reg(RAX), mo_reg(RAX));
+    x86_put(mc, M_Mov, 4, mo_imm(1 << IR_DYN_INT_BITS), mo_reg(R11));
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+    place(mc, same);
+    x86_put(mc, M_Xor, 4, mo_reg(RAX), mo_reg(RAX));
+    x86_put(mc, M_Xor, 4, mo_reg(R11), mo_reg(R11));
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+}
+
+/*{==================================*/
+/*
+** API
+*/
+void runtime_declare(MachineCode* mc, Runtime* rt) {
+    const uint32_t count = rt->dynamic ? RT_Count : RT_FirstDynamic;
+    for (uint32_t i = 0; i < count; i++)
+        rt->routines[i] = x86_label(mc, MS_Text, ROUTINE_NAMES[i], (uint32_t)strlen(ROUTINE_NAMES[i]));
+    rt->out = x86_label(mc, MS_Bss, "__pya_out", 9);
+    rt->out_len = x86_label(mc, MS_Bss, "__pya_out_len", 13);
+    rt_push(mc->arena, mc->bss, ((MBss){.label = rt->out_len, .size = 8}));
+    rt_push(mc->arena, mc->bss, ((MBss){.label = rt->out, .size = RUNTIME_OUT_SIZE}));
+    if (rt->dynamic) {
+        rt->heap = x86_label(mc, MS_Bss, "__pya_heap", 10);
+        rt->heap_len = x86_label(mc, MS_Bss, "__pya_heap_len", 14);
+        rt_push(mc->arena, mc->bss, ((MBss){.label = rt->heap_len, .size = 8}));
+        rt_push(mc->arena, mc->bss, ((MBss){.label = rt->heap, .size = RUNTIME_HEAP_SIZE}));
+    }
+    rt->pairs = x86_label(mc, MS_Rodata, "__pya_digit_pairs", 17);
+    rt_push(mc->arena, mc->strings, ((MString){.label = rt->pairs, .text = intern(mc->symbols, DIGIT_PAIRS, sizeof(DIGIT_PAIRS))}));
+    for (uint32_t i = 0; i < count; i++) {
+        if (TRAP_TEXTS[i].text == NULL)
+            continue;
+        rt->texts[i] = x86_label(mc, MS_Rodata, TRAP_TEXTS[i].label, (uint32_t)strlen(TRAP_TEXTS[i].label));
+        rt_push(mc->arena, mc->strings, ((MString){.label = rt->texts[i], .text = intern(mc->symbols, TRAP_TEXTS[i].text, (uint32_t)strlen(TRAP_TEXTS[i].text))}));
+    }
+}
+
+void runtime_emit(MachineCode* mc, const Runtime* rt) {
+    const uint32_t write = local(mc, ".Lrt_write"), write_done = local(mc, ".Lrt_write_done");
+    const uint32_t append = local(mc, ".Lrt_append"), copy = local(mc, ".Lrt_copy"), put = local(mc, ".Lrt_put");
+    const MOperand len = mo_label(rt->out_len), out = mo_label(rt->out);
+
+    /* %edi = file, %rsi = bytes, %rdx = count, all of it, a failed write drops the rest */
+    place(mc, write);
+    x86_put(mc, M_Test, 8, mo_reg(RDX), mo_reg(RDX));
+    jcc(mc, CC_E, write_done);
+    x86_put(mc, M_Mov, 4, mo_imm(1), mo_reg(RAX));
+    x86_put(mc, M_Syscall, 0, mo_none, mo_none);
+    x86_put(mc, M_Test, 8, mo_reg(RAX), mo_reg(RAX));
+    jcc(mc, CC_LE, write_done);
+    x86_put(mc, M_Add, 8, mo_reg(RAX), mo_reg(RSI));
+    x86_put(mc, M_Sub, 8, mo_reg(RAX), mo_reg(RDX));
+    x86_put(mc, M_Jmp, 0, mo_label(write), mo_none);
+    place(mc, write_done);
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+
+    place(mc, rt->routines[RT_Flush]);
+    x86_put(mc, M_Mov, 4, mo_imm(1), mo_reg(RDI));
+    x86_put(mc, M_Lea, 8, out, mo_reg(RSI));
+    x86_put(mc, M_Mov, 8, len, mo_reg(RDX));
+    x86_put(mc, M_Mov, 8, mo_imm(0), len);
+    x86_put(mc, M_Jmp, 0, mo_label(write), mo_none);
+
+    /* %rsi = bytes, %rcx = count, into the buffer, or straight out when they don't fit even once it is empty */
+    place(mc, append);
+    x86_put(mc, M_Mov, 8, len, mo_reg(RAX));
+    x86_put(mc, M_Mov, 8, mo_reg(RAX), mo_reg(RDX));
+    x86_put(mc, M_Add, 8, mo_reg(RCX), mo_reg(RDX));
+    x86_put(mc, M_Cmp, 8, mo_imm(RUNTIME_OUT_SIZE), mo_reg(RDX));
+    jcc(mc, CC_BE, copy);
+    x86_put(mc, M_Push, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Push, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Call, 0, mo_label(rt->routines[RT_Flush]), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RCX), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RSI), mo_none);
+    x86_put(mc, M_Xor, 4, mo_reg(RAX), mo_reg(RAX));
+    x86_put(mc, M_Cmp, 8, mo_imm(RUNTIME_OUT_SIZE), mo_reg(RCX));
+    jcc(mc, CC_BE, copy);
+    x86_put(mc, M_Mov, 8, mo_reg(RCX), mo_reg(RDX));
+    x86_put(mc, M_Mov, 4, mo_imm(1), mo_reg(RDI));
+    x86_put(mc, M_Jmp, 0, mo_label(write), mo_none);
+    place(mc, copy);
+    x86_put(mc, M_Lea, 8, out, mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RAX), mo_reg(RDI));
+    x86_put(mc, M_Add, 8, mo_reg(RCX), mo_reg(RAX));
+    x86_put(mc, M_Mov, 8, mo_reg(RAX), len);
+    x86_put(mc, M_RepMovsb, 0, mo_none, mo_none);
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+
+    /* %rdi = string, the 8 byte length then the bytes */
+    place(mc, rt->routines[RT_PrintStr]);
+    x86_put(mc, M_Mov, 8, mo_mem(RDI, 0), mo_reg(RCX));
+    x86_put(mc, M_Lea, 8, mo_mem(RDI, 8), mo_reg(RSI));
+    x86_put(mc, M_Jmp, 0, mo_label(append), mo_none);
+
+    /* %dil = character */
+    place(mc, rt->routines[RT_PrintChar]);
+    x86_put(mc, M_Mov, 8, len, mo_reg(RAX));
+    x86_put(mc, M_Cmp, 8, mo_imm(RUNTIME_OUT_SIZE), mo_reg(RAX));
+    jcc(mc, CC_B, put);
+    x86_put(mc, M_Push, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Call, 0, mo_label(rt->routines[RT_Flush]), mo_none);
+    x86_put(mc, M_Pop, 8, mo_reg(RDI), mo_none);
+    x86_put(mc, M_Xor, 4, mo_reg(RAX), mo_reg(RAX));
+    place(mc, put);
+    x86_put(mc, M_Lea, 8, out, mo_reg(RCX));
+    x86_put(mc, M_Add, 8, mo_reg(RAX), mo_reg(RCX));
+    x86_put(mc, M_Mov, 1, mo_reg(RDI), mo_mem(RCX, 0));
+    x86_put(mc, M_Inc, 8, mo_reg(RAX), mo_none);
+    x86_put(mc, M_Mov, 8, mo_reg(RAX), len);
+    x86_put(mc, M_Ret, 0, mo_none, mo_none);
+
+    emit_integers(mc, rt);
+    if (rt->dynamic)
+        emit_dynamic(mc, rt);
+
+    /* jumped to from anywhere, the message goes in %r8 which flushing leaves alone */
+    const uint32_t trap = local(mc, ".Lrt_trap");
+    for (uint32_t i = 0; i < (rt->dynamic ? RT_Count : RT_FirstDynamic); i++) {
+        if (TRAP_TEXTS[i].text == NULL)
+            continue;
+        place(mc, rt->routines[i]);
+        x86_put(mc, M_Lea, 8, mo_label(rt->texts[i]), mo_reg(R8));
+        x86_put(mc, M_Jmp, 0, mo_label(trap), mo_none);
+    }
+    place(mc, trap);
+    x86_put(mc, M_Call, 0, mo_label(rt->routines[RT_Flush]), mo_none);
+    x86_put(mc, M_Mov, 4, mo_imm(2), mo_reg(RDI));
+    x86_put(mc, M_Mov, 8, mo_mem(R8, 0), mo_reg(RDX));
+    x86_put(mc, M_Lea, 8, mo_mem(R8, 8), mo_reg(RSI));
+    x86_put(mc, M_Call, 0, mo_label(write), mo_none);
+    x86_put(mc, M_Mov, 4, mo_imm(60), mo_reg(RAX));
+    x86_put(mc, M_Mov, 4, mo_imm(1), mo_reg(RDI));
+    x86_put(mc, M_Syscall, 0, mo_none, mo_none);
+}
@@ -0,0 +1,122 @@
+/*
+** Fast skipping over long runs for the lexer.
+** Each scanner returns the first "interesting" byte at or after <p> (or <end>).
+** SSE2/AVX2 kernels on x86, picked at runtime, scalar everywhere else.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "head.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+/*
+** Scalar
+*/
+#define is_ident_chr(CHR) ((((CHR) | 0x20) >= 'a' && ((CHR) | 0x20) <= 'z') || ((CHR) >= '0' && (CHR) <= '9') || (CHR) == '_')
+#define is_space_chr(CHR) ((CHR) == ' ' || (CHR) == '\t' || (CHR) == '\f' || (CHR) == '\v')
+#define is_line_end_chr(CHR) ((CHR) == '\n' || (CHR) == '\r' || (CHR) == '\0')
+#define is_multi_comment_stop(CHR) (is_line_end_chr(CHR) || (CHR) == '\'')
+#define is_string_stop(CHR) (is_line_end_chr(CHR) || (CHR) == '\\' || (CHR) == '\'' || (CHR) == '"')
+
+#define scalar_scanner(_name, _cond)                                    \
+static const char* _name(const char* p, const char* end) {              \
+    while (p < end && (_cond(*p)))                                      \
+        p++;                                                            \
+    return p;                                                           \
+}
+scalar_scanner(ident_scalar, is_ident_chr)
+scalar_scanner(space_scalar, is_space_chr)
+#define not_line_end_chr(CHR) (!is_line_end_chr(CHR))
+#define not_multi_comment_stop(CHR) (!is_multi_comment_stop(CHR))
+#define not_string_stop(CHR) (!is_string_stop(CHR))
+scalar_scanner(line_comment_scalar, not_line_end_chr)
+scalar_scanner(multi_comment_scalar, not_multi_comment_stop)
+scalar_scanner(string_scalar, not_string_stop)
+
+#if SCAN_X86
+/*
+** SSE2/AVX2, <_mask> turns a vector into a bitmask of the bytes to keep skipping.
+** The tail shorter than a vector goes through the scalar scanner.
+*/
+#define vector_scanner(_name, _target, _vec, _width, _load, _movemask, _mask, _scalar, _full) \
+__attribute__((target(_target)))                                        \
+static const char* _name(const char* p, const char* end) {              \
+    while (end - p >= _width) {                                         \
+        _vec v = _load((const _vec*)p);                                 \
+        uint32_t keep = (uint32_t)_movemask(_mask(v));                  \
+        if (keep != (uint32_t)(_full))                                  \
+            return p + __builtin_ctz(~keep);                            \
+        p += _width;                                                    \
+    }                                                                   \
+    return _scalar(p, end);                                             \
+}
+
+/* unsigned "lo <= v <= lo+n" through a signed compare */
+#define sse_in_range(v, lo, n) _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(128-(lo)))), _mm_set1_epi8((char)(-128+(n)+1)))
+#define sse_eq(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define avx_in_range(v, lo, n) _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128+(n)+1)), _mm256_add_epi8(v, _mm256_set1_epi8((char)(128-(lo)))))
+#define avx_eq(v, c) _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+
+#define sse_ident(v) _mm_or_si128(_mm_or_si128(sse_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 25), sse_in_range(v, '0', 9)), sse_eq(v, '_'))
+#define sse_space(v) _mm_or_si128(_mm_or_si128(sse_eq(v, ' '), sse_eq(v, '\t')), _mm_or_si128(sse_eq(v, '\f'), sse_eq(v, '\v')))
+#define sse_line_end(v) _mm_or_si128(_mm_or_si128(sse_eq(v, '\n'), sse_eq(v, '\r')), sse_eq(v, '\0'))
+#define sse_not(x) _mm_xor_si128(x, _mm_set1_epi8(-1))
+#define sse_line_comment(v) sse_not(sse_line_end(v))
+#define sse_multi_comment(v) sse_not(_mm_or_si128(sse_line_end(v), sse_eq(v, '\'')))
+#define sse_string(v) sse_not(_mm_or_si128(_mm_or_si128(sse_line_end(v), sse_eq(v, '\\')), _mm_or_si128(sse_eq(v, '\''), sse_eq(v, '"'))))
+
+#define avx_ident(v) _mm256_or_si256(_mm256_or_si256(avx_in_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 25), avx_in_range(v, '0', 9)), avx_eq(v, '_'))
+#define avx_space(v) _mm256_or_si256(_mm256_or_si256(avx_eq(v, ' '), avx_eq(v, '\t')), _mm256_or_si256(avx_eq(v, '\f'), avx_eq(v, '\v')))
+#define avx_line_end(v) _mm256_or_si256(_mm256_or_si256(avx_eq(v, '\n'), avx_eq(v, '\r')), avx_eq(v, '\0'))
+#define avx_not(x) _mm256_xor_si256(x, _mm256_set1_epi8(-1))
+#define avx_line_comment(v) avx_not(avx_line_end(v))
+#define avx_multi_comment(v) avx_not(_mm256_or_si256(avx_line_end(v), avx_eq(v, '\'')))
+#define avx_string(v) avx_not(_mm256_or_si256(_mm256_or_si256(avx_line_end(v), avx_eq(v, '\\')), _mm256_or_si256(avx_eq(v, '\''), avx_eq(v, '"'))))
+
+vector_scanner(ident_sse2, "sse2", __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8, sse_ident, ident_scalar, 0xFFFF)
+vector_scanner(space_sse2, "sse2", __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8, sse_space, space_scalar, 0xFFFF)
+vector_scanner(line_comment_sse2, "sse2", __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8, sse_line_comment, line_comment_scalar, 0xFFFF)
+vector_scanner(multi_comment_sse2, "sse2", __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8, sse_multi_comment, multi_comment_scalar, 0xFFFF)
+vector_scanner(string_sse2, "sse2", __m128i, 16, _mm_loadu_si128, _mm_movemask_epi8, sse_string, string_scalar, 0xFFFF)
+
+vector_scanner(ident_avx2, "avx2", __m256i, 32, _mm256_loadu_si256, _mm256_movemask_epi8, avx_ident, ident_scalar, 0xFFFFFFFF)
+vector_scanner(space_avx2, "avx2", __m256i, 32, _mm256_loadu_si256, _mm256_movemask_epi8, avx_space, space_scalar, 0xFFFFFFFF)
+vector_scanner(line_comment_avx2, "avx2", __m256i, 32, _mm256_loadu_si256, _mm256_movemask_epi8, avx_line_comment, line_comment_scalar, 0xFFFFFFFF)
+vector_scanner(multi_comment_avx2, "avx2", __m256i, 32, _mm256_loadu_si256, _mm256_movemask_epi8, avx_multi_comment, multi_comment_scalar, 0xFFFFFFFF)
+vector_scanner(string_avx2, "avx2", __m256i, 32, _mm256_loadu_si256, _mm256_movemask_epi8, avx_string, string_scalar, 0xFFFFFFFF)
+#endif
+
+/*}=======================*/
+
+/*
+** API
+*/
+ScanKernels scan_kernels = {
+    .name = "scalar",
+    .ident = ident_scalar,
+    .space = space_scalar,
+    .line_comment = line_comment_scalar,
+    .multi_comment = multi_comment_scalar,
+    .string = string_scalar,
+};
+
+void scan_init(ScanLevel max) {
+    scan_kernels = (ScanKernels){"scalar", ident_scalar, space_scalar, line_comment_scalar, multi_comment_scalar, string_scalar};
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (max >= ScanAVX2 && __builtin_cpu_supports("avx2")) {
+        scan_kernels = (ScanKernels){"avx2", ident_avx2, space_avx2, line_comment_avx2, multi_comment_avx2, string_avx2};
+        return;
+    }
+    if (max >= ScanSSE2 && __builtin_cpu_supports("sse2")) {
+        scan_kernels = (ScanKernels){"sse2", ident_sse2, space_sse2, line_comment_sse2, multi_comment_sse2, string_sse2};
+        return;
+    }
+#endif
+    (void)max;
+}
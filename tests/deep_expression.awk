@@ -0,0 +1,23 @@
+# Expressions nested deeper than the C stack could recurse: parentheses, calls, a long chain, casts.
+BEGIN {
+    n = 200000
+    print "def f(x: i64) -> i64:"
+    print "    return x"
+    print "end"
+    printf "a = "
+    for (i = 0; i < n; i++) printf "(1 + "
+    printf "0"
+    for (i = 0; i < n; i++) printf ")"
+    printf "\nb = "
+    for (i = 0; i < n; i++) printf "f("
+    printf "2"
+    for (i = 0; i < n; i++) printf ")"
+    printf "\nc = 1"
+    for (i = 0; i < n; i++) printf " - 1"
+    printf "\nd = "
+    for (i = 0; i < n; i++) printf "string("
+    printf "3"
+    for (i = 0; i < n; i++) printf ")"
+    print ""
+    print "print(a, b, c, d)"
+}
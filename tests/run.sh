@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Regression tests: every tests/<name>.sn is compiled with the given pya.
+# With a <name>.out, the program has to build and print exactly that.
+# With a <name>.err, the build has to fail and print that message (on either stream).
+# A <name>.awk prints a source too big to keep, it is tested like a <name>.sn.
+#
+PYA=${1:-./pya}
+DIR=$(dirname "$0")
+TMP=${TMPDIR:-/tmp}/pya-tests.$$
+mkdir -p "$TMP"
+trap 'rm -rf "$TMP"' EXIT
+
+passed=0
+failed=0
+for src in "$DIR"/*.sn "$DIR"/*.awk; do
+    [ -f "$src" ] || continue
+    name=$(basename "$src" .awk)
+    name=$(basename "$name" .sn)
+    if [ "${src%.awk}" != "$src" ]; then
+        awk -f "$src" >"$TMP/$name.sn"
+        src=$TMP/$name.sn
+    fi
+    if [ -f "$DIR/$name.err" ]; then
+        if "$PYA" -o "$TMP/$name" "$src" >"$TMP/$name.log" 2>&1; then
+            echo "FAIL $name: built, expected an error"
+            failed=$((failed+1))
+            continue
+        fi
+        if ! sed 's/\x1b\[[0-9;]*m//g' "$TMP/$name.log" | grep -qF "$(cat "$DIR/$name.err")"; then
+            echo "FAIL $name: expected \"$(cat "$DIR/$name.err")\", got:"
+            sed 's/\x1b\[[0-9;]*m//g' "$TMP/$name.log"
+            failed=$((failed+1))
+            continue
+        fi
+    else
+        if ! "$PYA" -o "$TMP/$name" "$src" >/dev/null 2>"$TMP/$name.log"; then
+            echo "FAIL $name: did not build"
+            sed 's/\x1b\[[0-9;]*m//g' "$TMP/$name.log"
+            failed=$((failed+1))
+            continue
+        fi
+        "$TMP/$name" >"$TMP/$name.txt" 2>&1
+        if ! cmp -s "$TMP/$name.txt" "$DIR/$name.out"; then
+            echo "FAIL $name:"
+            diff "$DIR/$name.out" "$TMP/$name.txt"
+            failed=$((failed+1))
+            continue
+        fi
+    fi
+    passed=$((passed+1))
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,509 @@
+/*
+** x86-64 machine code.
+** The generator appends instructions here, then they are either printed as GNU as text or
+** encoded in process, so building a program needs no assembler.
+** Only the forms the generator and the runtime use are encoded.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "head.h"
+
+/* config */
+#define X86_INIT_CAPACITY       256
+#define X86_GROWTH              2
+/*}=======================*/
+
+#define x86_push(_arena, _arr, _val) do {                                                                           \
+    if ((_arr).siz + 1 > (_arr).cap) {                                                                              \
+        (_arr).v = arena_realloc(_arena, (_arr).v, sizeof(*(_arr).v)*(_arr).cap, sizeof(*(_arr).v)*(_arr).cap*X86_GROWTH); \
+        (_arr).cap *= X86_GROWTH;                                                                                   \
+    }                                                                                                               \
+    (_arr).v[(_arr).siz++] = (_val);                                                                                \
+} while (0)
+
+#define x86_init(_arena, _arr) do {                                         \
+    (_arr).v = arena_alloc(_arena, sizeof(*(_arr).v)*X86_INIT_CAPACITY);    \
+    (_arr).siz = 0;                                                         \
+    (_arr).cap = X86_INIT_CAPACITY;                                         \
+} while (0)
+
+/*
+** Text
+*/
+
+/* by width, 8 4 2 1 bytes */
+static const char* REG_NAMES[16][4] = {
+    {"%rax", "%eax", "%ax", "%al"},     {"%rcx", "%ecx", "%cx", "%cl"},
+    {"%rdx", "%edx", "%dx", "%dl"},     {"%rbx", "%ebx", "%bx", "%bl"},
+    {"%rsp", "%esp", "%sp", "%spl"},    {"%rbp", "%ebp", "%bp", "%bpl"},
+    {"%rsi", "%esi", "%si", "%sil"},    {"%rdi", "%edi", "%di", "%dil"},
+    {"%r8", "%r8d", "%r8w", "%r8b"},    {"%r9", "%r9d", "%r9w", "%r9b"},
+    {"%r10", "%r10d", "%r10w", "%r10b"}, {"%r11", "%r11d", "%r11w", "%r11b"},
+    {"%r12", "%r12d", "%r12w", "%r12b"}, {"%r13", "%r13d", "%r13w", "%r13b"},
+    {"%r14", "%r14d", "%r14w", "%r14b"}, {"%r15", "%r15d", "%r15w", "%r15b"},
+};
+#define width_index(_w) ((_w) == 8 ? 0 : (_w) == 4 ? 1 : (_w) == 2 ? 2 : 3)
+
+static const char* COND_NAMES[16] = {"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g"};
+
+/* mnemonics that take the b/w/l/q suffix, the rest are spelled out */
+static const char* OP_NAMES[M_OpCount] = {
+    [M_Mov] = "mov", [M_Lea] = "lea", [M_Add] = "add", [M_Sub] = "sub", [M_Imul] = "imul", [M_Xor] = "xor",
+    [M_And] = "and", [M_Or] = "or", [M_Cmp] = "cmp", [M_Test] = "test", [M_Shl] = "shl", [M_Shr] = "shr",
+    [M_Sar] = "sar", [M_Neg] = "neg", [M_Inc] = "inc",
+    [M_Dec] = "dec", [M_Mul] = "mul", [M_Div] = "div", [M_Idiv] = "idiv", [M_Push] = "push", [M_Pop] = "pop",
+};
+static const char SUFFIX[9] = {[1] = 'b', [2] = 'w', [4] = 'l', [8] = 'q'};
+
+static void print_operand(const MachineCode* mc, MOperand o, uint8_t width, FILE* out) {
+    switch (o.kind) {
+        case MO_Reg: fputs(REG_NAMES[o.reg][width_index(width)], out); break;
+        case MO_Imm: fprintf(out, "$%lld", (long long)o.imm); break;
+        case MO_Mem: {
+            if (o.imm != 0)
+                fprintf(out, "%lld", (long long)o.imm);
+            fprintf(out, "(%s)", REG_NAMES[o.reg][0]);
+            break;
+        }
+        case MO_Label: fprintf(out, "%.*s(%%rip)", (int)mc->labels.v[o.imm].len, mc->labels.v[o.imm].name); break;
+        default: break;
+    }
+}
+
+#define label_text(_mc, _l) (int)(_mc)->labels.v[_l].len, (_mc)->labels.v[_l].name
+
+static void print_inst(const MachineCode* mc, const MInst* in, FILE* out) {
+    switch ((MOp)in->op) {
+        case M_Label: {
+            if (mc->labels.v[in->src.imm].global)
+                fprintf(out, "    .globl %.*s\n", label_text(mc, in->src.imm));
+            fprintf(out, "%.*s:\n", label_text(mc, in->src.imm));
+            return;
+        }
+        case M_MovAbs: fprintf(out, "    movabsq "); break;
+        case M_Movsx: fprintf(out, "    movs%c%c ", SUFFIX[in->aux], SUFFIX[in->width]); break;
+        case M_Movzx: fprintf(out, "    movz%c%c ", SUFFIX[in->aux], SUFFIX[in->width]); break;
+        case M_Cqto: fprintf(out, "    cqto\n"); return;
+        case M_RepMovsb: fprintf(out, "    rep movsb\n"); return;
+        case M_Setcc: fprintf(out, "    set%s ", COND_NAMES[in->aux]); break;
+        case M_Jmp: fprintf(out, "    jmp %.*s\n", label_text(mc, in->src.imm)); return;
+        case M_Jcc: fprintf(out, "    j%s %.*s\n", COND_NAMES[in->aux], label_text(mc, in->src.imm)); return;
+        case M_Call: fprintf(out, "    call %.*s\n", label_text(mc, in->src.imm)); return;
+        case M_Ret: fprintf(out, "    ret\n"); return;
+        case M_Leave: fprintf(out, "    leave\n"); return;
+        case M_Syscall: fprintf(out, "    syscall\n"); return;
+        default: fprintf(out, "    %s%c ", OP_NAMES[in->op], SUFFIX[in->width]); break;
+    }
+
+    /* movs/movz read a narrower source */
+    const uint8_t src_width = in->op == M_Movsx || in->op == M_Movzx ? in->aux : in->width;
+    print_operand(mc, in->src, src_width, out);
+    if (in->dst.kind != MO_None) {
+        fputs(", ", out);
+        print_operand(mc, in->dst, in->width, out);
+    }
+    fputc('\n', out);
+}
+
+/* .ascii body, everything outside printable ASCII is escaped */
+static void print_string(const MachineCode* mc, Symbol str, FILE* out) {
+    const char* txt = symbol_name(mc->symbols, str);
+    const uint32_t len = symbol_len(mc->symbols, str);
+    fprintf(out, "    .quad %u\n", len);
+    fprintf(out, "    .ascii \"");
+    for (uint32_t i = 0; i < len; i++) {
+        const unsigned char c = (unsigned char)txt[i];
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 32 || c > 126)
+            fprintf(out, "\\%03o", c);
+        else
+            fputc(c, out);
+    }
+    fprintf(out, "\"\n");
+}
+
+/*
+** Encoding
+*/
+
+/* one instruction, at most 15 bytes */
+typedef struct Encoding {
+    uint8_t bytes[16];
+    uint8_t len;
+    int8_t disp; /* where the %rip displacement of a label starts, -1 if none */
+} Encoding;
+
+#define put_byte(_e, _b) ((_e)->bytes[(_e)->len++] = (uint8_t)(_b))
+
+static void put_le(Encoding* e, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        put_byte(e, value >> (i*8));
+}
+
+#define fits8(_v) ((_v) >= -128 && (_v) <= 127)
+#define fits32(_v) ((_v) >= INT32_MIN && (_v) <= INT32_MAX)
+/* %spl %bpl %sil %dil only exist with a REX prefix, without one they are %ah %ch %dh %bh */
+#define needs_rex8(_r) ((_r) >= RSP && (_r) <= RDI)
+
+/*
+** Prefixes, <opcode> and the ModRM of <rm> with <reg> (a register or an opcode digit) in the reg field.
+** <bytes> is the width of the operation, byte registers are spelled out by <reg_byte> and the width.
+*/
+static void put_rm(Encoding* e, uint8_t bytes, uint8_t reg, int reg_byte, MOperand rm, const uint8_t* opcode, int opcode_len) {
+    if (bytes == 2)
+        put_byte(e, 0x66);
+    uint8_t rex = 0x40 | (bytes == 8 ? 8 : 0) | (reg & 8 ? 4 : 0) | ((rm.kind == MO_Reg || rm.kind == MO_Mem) && (rm.reg & 8) ? 1 : 0);
+    if (rex != 0x40 || (reg_byte && needs_rex8(reg)) || (bytes == 1 && rm.kind == MO_Reg && needs_rex8(rm.reg)))
+        put_byte(e, rex);
+    for (int i = 0; i < opcode_len; i++)
+        put_byte(e, opcode[i]);
+
+    const uint8_t r = (uint8_t)((reg & 7) << 3);
+    switch (rm.kind) {
+        case MO_Reg: put_byte(e, 0xC0 | r | (rm.reg & 7)); break;
+        case MO_Mem: {
+            const int64_t disp = rm.imm;
+            const uint8_t mod = disp == 0 && (rm.reg & 7) != RBP ? 0x00 : fits8(disp) ? 0x40 : 0x80;
+            put_byte(e, mod | r | (rm.reg & 7));
+            if ((rm.reg & 7) == RSP)
+                put_byte(e, 0x24); /* SIB, no index */
+            if (mod == 0x40)
+                put_byte(e, disp);
+            else if (mod == 0x80)
+                put_le(e, (uint64_t)disp, 4);
+            break;
+        }
+        case MO_Label: {
+            put_byte(e, 0x05 | r);
+            e->disp = (int8_t)e->len;
+            put_le(e, 0, 4);
+            break;
+        }
+        default: break;
+    }
+}
+#define put_rm1(_e, _bytes, _reg, _reg_byte, _rm, _op) do { const uint8_t _o[] = {_op}; put_rm(_e, _bytes, _reg, _reg_byte, _rm, _o, 1); } while (0)
+#define put_rm2(_e, _bytes, _reg, _reg_byte, _rm, _op1, _op2) do { const uint8_t _o[] = {_op1, _op2}; put_rm(_e, _bytes, _reg, _reg_byte, _rm, _o, 2); } while (0)
+
+/* opcode with the register in its low bits */
+static void put_plus_reg(Encoding* e, int wide, uint8_t reg, uint8_t opcode, int byte_reg) {
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg & 8 ? 1 : 0);
+    if (rex != 0x40 || (byte_reg && needs_rex8(reg)))
+        put_byte(e, rex);
+    put_byte(e, opcode + (reg & 7));
+}
+
+/* digit of the 0x80/0x81/0x83 group and base opcode of each ALU operation */
+static const uint8_t ALU_DIGIT[M_OpCount] = {[M_Add] = 0, [M_Or] = 1, [M_And] = 4, [M_Sub] = 5, [M_Xor] = 6, [M_Cmp] = 7};
+static const uint8_t UNARY_DIGIT[M_OpCount] = {[M_Neg] = 3, [M_Mul] = 4, [M_Div] = 6, [M_Idiv] = 7, [M_Inc] = 0, [M_Dec] = 1, [M_Shl] = 4, [M_Shr] = 5, [M_Sar] = 7};
+
+/*
+** <in> at its shortest, jumps and calls get the displacement <rel> to their target.
+** <near> jumps take 8 bits, the others 32.
+*/
+static void encode(const MInst* in, int32_t rel, int near, Encoding* e) {
+    e->len = 0;
+    e->disp = -1;
+    const uint8_t w = in->width;
+    const MOperand src = in->src, dst = in->dst;
+    switch ((MOp)in->op) {
+        case M_Label: break;
+        case M_Mov: {
+            if (src.kind == MO_Reg)
+                put_rm1(e, w, src.reg, w == 1, dst, w == 1 ? 0x88 : 0x89);
+            else if (src.kind != MO_Imm)
+                put_rm1(e, w, dst.reg, w == 1, src, w == 1 ? 0x8A : 0x8B);
+            else if (dst.kind == MO_Reg && w == 4) {
+                put_plus_reg(e, 0, dst.reg, 0xB8, 0);
+                put_le(e, (uint64_t)src.imm, 4);
+            } else if (dst.kind == MO_Reg && w == 1) {
+                put_plus_reg(e, 0, dst.reg, 0xB0, 1);
+                put_byte(e, src.imm);
+            } else {
+                put_rm1(e, w, 0, 0, dst, w == 1 ? 0xC6 : 0xC7);
+                put_le(e, (uint64_t)src.imm, w == 1 ? 1 : w == 2 ? 2 : 4);
+            }
+            break;
+        }
+        case M_MovAbs: {
+            put_plus_reg(e, 1, dst.reg, 0xB8, 0);
+            put_le(e, (uint64_t)src.imm, 8);
+            break;
+        }
+        case M_Movsx: {
+            if (in->aux == 4)
+                put_rm1(e, w, dst.reg, 0, src, 0x63);
+            else if (in->aux == 2)
+                put_rm2(e, w, dst.reg, 0, src, 0x0F, 0xBF);
+            else /* the source is a byte register */
+                put_rm2(e, src.kind == MO_Reg && needs_rex8(src.reg) && w != 8 ? 1 : w, dst.reg, 0, src, 0x0F, 0xBE);
+            break;
+        }
+        case M_Movzx: {
+            if (in->aux == 2)
+                put_rm2(e, w, dst.reg, 0, src, 0x0F, 0xB7);
+            else
+                put_rm2(e, src.kind == MO_Reg && needs_rex8(src.reg) && w != 8 ? 1 : w, dst.reg, 0, src, 0x0F, 0xB6);
+            break;
+        }
+        case M_Lea: put_rm1(e, 8, dst.reg, 0, src, 0x8D); break;
+        case M_Add: case M_Sub: case M_Xor: case M_And: case M_Or: case M_Cmp: {
+            const uint8_t digit = ALU_DIGIT[in->op];
+            if (src.kind == MO_Imm && dst.kind == MO_Reg && dst.reg == RAX && (w == 1 || !fits8(src.imm))) {
+                /* the short forms on the accumulator, as as picks them */
+                if (w == 2)
+                    put_byte(e, 0x66);
+                else if (w == 8)
+                    put_byte(e, 0x48);
+                put_byte(e, digit*8 + (w == 1 ? 4 : 5));
+                put_le(e, (uint64_t)src.imm, w == 1 ? 1 : w == 2 ? 2 : 4);
+            } else if (src.kind == MO_Imm && w == 1) {
+                put_rm1(e, w, digit, 0, dst, 0x80);
+                put_byte(e, src.imm);
+            } else if (src.kind == MO_Imm && fits8(src.imm)) {
+                put_rm1(e, w, digit, 0, dst, 0x83);
+                put_byte(e, src.imm);
+            } else if (src.kind == MO_Imm) {
+                put_rm1(e, w, digit, 0, dst, 0x81);
+                put_le(e, (uint64_t)src.imm, 4);
+            } else if (src.kind == MO_Reg) {
+                put_rm1(e, w, src.reg, w == 1, dst, digit*8 + (w == 1 ? 0 : 1));
+            } else {
+                put_rm1(e, w, dst.reg, w == 1, src, digit*8 + (w == 1 ? 2 : 3));
+            }
+            break;
+        }
+        case M_Test: {
+            if (src.kind != MO_Imm) {
+                put_rm1(e, w, src.reg, w == 1, dst, w == 1 ? 0x84 : 0x85);
+                break;
+            }
+            if (dst.kind == MO_Reg && dst.reg == RAX) { /* the short form, as as picks it */
+                if (w == 2)
+                    put_byte(e, 0x66);
+                else if (w == 8)
+                    put_byte(e, 0x48);
+                put_byte(e, w == 1 ? 0xA8 : 0xA9);
+            } else {
+                put_rm1(e, w, 0, 0, dst, w == 1 ? 0xF6 : 0xF7);
+            }
+            put_le(e, (uint64_t)src.imm, w == 1 ? 1 : w == 2 ? 2 : 4);
+            break;
+        }
+        case M_Imul: {
+            if (src.kind != MO_Imm)
+                put_rm2(e, w, dst.reg, 0, src, 0x0F, 0xAF);
+            else if (fits8(src.imm)) {
+                put_rm1(e, w, dst.reg, 0, dst, 0x6B);
+                put_byte(e, src.imm);
+            } else {
+                put_rm1(e, w, dst.reg, 0, dst, 0x69);
+                put_le(e, (uint64_t)src.imm, 4);
+            }
+            break;
+        }
+        case M_Shl: case M_Shr: case M_Sar: {
+            if (src.imm == 1) { /* by one has its own opcode */
+                put_rm1(e, w, UNARY_DIGIT[in->op], 0, dst, w == 1 ? 0xD0 : 0xD1);
+                break;
+            }
+            put_rm1(e, w, UNARY_DIGIT[in->op], 0, dst, w == 1 ? 0xC0 : 0xC1);
+            put_byte(e, src.imm);
+            break;
+        }
+        case M_RepMovsb: put_byte(e, 0xF3); put_byte(e, 0xA4); break;
+        case M_Neg: case M_Mul: case M_Div: case M_Idiv: put_rm1(e, w, UNARY_DIGIT[in->op], 0, src, w == 1 ? 0xF6 : 0xF7); break;
+        case M_Inc: case M_Dec: put_rm1(e, w, UNARY_DIGIT[in->op], 0, src, w == 1 ? 0xFE : 0xFF); break;
+        case M_Cqto: put_byte(e, 0x48); put_byte(e, 0x99); break;
+        case M_Setcc: put_rm2(e, 1, 0, 0, src, 0x0F, 0x90 + in->aux); break;
+        case M_Push: {
+            if (src.kind == MO_Reg)
+                put_plus_reg(e, 0, src.reg, 0x50, 0);
+            else if (src.kind == MO_Imm && fits8(src.imm)) {
+                put_byte(e, 0x6A);
+                put_byte(e, src.imm);
+            } else if (src.kind == MO_Imm) {
+                put_byte(e, 0x68);
+                put_le(e, (uint64_t)src.imm, 4);
+            } else
+                put_rm1(e, 4, 6, 0, src, 0xFF); /* 64 bit without REX.W */
+            break;
+        }
+        case M_Pop: put_plus_reg(e, 0, src.reg, 0x58, 0); break;
+        case M_Jmp: {
+            put_byte(e, near ? 0xEB : 0xE9);
+            put_le(e, (uint64_t)(int64_t)rel, near ? 1 : 4);
+            break;
+        }
+        case M_Jcc: {
+            if (near)
+                put_byte(e, 0x70 + in->aux);
+            else {
+                put_byte(e, 0x0F);
+                put_byte(e, 0x80 + in->aux);
+            }
+            put_le(e, (uint64_t)(int64_t)rel, near ? 1 : 4);
+            break;
+        }
+        case M_Call: put_byte(e, 0xE8); put_le(e, (uint64_t)(int64_t)rel, 4); break;
+        case M_Ret: put_byte(e, 0xC3); break;
+        case M_Leave: put_byte(e, 0xC9); break;
+        case M_Syscall: put_byte(e, 0x0F); put_byte(e, 0x05); break;
+        default: break;
+    }
+}
+
+#define is_branch(_op) ((_op) == M_Jmp || (_op) == M_Jcc)
+
+/*
+** Offsets of every instruction and text label, branches marked in <far> take 32 bits.
+** Returns the size of .text.
+*/
+static uint32_t layout_text(MachineCode* mc, const uint8_t* far, uint32_t* offsets) {
+    uint32_t at = 0;
+    Encoding e;
+    for (size_t i = 0; i < mc->insts.siz; i++) {
+        const MInst* in = &mc->insts.v[i];
+        offsets[i] = at;
+        if (in->op == M_Label) {
+            mc->labels.v[in->src.imm].offset = at;
+            continue;
+        }
+        encode(in, 0, !far[i], &e);
+        at += e.len;
+    }
+    offsets[mc->insts.siz] = at;
+    return at;
+}
+
+/*{==================================*/
+/*
+** API
+*/
+MachineCode* x86_create(InternTable* symbols, Arena* arena) {
+    MachineCode* mc = arena_alloc(arena, sizeof(MachineCode));
+    mc->symbols = symbols;
+    mc->arena = arena;
+    mc->entry = 0;
+    x86_init(arena, mc->insts);
+    x86_init(arena, mc->labels);
+    x86_init(arena, mc->strings);
+    x86_init(arena, mc->bss);
+    return mc;
+}
+
+uint32_t x86_label(MachineCode* mc, MSection section, const char* name, uint32_t len) {
+    x86_push(mc->arena, mc->labels, ((MLabel){.name = name, .len = len, .section = (uint8_t)section, .global = 0, .offset = 0}));
+    return (uint32_t)mc->labels.siz-1;
+}
+
+void x86_put(MachineCode* mc, MOp op, uint8_t width, MOperand src, MOperand dst) {
+    x86_push(mc->arena, mc->insts, ((MInst){.op = (uint8_t)op, .width = width, .aux = 0, .src = src, .dst = dst}));
+}
+
+void x86_print(const MachineCode* mc, FILE* out) {
+    fprintf(out, "    .text\n");
+    for (size_t i = 0; i < mc->insts.siz; i++)
+        print_inst(mc, &mc->insts.v[i], out);
+
+    fprintf(out, "    .section .rodata\n");
+    for (size_t i = 0; i < mc->strings.siz; i++) {
+        fprintf(out, "    .balign 8\n");
+        fprintf(out, "%.*s:\n", label_text(mc, mc->strings.v[i].label));
+        print_string(mc, mc->strings.v[i].text, out);
+    }
+    fprintf(out, "    .bss\n");
+    for (size_t i = 0; i < mc->bss.siz; i++) {
+        fprintf(out, "    .balign 8\n");
+        fprintf(out, "%.*s:\n", label_text(mc, mc->bss.v[i].label));
+        fprintf(out, "    .zero %u\n", mc->bss.v[i].size);
+    }
+}
+
+/*
+** Branches start short and only the ones whose target is out of reach grow,
+** which can push others out of reach, so it goes until nothing changes.
+*/
+X86Object* x86_encode(MachineCode* mc, Arena* arena) {
+    X86Object* obj = arena_alloc(arena, sizeof(X86Object));
+    const size_t n = mc->insts.siz;
+    uint8_t* far = arena_alloc(arena, n+1);
+    uint32_t* offsets = arena_alloc(arena, sizeof(uint32_t)*(n+1));
+    memset(far, 0, n+1);
+
+    uint32_t size = layout_text(mc, far, offsets);
+    for (int changed = 1; changed;) {
+        changed = 0;
+        for (size_t i = 0; i < n; i++) {
+            const MInst* in = &mc->insts.v[i];
+            if (!is_branch(in->op) || far[i])
+                continue;
+            int64_t rel = (int64_t)mc->labels.v[in->src.imm].offset - offsets[i+1];
+            if (!fits8(rel)) {
+                far[i] = 1;
+                changed = 1;
+            }
+        }
+        if (changed)
+            size = layout_text(mc, far, offsets);
+    }
+
+    /* .text */
+    obj->text = arena_alloc(arena, size+1);
+    obj->text_size = size;
+    size_t relocs_cap = X86_INIT_CAPACITY;
+    obj->relocs = arena_alloc(arena, sizeof(X86Reloc)*relocs_cap);
+    obj->relocs_siz = 0;
+    Encoding e;
+    for (size_t i = 0; i < n; i++) {
+        const MInst* in = &mc->insts.v[i];
+        int32_t rel = 0;
+        if (is_branch(in->op) || in->op == M_Call)
+            rel = (int32_t)((int64_t)mc->labels.v[in->src.imm].offset - offsets[i+1]);
+        encode(in, rel, !far[i], &e);
+        memcpy(obj->text + offsets[i], e.bytes, e.len);
+        if (e.disp < 0)
+            continue;
+        if (obj->relocs_siz + 1 > relocs_cap) {
+            obj->relocs = arena_realloc(arena, obj->relocs, sizeof(X86Reloc)*relocs_cap, sizeof(X86Reloc)*relocs_cap*X86_GROWTH);
+            relocs_cap *= X86_GROWTH;
+        }
+        const MOperand* ref = in->src.kind == MO_Label ? &in->src : &in->dst;
+        obj->relocs[obj->relocs_siz++] = (X86Reloc){
+            .offset = offsets[i] + (uint32_t)e.disp,
+            .label = (uint32_t)ref->imm,
+            .addend = -(int32_t)(e.len - e.disp), /* from the end of the instruction */
+        };
+    }
+
+    /* .rodata, strings are 8 byte aligned */
+    uint32_t at = 0;
+    for (size_t i = 0; i < mc->strings.siz; i++) {
+        at = (at + 7) & ~7u;
+        mc->labels.v[mc->strings.v[i].label].offset = at;
+        at += 8 + symbol_len(mc->symbols, mc->strings.v[i].text);
+    }
+    obj->rodata_size = at;
+    obj->rodata = arena_alloc(arena, at+1);
+    memset(obj->rodata, 0, at+1);
+    for (size_t i = 0; i < mc->strings.siz; i++) {
+        const MString* str = &mc->strings.v[i];
+        const uint64_t len = symbol_len(mc->symbols, str->text);
+        uint8_t* p = obj->rodata + mc->labels.v[str->label].offset;
+        for (int k = 0; k < 8; k++)
+            p[k] = (uint8_t)(len >> (k*8));
+        memcpy(p+8, symbol_name(mc->symbols, str->text), len);
+    }
+
+    /* .bss */
+    at = 0;
+    for (size_t i = 0; i < mc->bss.siz; i++) {
+        at = (at + 7) & ~7u;
+        mc->labels.v[mc->bss.v[i].label].offset = at;
+        at += mc->bss.v[i].size;
+    }
+    obj->bss_size = at;
+    return obj;
+}